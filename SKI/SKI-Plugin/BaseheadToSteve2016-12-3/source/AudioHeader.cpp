@@ -0,0 +1,349 @@
+//------------------------------------------------------------------------
+//
+// Project     : BaseHeadSKI
+// Filename    : AudioHeader.cpp
+// Description : Reads sample rate, channels, length and BWF time reference
+//				 from the header of WAV, BWF, RF64, Wave64 and AIFF files
+//
+//------------------------------------------------------------------------
+#include "AudioHeader.h"
+#include "MappedFile.h"
+
+#include <math.h>
+
+// 32 bit builds cannot map a file of several GB; headers written before
+// the sample data are always within this
+#define AUDIOHEADER_MAX_MAP_32	(64 << 20)
+
+// bext: Description, Originator, OriginatorReference, OriginationDate and
+// OriginationTime come before TimeReferenceLow and TimeReferenceHigh
+#define BEXT_TIME_REFERENCE_OFFSET	338
+
+//------------------------------------------------------------------------
+static inline uint16_t getLE16 (const unsigned char* p) { return (uint16_t)(p[0] | (p[1] << 8)); }
+static inline uint32_t getLE32 (const unsigned char* p) { return p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t)p[3] << 24); }
+static inline uint64_t getLE64 (const unsigned char* p) { return getLE32 (p) | ((uint64_t)getLE32 (p + 4) << 32); }
+static inline uint16_t getBE16 (const unsigned char* p) { return (uint16_t)((p[0] << 8) | p[1]); }
+static inline uint32_t getBE32 (const unsigned char* p) { return ((uint32_t)p[0] << 24) | (p[1] << 16) | (p[2] << 8) | p[3]; }
+static inline uint64_t getBE64 (const unsigned char* p) { return ((uint64_t)getBE32 (p) << 32) | getBE32 (p + 4); }
+
+//------------------------------------------------------------------------
+// IEEE 754 80 bit extended, as AIFF stores the sample rate
+static double getExtended (const unsigned char* p)
+{
+	int nExponent = ((p[0] & 0x7F) << 8) | p[1];
+	uint64_t nMantissa = getBE64 (p + 2);
+	if (nExponent == 0x7FFF)
+		return 0.0;		// infinity or NaN, no usable rate
+	double value = ldexp ((double)nMantissa, nExponent - 16383 - 63);
+	return (p[0] & 0x80) ? -value : value;
+}
+
+//------------------------------------------------------------------------
+// What the chunks of a WAV, RF64 or Wave64 file contributed so far
+struct WaveChunks
+{
+	bool bHasFormat;
+	bool bHasData;
+	bool bHasDs64;
+	uint64_t nDs64DataSize;
+	uint64_t nDataSize;
+
+	WaveChunks () : bHasFormat (false), bHasData (false), bHasDs64 (false), nDs64DataSize (0), nDataSize (0) {}
+};
+
+//------------------------------------------------------------------------
+// One chunk of the common WAV family layout. pBody points to nAvailable
+// mapped bytes of a body nBodySize long, which starts at nBodyOffset in
+// the file. Returns the body size to skip, which differs from nBodySize
+// for the data chunk of RF64.
+static uint64_t readWaveChunk (const char* pId, const unsigned char* pBody, size_t nAvailable, uint64_t nBodySize,
+	uint64_t nBodyOffset, WaveChunks& chunks, AudioFileInfo& info)
+{
+	if (memcmp (pId, "fmt ", 4) == 0 && nAvailable >= 16 && nBodySize >= 16)
+	{
+		uint16_t nTag = getLE16 (pBody);
+		info.nChannels = getLE16 (pBody + 2);
+		info.nSampleRate = getLE32 (pBody + 4);
+		info.nBlockAlign = getLE16 (pBody + 12);
+		info.nBitsPerSample = getLE16 (pBody + 14);
+		if (nTag == 0xFFFE && nAvailable >= 26 && nBodySize >= 26)
+			nTag = getLE16 (pBody + 24);	// WAVE_FORMAT_EXTENSIBLE: start of the sub format GUID
+		info.bFloat = nTag == 3;
+		info.bCompressed = nTag != 1 && nTag != 3;
+		chunks.bHasFormat = true;
+	}
+	else if (memcmp (pId, "ds64", 4) == 0 && nAvailable >= 24)
+	{
+		chunks.nDs64DataSize = getLE64 (pBody + 8);
+		chunks.bHasDs64 = true;
+	}
+	else if (memcmp (pId, "bext", 4) == 0 && nAvailable >= BEXT_TIME_REFERENCE_OFFSET + 8)
+	{
+		info.nTimeReference = getLE64 (pBody + BEXT_TIME_REFERENCE_OFFSET);
+		info.bHasTimeReference = true;
+	}
+	else if (memcmp (pId, "data", 4) == 0 && !chunks.bHasData)
+	{
+		// RF64 and BW64 keep the real size in ds64
+		if (nBodySize == 0xFFFFFFFF && chunks.bHasDs64)
+			nBodySize = chunks.nDs64DataSize;
+		info.nDataOffset = nBodyOffset;
+		chunks.nDataSize = nBodySize;
+		chunks.bHasData = true;
+	}
+	return nBodySize;
+}
+
+//------------------------------------------------------------------------
+static const char* finishWave (const WaveChunks& chunks, uint64_t nFileSize, AudioFileInfo& info)
+{
+	if (!chunks.bHasFormat)
+		return "No format chunk";
+	if (!chunks.bHasData)
+		return "No data chunk";
+	if (info.nChannels == 0 || info.nSampleRate == 0 || info.nBlockAlign == 0)
+		return "Invalid format chunk";
+
+	// recordings that were cut off keep the size they were started with
+	uint64_t nDataSize = chunks.nDataSize;
+	if (info.nDataOffset + nDataSize > nFileSize)
+		nDataSize = nFileSize > info.nDataOffset ? nFileSize - info.nDataOffset : 0;
+	info.nFrames = nDataSize / info.nBlockAlign;
+	return 0;
+}
+
+//------------------------------------------------------------------------
+// RIFF, RF64 and BW64: 4 byte ids, 32 bit sizes, bodies padded to even
+static const char* parseWave (const unsigned char* pData, size_t nSize, uint64_t nFileSize, AudioFileInfo& info)
+{
+	WaveChunks chunks;
+	uint64_t nPos = 12;
+	while (nPos + 8 <= nSize)
+	{
+		const unsigned char* pChunk = pData + nPos;
+		uint64_t nBodySize = getLE32 (pChunk + 4);
+		nBodySize = readWaveChunk ((const char*)pChunk, pChunk + 8, (size_t)(nSize - nPos - 8), nBodySize, nPos + 8, chunks, info);
+		if (nBodySize >= nFileSize)
+			break;
+		nPos += 8 + nBodySize + (nBodySize & 1);
+	}
+	return finishWave (chunks, nFileSize, info);
+}
+
+//------------------------------------------------------------------------
+// Sony Wave64: GUID ids, 64 bit sizes that include the 24 byte chunk
+// header, chunks aligned to 8 bytes. The GUIDs of the chunks start with
+// the RIFF id and share the last 12 bytes.
+static const unsigned char kWave64GuidSuffix[12] = {0xF3, 0xAC, 0xD3, 0x11, 0x8C, 0xD1, 0x00, 0xC0, 0x4F, 0x8E, 0xDB, 0x8A};
+
+static const char* parseWave64 (const unsigned char* pData, size_t nSize, uint64_t nFileSize, AudioFileInfo& info)
+{
+	if (nSize < 40 || memcmp (pData + 24, "wave", 4) != 0 || memcmp (pData + 28, kWave64GuidSuffix, 12) != 0)
+		return "Invalid Wave64 header";
+
+	WaveChunks chunks;
+	uint64_t nPos = 40;
+	while (nPos + 24 <= nSize)
+	{
+		const unsigned char* pChunk = pData + nPos;
+		uint64_t nChunkSize = getLE64 (pChunk + 16);
+		if (nChunkSize < 24 || nChunkSize > nFileSize)
+			break;
+		if (memcmp (pChunk + 4, kWave64GuidSuffix, 12) == 0)
+			readWaveChunk ((const char*)pChunk, pChunk + 24, (size_t)(nSize - nPos - 24), nChunkSize - 24, nPos + 24, chunks, info);
+		nPos += (nChunkSize + 7) & ~(uint64_t)7;
+	}
+	return finishWave (chunks, nFileSize, info);
+}
+
+//------------------------------------------------------------------------
+// AIFF and AIFC: big endian, 32 bit sizes, bodies padded to even
+static const char* parseAiff (const unsigned char* pData, size_t nSize, uint64_t nFileSize, AudioFileInfo& info)
+{
+	bool bAifc = memcmp (pData + 8, "AIFC", 4) == 0;
+	bool bHasCommon = false;
+	bool bHasData = false;
+	uint32_t nFrames = 0;
+
+	info.bBigEndian = true;
+	uint64_t nPos = 12;
+	while (nPos + 8 <= nSize)
+	{
+		const unsigned char* pChunk = pData + nPos;
+		const unsigned char* pBody = pChunk + 8;
+		uint64_t nAvailable = nSize - nPos - 8;
+		uint64_t nBodySize = getBE32 (pChunk + 4);
+
+		if (memcmp (pChunk, "COMM", 4) == 0 && nAvailable >= 18 && nBodySize >= 18)
+		{
+			info.nChannels = getBE16 (pBody);
+			nFrames = getBE32 (pBody + 2);
+			info.nBitsPerSample = getBE16 (pBody + 6);
+			double rate = getExtended (pBody + 8);
+			info.nSampleRate = rate > 0.0 && rate < 4294967295.0 ? (uint32_t)(rate + 0.5) : 0;
+			if (bAifc && nAvailable >= 22 && nBodySize >= 22)
+			{
+				const char* pCompression = (const char*)pBody + 18;
+				if (memcmp (pCompression, "sowt", 4) == 0)
+					info.bBigEndian = false;
+				else if (memcmp (pCompression, "fl32", 4) == 0 || memcmp (pCompression, "FL32", 4) == 0
+					|| memcmp (pCompression, "fl64", 4) == 0 || memcmp (pCompression, "FL64", 4) == 0)
+					info.bFloat = true;
+				else if (memcmp (pCompression, "NONE", 4) != 0)
+					info.bCompressed = true;
+			}
+			bHasCommon = true;
+		}
+		else if (memcmp (pChunk, "SSND", 4) == 0 && nAvailable >= 8 && !bHasData)
+		{
+			info.nDataOffset = nPos + 16 + getBE32 (pBody);
+			bHasData = true;
+		}
+		nPos += 8 + nBodySize + (nBodySize & 1);
+	}
+
+	if (!bHasCommon)
+		return "No common chunk";
+	if (info.nChannels == 0 || info.nSampleRate == 0 || info.nBitsPerSample == 0)
+		return "Invalid common chunk";
+	info.nBlockAlign = info.nChannels * ((info.nBitsPerSample + 7) / 8);
+
+	// no SSND chunk is fine for a file without samples
+	info.nFrames = bHasData ? nFrames : 0;
+	if (bHasData && !info.bCompressed && info.nDataOffset + info.nFrames * info.nBlockAlign > nFileSize)
+		info.nFrames = nFileSize > info.nDataOffset ? (nFileSize - info.nDataOffset) / info.nBlockAlign : 0;
+	return 0;
+}
+
+//------------------------------------------------------------------------
+const char* parseAudioHeader (const unsigned char* pData, size_t nSize, uint64_t nFileSize, AudioFileInfo& info /*out*/)
+{
+	info = AudioFileInfo ();
+	if (nSize < 12)
+		return "File too short";
+
+	if (nSize >= 16 && memcmp (pData, "riff", 4) == 0 && memcmp (pData + 4, "\x2E\x91\xCF\x11\xA5\xD6\x28\xDB\x04\xC1\x00\x00", 12) == 0)
+	{
+		info.format = kProbeFormatWave64;
+		return parseWave64 (pData, nSize, nFileSize, info);
+	}
+	if (memcmp (pData + 8, "WAVE", 4) == 0)
+	{
+		if (memcmp (pData, "RIFF", 4) == 0)
+			info.format = kProbeFormatWave;
+		else if (memcmp (pData, "RF64", 4) == 0 || memcmp (pData, "BW64", 4) == 0)
+			info.format = kProbeFormatRF64;
+		else
+			return "Unknown audio format";
+		return parseWave (pData, nSize, nFileSize, info);
+	}
+	if (memcmp (pData, "FORM", 4) == 0 && (memcmp (pData + 8, "AIFF", 4) == 0 || memcmp (pData + 8, "AIFC", 4) == 0))
+	{
+		info.format = kProbeFormatAiff;
+		return parseAiff (pData, nSize, nFileSize, info);
+	}
+	return "Unknown audio format";
+}
+
+//------------------------------------------------------------------------
+static size_t getMapSize (uint64_t nFileSize)
+{
+	if (sizeof (void*) < 8 && nFileSize > AUDIOHEADER_MAX_MAP_32)
+		return AUDIOHEADER_MAX_MAP_32;
+	return (size_t)nFileSize;
+}
+
+//------------------------------------------------------------------------
+const char* readAudioHeader (const string& szPath, AudioFileInfo& info /*out*/)
+{
+	CMappedFile file;
+	const char* error = file.open (szPath);
+	if (!error)
+		error = file.map (0, getMapSize (file.GetSize ()));
+	if (!error)
+		error = parseAudioHeader (file.GetData (), file.GetMappedSize (), file.GetSize (), info);
+	return error;
+}
+
+//------------------------------------------------------------------------
+CAudioInfoCache::CAudioInfoCache (size_t nCapacity)
+: m_nCapacity (nCapacity > 0 ? nCapacity : 1)
+{
+}
+
+//------------------------------------------------------------------------
+CAudioInfoCache::~CAudioInfoCache ()
+{
+}
+
+//------------------------------------------------------------------------
+CAudioInfoCache& CAudioInfoCache::shared ()
+{
+	static CAudioInfoCache cache;
+	return cache;
+}
+
+//------------------------------------------------------------------------
+const char* CAudioInfoCache::getInfo (const string& szPath, AudioFileInfo& info /*out*/)
+{
+	CMappedFile file;
+	const char* error = file.open (szPath);
+	if (error)
+		return error;
+
+	{
+		std::lock_guard<std::mutex> guard (m_Lock);
+		std::unordered_map<string, EntryList::iterator>::iterator it = m_Index.find (szPath);
+		if (it != m_Index.end ())
+		{
+			Entry& entry = *it->second;
+			if (entry.nSize == file.GetSize () && entry.nModified == file.GetModified ())
+			{
+				m_Entries.splice (m_Entries.begin (), m_Entries, it->second);
+				info = entry.info;
+				return entry.error;
+			}
+			m_Entries.erase (it->second);
+			m_Index.erase (it);
+		}
+	}
+
+	// parsed without the lock, a thread racing for the same file only
+	// costs a second parse
+	error = file.map (0, getMapSize (file.GetSize ()));
+	if (error)
+	{
+		info = AudioFileInfo ();
+		return error;
+	}
+	error = parseAudioHeader (file.GetData (), file.GetMappedSize (), file.GetSize (), info);
+
+	std::lock_guard<std::mutex> guard (m_Lock);
+	if (m_Index.find (szPath) != m_Index.end ())
+		return error;
+
+	Entry entry;
+	entry.szPath = szPath;
+	entry.nSize = file.GetSize ();
+	entry.nModified = file.GetModified ();
+	entry.error = error;
+	entry.info = info;
+	m_Entries.push_front (entry);
+	m_Index[szPath] = m_Entries.begin ();
+
+	while (m_Entries.size () > m_nCapacity)
+	{
+		m_Index.erase (m_Entries.back ().szPath);
+		m_Entries.pop_back ();
+	}
+	return error;
+}
+
+//------------------------------------------------------------------------
+void CAudioInfoCache::clear ()
+{
+	std::lock_guard<std::mutex> guard (m_Lock);
+	m_Index.clear ();
+	m_Entries.clear ();
+}
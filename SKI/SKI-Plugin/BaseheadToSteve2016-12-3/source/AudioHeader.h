@@ -0,0 +1,97 @@
+//------------------------------------------------------------------------
+//
+// Project     : BaseHeadSKI
+// Filename    : AudioHeader.h
+// Description : Reads sample rate, channels, length and BWF time reference
+//				 from the header of WAV, BWF, RF64, Wave64 and AIFF files
+//
+//------------------------------------------------------------------------
+#if !defined(AUDIOHEADER_H)
+#define AUDIOHEADER_H
+
+#if _MSC_VER > 1000
+#pragma once
+#endif // _MSC_VER > 1000
+
+#include "FileProbe.h"
+
+#include <list>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <string.h>
+#include <stdint.h>
+using namespace std;
+
+// files whose header is kept by CAudioInfoCache::shared ()
+#define AUDIOINFO_CACHE_SIZE	1024
+
+//------------------------------------------------------------------------
+struct AudioFileInfo
+{
+	int format;					// kProbeFormatWave, ...RF64, ...Wave64 or ...Aiff
+	uint32_t nSampleRate;		// rounded for AIFF, which stores it as 80 bit float
+	uint16_t nChannels;
+	uint16_t nBitsPerSample;
+	uint32_t nBlockAlign;		// bytes per frame
+	uint64_t nFrames;
+	uint64_t nDataOffset;		// first byte of the sample data in the file
+	bool bFloat;
+	bool bBigEndian;			// AIFF, except AIFC 'sowt'
+	bool bCompressed;			// samples are not plain PCM or float
+	bool bHasTimeReference;		// BWF bext chunk
+	uint64_t nTimeReference;	// samples since midnight
+
+	AudioFileInfo () { memset (this, 0, sizeof (*this)); }
+
+	double getDuration () const { return nSampleRate ? (double)nFrames / nSampleRate : 0.0; }
+	double getTimeReference () const { return nSampleRate ? (double)nTimeReference / nSampleRate : 0.0; }
+};
+
+// Parses the header in the first nSize bytes of a file of nFileSize
+// bytes; returns 0 on success or what is wrong with it. Chunks are only
+// read where they lie in pData, the sample data is never touched.
+const char* parseAudioHeader (const unsigned char* pData, size_t nSize, uint64_t nFileSize, AudioFileInfo& info /*out*/);
+
+// Maps the UTF-8 path read only and parses its header. Only the pages
+// holding chunk headers are read from disk.
+const char* readAudioHeader (const string& szPath, AudioFileInfo& info /*out*/);
+
+//------------------------------------------------------------------------
+// Parsed headers of the most recently used files. An entry is used as
+// long as the file's size and modification time are unchanged, so every
+// lookup still opens the file, but never reads it again. Any thread.
+//------------------------------------------------------------------------
+class CAudioInfoCache
+{
+public:
+	//--------------------------------------------------------------------
+	CAudioInfoCache (size_t nCapacity = AUDIOINFO_CACHE_SIZE);
+	virtual ~CAudioInfoCache ();
+
+	// Like readAudioHeader ()
+	const char* getInfo (const string& szPath, AudioFileInfo& info /*out*/);
+	void clear ();
+
+	// The cache used by the plugin
+	static CAudioInfoCache& shared ();
+
+//------------------------------------------------------------------------
+private:
+	struct Entry
+	{
+		string szPath;
+		uint64_t nSize;
+		uint64_t nModified;
+		const char* error;		// parse errors are cached as well
+		AudioFileInfo info;
+	};
+	typedef std::list<Entry> EntryList;
+
+	std::mutex m_Lock;
+	EntryList m_Entries;		// most recently used first
+	std::unordered_map<string, EntryList::iterator> m_Index;
+	size_t m_nCapacity;
+};
+
+#endif // !defined(AUDIOHEADER_H)
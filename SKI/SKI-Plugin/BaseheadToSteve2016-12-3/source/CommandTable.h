@@ -0,0 +1,170 @@
+//------------------------------------------------------------------------
+//
+// Project     : BaseHeadSKI
+// Filename    : CommandTable.h
+// Description : Compile time perfect hash over the command names of the
+//				 pipe protocol, case insensitive
+//
+//------------------------------------------------------------------------
+#if !defined(COMMANDTABLE_H)
+#define COMMANDTABLE_H
+
+#if _MSC_VER > 1000
+#pragma once
+#endif // _MSC_VER > 1000
+
+#include <string_view>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+
+//------------------------------------------------------------------------
+constexpr char foldCommandChar (char c)
+{
+	return (c >= 'A' && c <= 'Z') ? (char)(c + ('a' - 'A')) : c;
+}
+
+//------------------------------------------------------------------------
+// Like gperf, only the length and a few key characters are hashed (the
+// first two, the middle and the last two, case folded), so the cost does
+// not grow with the name; varied by seed. Names that agree in all of
+// them can not be told apart, CommandTable::isValid () is then false.
+constexpr uint32_t hashCommandName (std::string_view name, uint32_t nSeed)
+{
+	size_t n = name.size ();
+	uint64_t nKey = n;
+	if (n > 0)
+	{
+		nKey |= (uint64_t)(unsigned char)foldCommandChar (name[0]) << 8;
+		nKey |= (uint64_t)(unsigned char)foldCommandChar (name[n > 1 ? 1 : 0]) << 16;
+		nKey |= (uint64_t)(unsigned char)foldCommandChar (name[n / 2]) << 24;
+		nKey |= (uint64_t)(unsigned char)foldCommandChar (name[n > 1 ? n - 2 : 0]) << 32;
+		nKey |= (uint64_t)(unsigned char)foldCommandChar (name[n - 1]) << 40;
+	}
+	uint64_t h = (nKey ^ (nSeed * 0x9E3779B97F4A7C15ull)) * 0xFF51AFD7ED558CCDull;
+	return (uint32_t)(h >> 32);
+}
+
+//------------------------------------------------------------------------
+constexpr bool equalsCommandName (std::string_view a, std::string_view b)
+{
+	if (a.size () != b.size ())
+		return false;
+	for (size_t i = 0; i < a.size (); i++)
+	{
+		if (foldCommandChar (a[i]) != foldCommandChar (b[i]))
+			return false;
+	}
+	return true;
+}
+
+//------------------------------------------------------------------------
+// foldCommandChar () on eight characters at once; bytes from 0x80 up are
+// left alone
+inline uint64_t foldCommandWord (uint64_t w)
+{
+	uint64_t nLow7 = w & 0x7F7F7F7F7F7F7F7Full;
+	uint64_t nAboveZ = nLow7 + 0x2525252525252525ull;	// bit 7 set above 'Z'
+	uint64_t nFromA = nLow7 + 0x3F3F3F3F3F3F3F3Full;	// bit 7 set from 'A'
+	uint64_t nUpper = ~w & (nFromA ^ nAboveZ) & 0x8080808080808080ull;
+	return w | (nUpper >> 2);
+}
+
+//------------------------------------------------------------------------
+// equalsCommandName () for lookups at run time, eight characters a step
+inline bool matchesCommandName (std::string_view a, std::string_view b)
+{
+	size_t n = a.size ();
+	if (n != b.size ())
+		return false;
+
+	uint64_t wa = 0, wb = 0;
+	if (n < 8)
+	{
+		memcpy (&wa, a.data (), n);
+		memcpy (&wb, b.data (), n);
+		return foldCommandWord (wa) == foldCommandWord (wb);
+	}
+
+	// the last step overlaps the one before unless n is a multiple of 8
+	for (size_t i = 0; ; i += 8)
+	{
+		if (i > n - 8)
+			i = n - 8;
+		memcpy (&wa, a.data () + i, 8);
+		memcpy (&wb, b.data () + i, 8);
+		if (foldCommandWord (wa) != foldCommandWord (wb))
+			return false;
+		if (i == n - 8)
+			return true;
+	}
+}
+
+//------------------------------------------------------------------------
+// Built from a fixed list of names at compile time: the constructor
+// searches a seed for which no two names share a slot, so find () costs
+// one hash and one compare. isValid () is false if no seed up to
+// kMaxSeed works; check it with a static_assert.
+//------------------------------------------------------------------------
+template <size_t N>
+class CommandTable
+{
+public:
+	//--------------------------------------------------------------------
+	static constexpr size_t kSlots = (N * 2 <= 8) ? 8 : (N * 2 <= 16) ? 16 : (N * 2 <= 32) ? 32 : 64;
+	static constexpr uint32_t kMaxSeed = 1000;
+
+	static_assert (N * 2 <= 64, "too many commands for CommandTable");
+
+	constexpr CommandTable (const char* const (&names)[N])
+	: m_Names {}
+	, m_Slots {}
+	, m_nSeed (0)
+	{
+		for (size_t i = 0; i < N; i++)
+			m_Names[i] = names[i];
+
+		for (uint32_t nSeed = 1; nSeed <= kMaxSeed && m_nSeed == 0; nSeed++)
+		{
+			if (fill (nSeed))
+				m_nSeed = nSeed;
+		}
+	}
+
+	constexpr bool isValid () const { return m_nSeed != 0; }
+	constexpr size_t size () const { return N; }
+	constexpr const char* getName (size_t nIndex) const { return m_Names[nIndex].data (); }
+
+	// index of name in the list given to the constructor, -1 if unknown
+	int find (std::string_view name) const
+	{
+		int nIndex = m_Slots[hashCommandName (name, m_nSeed) & (kSlots - 1)] - 1;
+		if (nIndex < 0 || !matchesCommandName (m_Names[nIndex], name))
+			return -1;
+		return nIndex;
+	}
+
+//------------------------------------------------------------------------
+private:
+	constexpr bool fill (uint32_t nSeed)
+	{
+		for (size_t i = 0; i < kSlots; i++)
+			m_Slots[i] = 0;
+
+		for (size_t i = 0; i < N; i++)
+		{
+			size_t nSlot = hashCommandName (m_Names[i], nSeed) & (kSlots - 1);
+			if (m_Slots[nSlot] != 0)
+				return false;
+			m_Slots[nSlot] = (unsigned char)(i + 1);
+		}
+		return true;
+	}
+
+	std::string_view m_Names[N];	// of string literals, so zero terminated
+	unsigned char m_Slots[kSlots];	// index + 1, 0 for an empty slot
+	uint32_t m_nSeed;
+};
+
+#endif // !defined(COMMANDTABLE_H)
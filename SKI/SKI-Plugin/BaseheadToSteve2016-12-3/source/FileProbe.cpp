@@ -0,0 +1,220 @@
+//------------------------------------------------------------------------
+//
+// Project     : BaseHeadSKI
+// Filename    : FileProbe.cpp
+// Description : Checks files before they are handed to the host: exists
+//				 and readable, and which audio format it starts like
+//
+//------------------------------------------------------------------------
+#include "FileProbe.h"
+#include "UtfConvert.h"
+
+#include <string.h>
+
+#if defined(_WIN32)
+#include <windows.h>
+#else
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#endif
+
+// enough for every signature in detectFormat ()
+#define PROBE_HEADER_SIZE	16
+
+//------------------------------------------------------------------------
+static int detectFormat (const unsigned char* pHeader, size_t nSize)
+{
+	static const unsigned char wave64Guid[] = {'r', 'i', 'f', 'f', 0x2E, 0x91, 0xCF, 0x11, 0xA5, 0xD6, 0x28, 0xDB, 0x04, 0xC1, 0x00, 0x00};
+
+	if (nSize >= 16 && memcmp (pHeader, wave64Guid, 16) == 0)
+		return kProbeFormatWave64;
+	if (nSize >= 12 && memcmp (pHeader + 8, "WAVE", 4) == 0)
+	{
+		if (memcmp (pHeader, "RIFF", 4) == 0)
+			return kProbeFormatWave;
+		if (memcmp (pHeader, "RF64", 4) == 0 || memcmp (pHeader, "BW64", 4) == 0)
+			return kProbeFormatRF64;
+	}
+	if (nSize >= 12 && memcmp (pHeader, "FORM", 4) == 0
+		&& (memcmp (pHeader + 8, "AIFF", 4) == 0 || memcmp (pHeader + 8, "AIFC", 4) == 0))
+		return kProbeFormatAiff;
+	if (nSize >= 4 && memcmp (pHeader, "fLaC", 4) == 0)
+		return kProbeFormatFlac;
+	if (nSize >= 4 && memcmp (pHeader, "OggS", 4) == 0)
+		return kProbeFormatOgg;
+	if (nSize >= 4 && memcmp (pHeader, "caff", 4) == 0)
+		return kProbeFormatCaf;
+	if (nSize >= 8 && memcmp (pHeader + 4, "ftyp", 4) == 0)
+		return kProbeFormatMp4;
+	if (nSize >= 3 && memcmp (pHeader, "ID3", 3) == 0)
+		return kProbeFormatMp3;
+	if (nSize >= 2 && pHeader[0] == 0xFF && (pHeader[1] & 0xE0) == 0xE0)
+		return kProbeFormatMp3;		// MPEG frame sync
+	return kProbeFormatUnknown;
+}
+
+//------------------------------------------------------------------------
+FileProbe probeFile (const string& szPath)
+{
+	FileProbe probe;
+	unsigned char header[PROBE_HEADER_SIZE];
+	size_t nRead = 0;
+
+#if defined(_WIN32)
+	u16string szWidePath = toUtf16 (szPath);
+	LPCWSTR pWidePath = (LPCWSTR)szWidePath.c_str ();
+
+	WIN32_FILE_ATTRIBUTE_DATA attributes;
+	if (!GetFileAttributesExW (pWidePath, GetFileExInfoStandard, &attributes))
+	{
+		DWORD dwError = GetLastError ();
+		probe.error = (dwError == ERROR_FILE_NOT_FOUND || dwError == ERROR_PATH_NOT_FOUND) ? "File not found" : "File not accessible";
+		return probe;
+	}
+	if (attributes.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY)
+	{
+		probe.error = "Not a file";
+		return probe;
+	}
+	probe.size = ((uint64_t)attributes.nFileSizeHigh << 32) | attributes.nFileSizeLow;
+
+	HANDLE hFile = CreateFileW (pWidePath, GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE,
+		NULL, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+	if (hFile == INVALID_HANDLE_VALUE)
+	{
+		probe.error = "Couldn't open file";
+		return probe;
+	}
+	DWORD dwRead = 0;
+	BOOL bRead = ReadFile (hFile, header, sizeof (header), &dwRead, NULL);
+	CloseHandle (hFile);
+	if (!bRead)
+	{
+		probe.error = "Couldn't read file";
+		return probe;
+	}
+	nRead = dwRead;
+#else
+	struct stat status;
+	if (stat (szPath.c_str (), &status) != 0)
+	{
+		probe.error = (errno == ENOENT || errno == ENOTDIR) ? "File not found" : "File not accessible";
+		return probe;
+	}
+	if (!S_ISREG (status.st_mode))
+	{
+		probe.error = "Not a file";
+		return probe;
+	}
+	probe.size = (uint64_t)status.st_size;
+
+	int nFile = open (szPath.c_str (), O_RDONLY);
+	if (nFile < 0)
+	{
+		probe.error = "Couldn't open file";
+		return probe;
+	}
+	ssize_t nResult = read (nFile, header, sizeof (header));
+	close (nFile);
+	if (nResult < 0)
+	{
+		probe.error = "Couldn't read file";
+		return probe;
+	}
+	nRead = (size_t)nResult;
+#endif
+
+	probe.format = detectFormat (header, nRead);
+	return probe;
+}
+
+//------------------------------------------------------------------------
+CFileProbePool::CFileProbePool (unsigned int nMaxThreads)
+: m_nMaxThreads (nMaxThreads)
+, m_bShutDown (false)
+{
+	unsigned int nCores = std::thread::hardware_concurrency ();
+	if (nCores > 0 && nCores < m_nMaxThreads)
+		m_nMaxThreads = nCores;
+	if (m_nMaxThreads == 0)
+		m_nMaxThreads = 1;
+}
+
+//------------------------------------------------------------------------
+CFileProbePool::~CFileProbePool ()
+{
+	{
+		std::lock_guard<std::mutex> guard (m_Lock);
+		m_bShutDown = true;
+		m_Tasks.clear ();
+	}
+	m_TaskAdded.notify_all ();
+
+	for (size_t i = 0; i < m_Threads.size (); i++)
+		m_Threads[i].join ();
+}
+
+//------------------------------------------------------------------------
+void CFileProbePool::probe (const std::vector<string>& paths, Completion completion)
+{
+	std::shared_ptr<Batch> batch = std::make_shared<Batch> ();
+	batch->paths = paths;
+	batch->probes.resize (paths.size ());
+	batch->nRemaining = paths.size ();
+	batch->completion = completion;
+
+	if (paths.empty ())
+	{
+		batch->completion (batch->probes);
+		return;
+	}
+
+	{
+		std::lock_guard<std::mutex> guard (m_Lock);
+		startThreads ();
+		for (size_t i = 0; i < paths.size (); i++)
+		{
+			Task task;
+			task.batch = batch;
+			task.nIndex = i;
+			m_Tasks.push_back (task);
+		}
+	}
+	m_TaskAdded.notify_all ();
+}
+
+//------------------------------------------------------------------------
+// m_Lock is held
+void CFileProbePool::startThreads ()
+{
+	while (m_Threads.size () < m_nMaxThreads)
+		m_Threads.push_back (std::thread (&CFileProbePool::work, this));
+}
+
+//------------------------------------------------------------------------
+void CFileProbePool::work ()
+{
+	std::unique_lock<std::mutex> lock (m_Lock);
+	while (true)
+	{
+		m_TaskAdded.wait (lock, [this] { return m_bShutDown || !m_Tasks.empty (); });
+		if (m_bShutDown)
+			break;
+
+		Task task = m_Tasks.front ();
+		m_Tasks.pop_front ();
+
+		lock.unlock ();
+		task.batch->probes[task.nIndex] = probeFile (task.batch->paths[task.nIndex]);
+		lock.lock ();
+
+		if (--task.batch->nRemaining == 0)
+		{
+			lock.unlock ();
+			task.batch->completion (task.batch->probes);
+			lock.lock ();
+		}
+	}
+}
@@ -0,0 +1,97 @@
+//------------------------------------------------------------------------
+//
+// Project     : BaseHeadSKI
+// Filename    : FileProbe.h
+// Description : Checks files before they are handed to the host: exists
+//				 and readable, and which audio format it starts like
+//
+//------------------------------------------------------------------------
+#if !defined(FILEPROBE_H)
+#define FILEPROBE_H
+
+#if _MSC_VER > 1000
+#pragma once
+#endif // _MSC_VER > 1000
+
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include <stdint.h>
+using namespace std;
+
+// audio formats recognized by their first bytes; the host decides what it
+// can import, so files of any other format pass as kProbeFormatUnknown
+#define kProbeFormatUnknown	0
+#define kProbeFormatWave	1	/* RIFF/WAVE, also BWF */
+#define kProbeFormatRF64	2	/* RF64 and BW64 */
+#define kProbeFormatWave64	3
+#define kProbeFormatAiff	4	/* AIFF and AIFC */
+#define kProbeFormatFlac	5
+#define kProbeFormatOgg		6
+#define kProbeFormatMp3		7
+#define kProbeFormatCaf		8
+#define kProbeFormatMp4		9
+
+//------------------------------------------------------------------------
+struct FileProbe
+{
+	const char* error;	// 0 if the file can be handed to the host, only set when it is missing or unreadable
+	uint64_t size;
+	int format;			// kProbeFormat...
+
+	FileProbe () : error (0), size (0), format (kProbeFormatUnknown) {}
+};
+
+// Stats, opens and reads the start of the UTF-8 path. May block for a
+// long time on an offline network share; never call it on the main thread.
+FileProbe probeFile (const string& szPath);
+
+//------------------------------------------------------------------------
+// Probes batches of files on a few worker threads, which start with the
+// first batch. The completion of a batch runs on the worker that probed
+// its last file, with one FileProbe per path in the same order.
+//------------------------------------------------------------------------
+class CFileProbePool
+{
+public:
+	//--------------------------------------------------------------------
+	typedef std::function<void (std::vector<FileProbe>& probes)> Completion;
+
+	CFileProbePool (unsigned int nMaxThreads = 8);
+	virtual ~CFileProbePool ();	// drops batches not started yet, waits for the others
+
+	void probe (const std::vector<string>& paths, Completion completion);
+
+//------------------------------------------------------------------------
+private:
+	struct Batch
+	{
+		std::vector<string> paths;
+		std::vector<FileProbe> probes;
+		size_t nRemaining;		// guarded by m_Lock
+		Completion completion;
+	};
+
+	struct Task
+	{
+		std::shared_ptr<Batch> batch;
+		size_t nIndex;
+	};
+
+	void startThreads ();
+	void work ();
+
+	std::mutex m_Lock;
+	std::condition_variable m_TaskAdded;
+	std::deque<Task> m_Tasks;			// guarded by m_Lock
+	std::vector<std::thread> m_Threads;
+	unsigned int m_nMaxThreads;
+	bool m_bShutDown;
+};
+
+#endif // !defined(FILEPROBE_H)
@@ -0,0 +1,195 @@
+//-----------------------------------------------------------------------------
+// Project      : BaseHeadSKI
+// Filename     : JobList.cpp
+// Description  : Long running commands, executed in time slices on the
+//				  main thread while the pipe stays responsive
+//-----------------------------------------------------------------------------
+
+#include "JobList.h"
+#include "messagehandler.h"
+
+#include <chrono>
+#include <stdio.h>
+
+
+//------------------------------------------------------------------------
+Job::Job (IProject* project, int32 total)
+: id (0)
+, project (project)
+, state (kRunning)
+, done (0)
+, total (total)
+, reportedDone (0)
+{
+}
+
+//------------------------------------------------------------------------
+const char* Job::getStateName (State state)
+{
+	switch (state)
+	{
+		case kRunning: return "running";
+		case kDone: return "done";
+		case kCancelled: return "cancelled";
+		case kFailed: return "failed";
+	}
+	return "";
+}
+
+//------------------------------------------------------------------------
+JobList::JobList ()
+: nextId (1)
+{
+}
+
+//------------------------------------------------------------------------
+JobList::~JobList ()
+{
+	for (uint32 i = 0; i < jobs.size (); i++)
+		delete jobs[i];
+}
+
+//------------------------------------------------------------------------
+uint32 JobList::add (Job* job)
+{
+	job->id = nextId++;
+	if (nextId == 0)
+		nextId = 1;
+	jobs.push_back (job);
+
+	if (job->total <= 0)
+		finish (job, Job::kDone);
+	removeOldJobs ();
+	return job->id;
+}
+
+//------------------------------------------------------------------------
+Job* JobList::find (uint32 id) const
+{
+	for (uint32 i = 0; i < jobs.size (); i++)
+	{
+		if (jobs[i]->id == id)
+			return jobs[i];
+	}
+	return 0;
+}
+
+//------------------------------------------------------------------------
+bool JobList::cancel (uint32 id)
+{
+	Job* job = find (id);
+	if (!job || job->state != Job::kRunning)
+		return false;
+	finish (job, Job::kCancelled);
+	return true;
+}
+
+//------------------------------------------------------------------------
+void JobList::cancelProject (IProject* project)
+{
+	for (uint32 i = 0; i < jobs.size (); i++)
+	{
+		if (jobs[i]->project == project && jobs[i]->state == Job::kRunning)
+			finish (jobs[i], Job::kCancelled);
+	}
+}
+
+//------------------------------------------------------------------------
+bool JobList::hasRunningJobs () const
+{
+	for (uint32 i = 0; i < jobs.size (); i++)
+	{
+		if (jobs[i]->state == Job::kRunning)
+			return true;
+	}
+	return false;
+}
+
+//------------------------------------------------------------------------
+void JobList::run (int32 maxTime)
+{
+	typedef std::chrono::steady_clock Clock;
+	Clock::time_point end = Clock::now () + std::chrono::milliseconds (maxTime);
+
+	bool working = true;
+	while (working)
+	{
+		working = false;
+		for (uint32 i = 0; i < jobs.size (); i++)
+		{
+			Job* job = jobs[i];
+			if (job->state != Job::kRunning)
+				continue;
+			if (Clock::now () >= end)
+			{
+				working = false;
+				break;
+			}
+
+			working = true;
+			if (!job->doStep ())
+			{
+				finish (job, Job::kFailed);
+				continue;
+			}
+			if (++job->done >= job->total)
+				finish (job, Job::kDone);
+		}
+	}
+
+	// one progress event per job and slice
+	char text[64];
+	for (uint32 i = 0; i < jobs.size (); i++)
+	{
+		Job* job = jobs[i];
+		if (job->state != Job::kRunning || job->done == job->reportedDone)
+			continue;
+		job->reportedDone = job->done;
+		snprintf (text, sizeof (text), "%u\t%d\t%d", job->id, job->done, job->total);
+		PipeMessageHandler::instance ()->sendEvent (SKI_JOB_PROGRESS, text);
+	}
+
+	removeOldJobs ();
+}
+
+//------------------------------------------------------------------------
+void JobList::finish (Job* job, Job::State state)
+{
+	job->state = state;
+	if (state == Job::kDone && job->result.empty ())
+		job->result = "ok";
+	else if (state == Job::kCancelled && job->result.empty ())
+		job->result = "Cancelled";
+
+	char prefix[32];
+	snprintf (prefix, sizeof (prefix), "%u\t", job->id);
+	std::string text (prefix);
+	text.append (Job::getStateName (state));
+	text.append ("\t");
+	text.append (job->result);
+	PipeMessageHandler::instance ()->sendEvent (SKI_JOB_FINISHED, text.c_str ());
+}
+
+//------------------------------------------------------------------------
+void JobList::removeOldJobs ()
+{
+	uint32 finished = 0;
+	for (uint32 i = 0; i < jobs.size (); i++)
+	{
+		if (jobs[i]->state != Job::kRunning)
+			finished++;
+	}
+
+	// oldest first
+	for (uint32 i = 0; i < jobs.size () && finished > MAX_FINISHED_JOBS; )
+	{
+		if (jobs[i]->state != Job::kRunning)
+		{
+			delete jobs[i];
+			jobs.erase (jobs.begin () + i);
+			finished--;
+		}
+		else
+			i++;
+	}
+}
@@ -0,0 +1,107 @@
+//-----------------------------------------------------------------------------
+// Project      : BaseHeadSKI
+// Filename     : JobList.h
+// Description  : Long running commands, executed in time slices on the
+//				  main thread while the pipe stays responsive
+//-----------------------------------------------------------------------------
+
+#ifndef __joblist__
+#define __joblist__
+
+#include "pluginterfaces/base/ftypes.h"
+
+#include <string>
+#include <vector>
+
+namespace Steinberg {
+class IProject;
+}
+using namespace Steinberg;
+
+// finished jobs kept for "job status"
+#define MAX_FINISHED_JOBS	32
+
+// main thread time given to jobs per idle call, in milliseconds
+#define JOB_SLICE_TIME		15
+
+
+//------------------------------------------------------------------------
+// A command split into 'total' steps. The client gets the job id as the
+// reply to the command, then SKI_JOB_PROGRESS events while it runs and
+// one SKI_JOB_FINISHED event at the end:
+//
+//   SKI_JOB_PROGRESS	<id> \t <done> \t <total>
+//   SKI_JOB_FINISHED	<id> \t <state> \t <result>
+//------------------------------------------------------------------------
+class Job
+{
+public:
+	enum State
+	{
+		kRunning,
+		kDone,
+		kCancelled,
+		kFailed
+	};
+
+	Job (IProject* project, int32 total);
+	virtual ~Job () {}
+
+	uint32 getId () const { return id; }
+	IProject* getProject () const { return project; }
+	State getState () const { return state; }
+	int32 countDone () const { return done; }
+	int32 countTotal () const { return total; }
+	const std::string& getResult () const { return result; }
+
+	static const char* getStateName (State state);
+
+protected:
+	friend class JobList;
+
+	// Does step number 'done'; the job fails if it returns false
+	virtual bool doStep () = 0;
+
+	uint32 id;
+	IProject* project;
+	State state;
+	int32 done;
+	int32 total;
+	int32 reportedDone;		// done as of the last progress event
+	std::string result;		// "ok" or what went wrong
+};
+
+//------------------------------------------------------------------------
+// Owns the jobs; main thread only.
+//------------------------------------------------------------------------
+class JobList
+{
+public:
+	JobList ();
+	~JobList ();
+
+	// Takes ownership and returns the job id
+	uint32 add (Job* job);
+
+	Job* find (uint32 id) const;
+
+	// false if there is no running job with id
+	bool cancel (uint32 id);
+
+	// Cancels all jobs working on project, before it goes away
+	void cancelProject (IProject* project);
+
+	bool hasRunningJobs () const;
+
+	// Runs steps of all running jobs in turn for about maxTime milliseconds
+	void run (int32 maxTime);
+
+protected:
+	void finish (Job* job, Job::State state);
+	void removeOldJobs ();
+
+	std::vector<Job*> jobs;		// in the order they were added
+	uint32 nextId;
+};
+
+#endif
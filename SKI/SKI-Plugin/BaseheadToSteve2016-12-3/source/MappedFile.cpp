@@ -0,0 +1,218 @@
+//------------------------------------------------------------------------
+//
+// Project     : BaseHeadSKI
+// Filename    : MappedFile.cpp
+// Description : Views of a file mapped into memory
+//
+//------------------------------------------------------------------------
+#include "MappedFile.h"
+#include "UtfConvert.h"
+
+#if !defined(_WIN32)
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
+
+//------------------------------------------------------------------------
+CMappedFile::CMappedFile ()
+: m_nSize (0)
+, m_nModified (0)
+, m_pData (NULL)
+, m_nMappedSize (0)
+, m_bWritable (false)
+#if defined(_WIN32)
+, m_hFile (INVALID_HANDLE_VALUE)
+, m_hMapping (NULL)
+#else
+, m_nFile (-1)
+#endif
+{
+}
+
+//------------------------------------------------------------------------
+CMappedFile::~CMappedFile ()
+{
+	close ();
+}
+
+#if defined(_WIN32)
+//------------------------------------------------------------------------
+const char* CMappedFile::open (const string& szPath)
+{
+	close ();
+	u16string szWidePath = toUtf16 (szPath);
+	m_hFile = CreateFileW ((LPCWSTR)szWidePath.c_str (), GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE,
+		NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+	if (m_hFile == INVALID_HANDLE_VALUE)
+		return "Couldn't open file";
+	return readStatus ();
+}
+
+//------------------------------------------------------------------------
+const char* CMappedFile::create (const string& szPath, uint64_t nSize)
+{
+	close ();
+	u16string szWidePath = toUtf16 (szPath);
+	m_hFile = CreateFileW ((LPCWSTR)szWidePath.c_str (), GENERIC_READ | GENERIC_WRITE, 0,
+		NULL, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, NULL);
+	if (m_hFile == INVALID_HANDLE_VALUE)
+		return "Couldn't create file";
+
+	LARGE_INTEGER size;
+	size.QuadPart = (LONGLONG)nSize;
+	if (!SetFilePointerEx (m_hFile, size, NULL, FILE_BEGIN) || !SetEndOfFile (m_hFile))
+		return "Couldn't write file";
+	m_bWritable = true;
+	return readStatus ();
+}
+
+//------------------------------------------------------------------------
+const char* CMappedFile::readStatus ()
+{
+	LARGE_INTEGER size;
+	FILETIME modified;
+	if (!GetFileSizeEx (m_hFile, &size) || !GetFileTime (m_hFile, NULL, NULL, &modified))
+		return "Couldn't read file";
+	m_nSize = (uint64_t)size.QuadPart;
+	m_nModified = ((uint64_t)modified.dwHighDateTime << 32) | modified.dwLowDateTime;
+	return 0;
+}
+
+//------------------------------------------------------------------------
+void CMappedFile::close ()
+{
+	unmap ();
+	if (m_hMapping)
+		CloseHandle (m_hMapping);
+	m_hMapping = NULL;
+	if (m_hFile != INVALID_HANDLE_VALUE)
+		CloseHandle (m_hFile);
+	m_hFile = INVALID_HANDLE_VALUE;
+	m_nSize = 0;
+	m_nModified = 0;
+	m_bWritable = false;
+}
+
+//------------------------------------------------------------------------
+const char* CMappedFile::map (uint64_t nOffset, size_t nSize)
+{
+	unmap ();
+	if (nOffset >= m_nSize)
+		return m_nSize == 0 ? "File is empty" : "Offset beyond the end of the file";
+	if (nSize == 0 || nSize > m_nSize - nOffset)
+		nSize = (size_t)(m_nSize - nOffset);
+
+	// one mapping object serves all views
+	if (m_hMapping == NULL)
+		m_hMapping = CreateFileMappingW (m_hFile, NULL, m_bWritable ? PAGE_READWRITE : PAGE_READONLY, 0, 0, NULL);
+	if (m_hMapping == NULL)
+		return "Couldn't map file";
+
+	m_pData = (unsigned char*)MapViewOfFile (m_hMapping, m_bWritable ? FILE_MAP_WRITE : FILE_MAP_READ,
+		(DWORD)(nOffset >> 32), (DWORD)(nOffset & 0xFFFFFFFF), nSize);
+	if (m_pData == NULL)
+		return "Couldn't map file";
+	m_nMappedSize = nSize;
+	return 0;
+}
+
+//------------------------------------------------------------------------
+void CMappedFile::unmap ()
+{
+	if (m_pData)
+		UnmapViewOfFile (m_pData);
+	m_pData = NULL;
+	m_nMappedSize = 0;
+}
+
+//------------------------------------------------------------------------
+size_t CMappedFile::GetGranularity ()
+{
+	SYSTEM_INFO info;
+	GetSystemInfo (&info);
+	return info.dwAllocationGranularity;
+}
+
+#else
+//------------------------------------------------------------------------
+const char* CMappedFile::open (const string& szPath)
+{
+	close ();
+	m_nFile = ::open (szPath.c_str (), O_RDONLY);
+	if (m_nFile < 0)
+		return "Couldn't open file";
+	return readStatus ();
+}
+
+//------------------------------------------------------------------------
+const char* CMappedFile::create (const string& szPath, uint64_t nSize)
+{
+	close ();
+	m_nFile = ::open (szPath.c_str (), O_RDWR | O_CREAT | O_TRUNC, 0644);
+	if (m_nFile < 0)
+		return "Couldn't create file";
+	if (ftruncate (m_nFile, (off_t)nSize) != 0)
+		return "Couldn't write file";
+	m_bWritable = true;
+	return readStatus ();
+}
+
+//------------------------------------------------------------------------
+const char* CMappedFile::readStatus ()
+{
+	struct stat status;
+	if (fstat (m_nFile, &status) != 0)
+		return "Couldn't read file";
+	if (!S_ISREG (status.st_mode))
+		return "Not a file";
+	m_nSize = (uint64_t)status.st_size;
+	m_nModified = (uint64_t)status.st_mtime;
+	return 0;
+}
+
+//------------------------------------------------------------------------
+void CMappedFile::close ()
+{
+	unmap ();
+	if (m_nFile >= 0)
+		::close (m_nFile);
+	m_nFile = -1;
+	m_nSize = 0;
+	m_nModified = 0;
+	m_bWritable = false;
+}
+
+//------------------------------------------------------------------------
+const char* CMappedFile::map (uint64_t nOffset, size_t nSize)
+{
+	unmap ();
+	if (nOffset >= m_nSize)
+		return m_nSize == 0 ? "File is empty" : "Offset beyond the end of the file";
+	if (nSize == 0 || nSize > m_nSize - nOffset)
+		nSize = (size_t)(m_nSize - nOffset);
+
+	void* pView = mmap (NULL, nSize, m_bWritable ? (PROT_READ | PROT_WRITE) : PROT_READ, MAP_SHARED, m_nFile, (off_t)nOffset);
+	if (pView == MAP_FAILED)
+		return "Couldn't map file";
+	m_pData = (unsigned char*)pView;
+	m_nMappedSize = nSize;
+	return 0;
+}
+
+//------------------------------------------------------------------------
+void CMappedFile::unmap ()
+{
+	if (m_pData)
+		munmap (m_pData, m_nMappedSize);
+	m_pData = NULL;
+	m_nMappedSize = 0;
+}
+
+//------------------------------------------------------------------------
+size_t CMappedFile::GetGranularity ()
+{
+	return (size_t)sysconf (_SC_PAGESIZE);
+}
+#endif
@@ -0,0 +1,72 @@
+//------------------------------------------------------------------------
+//
+// Project     : BaseHeadSKI
+// Filename    : MappedFile.h
+// Description : Views of a file mapped into memory
+//
+//------------------------------------------------------------------------
+#if !defined(MAPPEDFILE_H)
+#define MAPPEDFILE_H
+
+#if _MSC_VER > 1000
+#pragma once
+#endif // _MSC_VER > 1000
+
+#include <string>
+#include <stdint.h>
+#if defined(_WIN32)
+#include <Windows.h>
+#endif
+using namespace std;
+
+
+//------------------------------------------------------------------------
+// One view at a time of a file opened for reading, or created for
+// writing. Paths are UTF-8; every call returns 0 or what went wrong.
+//------------------------------------------------------------------------
+class CMappedFile
+{
+public:
+	//--------------------------------------------------------------------
+	CMappedFile ();
+	virtual ~CMappedFile ();
+
+	const char* open (const string& szPath);
+	// Creates or truncates the file to nSize bytes, for writing
+	const char* create (const string& szPath, uint64_t nSize);
+	void close ();
+
+	// Maps nSize bytes from nOffset, a multiple of GetGranularity (),
+	// instead of the previous view; nSize 0 or past the end maps up to the
+	// end of the file
+	const char* map (uint64_t nOffset = 0, size_t nSize = 0);
+	void unmap ();
+
+	uint64_t GetSize () const { return m_nSize; }
+	uint64_t GetModified () const { return m_nModified; }	// only to compare with itself
+	unsigned char* GetData () const { return m_pData; }
+	size_t GetMappedSize () const { return m_nMappedSize; }
+
+	static size_t GetGranularity ();
+
+//------------------------------------------------------------------------
+private:
+	CMappedFile (const CMappedFile&) = delete;
+	CMappedFile& operator= (const CMappedFile&) = delete;
+
+	const char* readStatus ();
+
+	uint64_t m_nSize;
+	uint64_t m_nModified;
+	unsigned char* m_pData;
+	size_t m_nMappedSize;
+	bool m_bWritable;
+#if defined(_WIN32)
+	HANDLE m_hFile;
+	HANDLE m_hMapping;
+#else
+	int m_nFile;
+#endif
+};
+
+#endif // !defined(MAPPEDFILE_H)
@@ -0,0 +1,90 @@
+//------------------------------------------------------------------------
+//
+// Project     : BaseHeadSKI
+// Filename    : MpscQueue.h
+// Description : Lock free queue, any number of producer threads and one
+//				 consumer thread
+//
+//------------------------------------------------------------------------
+#if !defined(MPSCQUEUE_H)
+#define MPSCQUEUE_H
+
+#if _MSC_VER > 1000
+#pragma once
+#endif // _MSC_VER > 1000
+
+#include <atomic>
+#include <utility>
+
+
+//------------------------------------------------------------------------
+// Linked list with a dummy node (D. Vyukov's MPSC queue). push () is one
+// atomic exchange and never waits; pop () only runs on the consumer. A
+// push that is still between its exchange and linking its node hides
+// itself and everything after it from pop () for that moment, so the
+// consumer has to check again after the producer signaled it.
+//------------------------------------------------------------------------
+template <class T>
+class MpscQueue
+{
+public:
+	//--------------------------------------------------------------------
+	MpscQueue ()
+	: m_pHead (new Node)
+	, m_pTail (m_pHead.load ())
+	{
+	}
+
+	~MpscQueue ()
+	{
+		T value;
+		while (pop (value))
+			;
+		delete m_pTail;
+	}
+
+	// any thread
+	void push (T value)
+	{
+		Node* pNode = new Node;
+		pNode->value = std::move (value);
+		Node* pPrevious = m_pHead.exchange (pNode, std::memory_order_acq_rel);
+		pPrevious->pNext.store (pNode, std::memory_order_release);
+	}
+
+	// consumer thread only
+	bool pop (T& value /*out*/)
+	{
+		Node* pNext = m_pTail->pNext.load (std::memory_order_acquire);
+		if (!pNext)
+			return false;
+		value = std::move (pNext->value);
+		delete m_pTail;
+		m_pTail = pNext;	// the popped node is the new dummy
+		return true;
+	}
+
+	// consumer thread only
+	bool isEmpty () const
+	{
+		return m_pTail->pNext.load (std::memory_order_acquire) == 0;
+	}
+
+//------------------------------------------------------------------------
+private:
+	struct Node
+	{
+		std::atomic<Node*> pNext;
+		T value;
+
+		Node () : pNext (0) {}
+	};
+
+	MpscQueue (const MpscQueue&) = delete;
+	MpscQueue& operator= (const MpscQueue&) = delete;
+
+	std::atomic<Node*> m_pHead;		// last pushed
+	Node* m_pTail;					// dummy before the next to pop
+};
+
+#endif // !defined(MPSCQUEUE_H)
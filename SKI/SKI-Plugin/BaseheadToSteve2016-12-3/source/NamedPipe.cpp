@@ -9,6 +9,16 @@
 //////////////////////////////////////////////////////////////////////
 
 #include "NamedPipe.h"
+#include "SharedRing.h"
+#include "PipeCodec.h"
+
+#include <string.h>
+
+#if !defined(_WIN32)
+#include <errno.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#endif
 
 #ifdef _DEBUG
 #undef THIS_FILE
@@ -16,121 +26,560 @@ static char THIS_FILE[]=__FILE__;
 
 #endif
 
-#define PIPE_BUF_SIZE 1024
-#define PIPE_TIMEOUT  (120*1000) /*120 seconds*/
+#define PIPE_READ_CHUNK (64*1024)	/*minimum free space per read*/
 
+#if defined(_WIN32)
 //------------------------------------------------------------------------
-CNamedPipe::CNamedPipe()
+CNamedPipe::CNamedPipe (uint32_t nId, HANDLE hInPipe)
 {
-	m_szPipeName = "";
-	m_szPipeHost = ".";
-	m_szFullPipeName = "\\\\.\\PIPE\\";
+	m_nId = nId;
 
+	m_hInPipe = hInPipe;
 	m_hOutPipe = NULL;
-	m_hInPipe  = NULL;
+	m_hReadEvent = CreateEvent (NULL, TRUE, FALSE, NULL);
+	m_hWriteEvent = CreateEvent (NULL, TRUE, FALSE, NULL);
+	memset (&m_ReadOv, 0, sizeof (m_ReadOv));
+	m_bReadPending = false;
+	m_nReadOffset = 0;
+	memset (&m_WriteOv, 0, sizeof (m_WriteOv));
+	m_bWritePending = false;
+
+	m_nClientPid = 0;
+	GetNamedPipeClientProcessId (m_hInPipe, &m_nClientPid);
+
+	m_ReadBuf.resize (PIPE_READ_CHUNK);
+	m_nBuffered = 0;
+	m_bLegacyPending = false;
+	m_bMessageEnded = false;
+	m_nOutSent = 0;
+	m_nOutQueued = 0;
+
+	m_pInRing = NULL;
+	m_pOutRing = NULL;
+
+	m_bBinary = false;
+	m_bSubscribed = false;
+	m_bBroken = false;
+	m_bFinished = false;
 }
 
 //------------------------------------------------------------------------
 CNamedPipe::~CNamedPipe()
 {
-	closePipe ();
+	if (m_bReadPending)
+	{
+		// the kernel must be done with m_ReadOv and m_ReadBuf before they go
+		CancelIo (m_hInPipe);
+		DWORD dwDummy = 0;
+		GetOverlappedResult (m_hInPipe, &m_ReadOv, &dwDummy, TRUE);
+	}
+	if (m_bWritePending)
+	{
+		// same for m_WriteOv and the front of m_OutQueue
+		CancelIo (m_hOutPipe);
+		DWORD dwDummy = 0;
+		GetOverlappedResult (m_hOutPipe, &m_WriteOv, &dwDummy, TRUE);
+	}
+
+	// closing (rather than disconnecting) lets the client read the rest
+	if (m_hOutPipe != NULL && m_hOutPipe != INVALID_HANDLE_VALUE)
+		CloseHandle (m_hOutPipe);
+	if (m_hInPipe != NULL && m_hInPipe != INVALID_HANDLE_VALUE)
+		CloseHandle (m_hInPipe);
+
+	if (m_hReadEvent)
+		CloseHandle (m_hReadEvent);
+	if (m_hWriteEvent)
+		CloseHandle (m_hWriteEvent);
+
+	delete m_pInRing;
+	delete m_pOutRing;
 }
 
 //------------------------------------------------------------------------
-bool CNamedPipe::initialize ()
+// Issues an overlapped read into the free part of the buffer. Completion
+// (immediate or later) signals GetReadEvent ().
+bool CNamedPipe::startRead ()
 {
-	m_hInPipe = CreateNamedPipe (
-		GetRealPipeName (true).c_str (),
-		PIPE_ACCESS_INBOUND,
-		PIPE_WAIT,
-		1,
-		PIPE_BUF_SIZE,
-		PIPE_BUF_SIZE,
-		PIPE_TIMEOUT,
-		NULL);
-	if (m_hInPipe == NULL || m_hInPipe == INVALID_HANDLE_VALUE)
+	if (m_bBroken)
 		return false;
 
-	m_hOutPipe = CreateNamedPipe (
-		GetRealPipeName (false).c_str (),
-		PIPE_ACCESS_OUTBOUND,
-		PIPE_WAIT,
-		1,
-		PIPE_BUF_SIZE,
-		PIPE_BUF_SIZE,
-		PIPE_TIMEOUT,
-		NULL);
-	if (m_hOutPipe == NULL || m_hOutPipe == INVALID_HANDLE_VALUE)
-		return false;
+	if (m_ReadBuf.size () - m_nBuffered < PIPE_READ_CHUNK)
+		m_ReadBuf.resize (m_nBuffered + PIPE_READ_CHUNK);
+
+	memset (&m_ReadOv, 0, sizeof (m_ReadOv));
+	m_ReadOv.hEvent = m_hReadEvent;
+	ResetEvent (m_hReadEvent);
 
+	m_nReadOffset = m_nBuffered;
+	DWORD dwWant = (DWORD)(m_ReadBuf.size () - m_nBuffered);
+	if (!ReadFile (m_hInPipe, &m_ReadBuf[m_nBuffered], dwWant, NULL, &m_ReadOv))
+	{
+		DWORD dwError = GetLastError ();
+		if (dwError != ERROR_IO_PENDING && dwError != ERROR_MORE_DATA)
+		{
+			m_bBroken = true;
+			return false;
+		}
+	}
+	m_bReadPending = true;
 	return true;
 }
 
 //------------------------------------------------------------------------
-void CNamedPipe::SetPipeName(string szName, string szHost/* = "."*/)
+bool CNamedPipe::onReadable ()
 {
-	m_szPipeName = szName;
-	m_szPipeHost = szHost;
-	m_szFullPipeName = "\\\\";
-	m_szFullPipeName += m_szPipeHost;
-	m_szFullPipeName += "\\PIPE\\";
-	m_szFullPipeName += m_szPipeName;
+	if (!m_bReadPending)
+		return !m_bBroken;
+	m_bReadPending = false;
+
+	DWORD dwRead = 0;
+	m_bMessageEnded = true;
+	if (!GetOverlappedResult (m_hInPipe, &m_ReadOv, &dwRead, FALSE))
+	{
+		// the message did not fit, the rest comes with the next read
+		if (GetLastError () == ERROR_MORE_DATA)
+			m_bMessageEnded = false;
+		else
+			dwRead = 0;
+	}
+	if (dwRead == 0)
+	{
+		// client closed its end or the pipe broke
+		m_bBroken = true;
+		return false;
+	}
+
+	// flushLegacy () may have emptied the buffer while the read was pending
+	if (m_nReadOffset != m_nBuffered)
+		memmove (&m_ReadBuf[m_nBuffered], &m_ReadBuf[m_nReadOffset], dwRead);
+	m_nBuffered += dwRead;
+	parseFrames ();
+
+	return startRead ();
 }
 
 //------------------------------------------------------------------------
-string CNamedPipe::GetRealPipeName(bool bIsServerInPipe)
+// Issues overlapped writes of the queue until one stays pending, whose
+// completion signals GetWriteEvent ().
+bool CNamedPipe::flushWrites ()
 {
-	string szRetVal = m_szFullPipeName;
-	szRetVal += bIsServerInPipe?"_IN":"_OUT";
-	return szRetVal;
+	while (!m_bBroken && !m_bWritePending && !m_OutQueue.empty () && hasOutPipe ())
+	{
+		const string& szFront = m_OutQueue.front ();
+		memset (&m_WriteOv, 0, sizeof (m_WriteOv));
+		m_WriteOv.hEvent = m_hWriteEvent;
+		ResetEvent (m_hWriteEvent);
+
+		DWORD dwWant = (DWORD)(szFront.length () - m_nOutSent);
+		if (!WriteFile (m_hOutPipe, szFront.data () + m_nOutSent, dwWant, NULL, &m_WriteOv))
+		{
+			if (GetLastError () != ERROR_IO_PENDING)
+			{
+				m_bBroken = true;
+				return false;
+			}
+			m_bWritePending = true;
+			break;
+		}
+
+		DWORD dwSent = 0;
+		if (!GetOverlappedResult (m_hOutPipe, &m_WriteOv, &dwSent, FALSE) || dwSent == 0)
+		{
+			m_bBroken = true;
+			return false;
+		}
+		onWritten (dwSent);
+	}
+	return !m_bBroken;
 }
 
 //------------------------------------------------------------------------
-bool CNamedPipe::read (string& szMsg /*out*/)
+bool CNamedPipe::onWritable ()
 {
-	char buf[PIPE_BUF_SIZE];
-	DWORD dwRead = 1;
-	
-	BOOL bOK = ReadFile (m_hInPipe, buf, PIPE_BUF_SIZE, &dwRead, NULL);
-	if (dwRead == 0 || !bOK)
+	if (!m_bWritePending)
+		return flushWrites ();
+
+	DWORD dwSent = 0;
+	if (!GetOverlappedResult (m_hOutPipe, &m_WriteOv, &dwSent, FALSE))
+	{
+		if (GetLastError () == ERROR_IO_INCOMPLETE)
+			return true;
+		dwSent = 0;
+	}
+	m_bWritePending = false;
+	if (dwSent == 0)
+	{
+		m_bBroken = true;
 		return false;
-	
-	szMsg = buf;	
-	return true;
+	}
+	onWritten (dwSent);
+	return flushWrites ();
+}
+
+#else
+//------------------------------------------------------------------------
+CNamedPipe::CNamedPipe (uint32_t nId, int nFd)
+{
+	m_nId = nId;
+	m_nFd = nFd;
+	m_bWriteWatched = false;
+
+	m_ReadBuf.resize (PIPE_READ_CHUNK);
+	m_nBuffered = 0;
+	m_bLegacyPending = false;
+	m_bMessageEnded = false;
+	m_nOutSent = 0;
+	m_nOutQueued = 0;
+
+	m_pInRing = NULL;
+	m_pOutRing = NULL;
+
+	m_bBinary = false;
+	m_bSubscribed = false;
+	m_bBroken = false;
+	m_bFinished = false;
+}
+
+//------------------------------------------------------------------------
+CNamedPipe::~CNamedPipe()
+{
+	if (m_nFd >= 0)
+		close (m_nFd);
+
+	delete m_pInRing;
+	delete m_pOutRing;
+}
+
+//------------------------------------------------------------------------
+bool CNamedPipe::startRead ()
+{
+	// readiness is reported by the server's epoll set, nothing to arm
+	return !m_bBroken;
+}
+
+//------------------------------------------------------------------------
+bool CNamedPipe::onReadable ()
+{
+	if (m_bBroken)
+		return false;
+
+	while (true)
+	{
+		if (m_ReadBuf.size () - m_nBuffered < PIPE_READ_CHUNK)
+			m_ReadBuf.resize (m_nBuffered + PIPE_READ_CHUNK);
+
+		ssize_t nRead = recv (m_nFd, &m_ReadBuf[m_nBuffered], m_ReadBuf.size () - m_nBuffered, MSG_DONTWAIT);
+		if (nRead > 0)
+		{
+			m_nBuffered += nRead;
+			continue;
+		}
+		if (nRead < 0 && errno == EINTR)
+			continue;
+		if (nRead < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+			break;
+
+		// client closed its end or the socket broke
+		m_bBroken = true;
+		return false;
+	}
+
+	parseFrames ();
+	return !m_bBroken;
+}
+
+//------------------------------------------------------------------------
+// Writes as much of the queue as the socket takes without blocking; the
+// server watches for writability while anything is left.
+bool CNamedPipe::flushWrites ()
+{
+	while (!m_bBroken && !m_OutQueue.empty ())
+	{
+		const string& szFront = m_OutQueue.front ();
+		ssize_t nSent = ::send (m_nFd, szFront.data () + m_nOutSent, szFront.length () - m_nOutSent, MSG_NOSIGNAL | MSG_DONTWAIT);
+		if (nSent < 0 && errno == EINTR)
+			continue;
+		if (nSent < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+			break;
+		if (nSent <= 0)
+		{
+			m_bBroken = true;
+			return false;
+		}
+		onWritten (nSent);
+	}
+	return !m_bBroken;
+}
+
+//------------------------------------------------------------------------
+bool CNamedPipe::onWritable ()
+{
+	return flushWrites ();
+}
+#endif
+
+//------------------------------------------------------------------------
+// Appends szData (emptied) to the queue and starts writing it.
+bool CNamedPipe::queueWrite (string& szData)
+{
+	if (m_bBroken)
+		return false;
+	if (m_nOutQueued > kPipeMaxQueued)
+	{
+		// the client stopped reading, it would hold on to ever more memory
+		m_bBroken = true;
+		return false;
+	}
+
+	m_nOutQueued += szData.length ();
+	m_OutQueue.push_back (string ());
+	m_OutQueue.back ().swap (szData);
+	return flushWrites ();
 }
 
 //------------------------------------------------------------------------
-bool CNamedPipe::send (string szMsg)
+void CNamedPipe::onWritten (size_t nBytes)
 {
-	string copy = szMsg;
-	DWORD dwSent;
-	BOOL bOK = 0;
-	try
+	m_nOutSent += nBytes;
+	m_nOutQueued -= nBytes;
+	if (m_nOutSent >= m_OutQueue.front ().length ())
 	{
-		bOK = WriteFile (m_hOutPipe, szMsg.c_str (), szMsg.length (), &dwSent, NULL);
+		m_OutQueue.pop_front ();
+		m_nOutSent = 0;
 	}
-	catch (...)
+}
+
+//------------------------------------------------------------------------
+void CNamedPipe::consumeReadBuffer (size_t nBytes)
+{
+	if (nBytes >= m_nBuffered)
 	{
-		throw copy;
+		m_nBuffered = 0;
+		return;
 	}
+	memmove (&m_ReadBuf[0], &m_ReadBuf[nBytes], m_nBuffered - nBytes);
+	m_nBuffered -= nBytes;
+}
 
-	// reset ... Otherwise BaseHead freezes
-	closePipe ();
-	initialize ();
+//------------------------------------------------------------------------
+// Moves every complete command from the read buffer to m_Requests. A
+// partial frame stays buffered until the rest of it arrives.
+void CNamedPipe::parseFrames ()
+{
+	size_t nOffset = 0;
+	while (nOffset < m_nBuffered)
+	{
+		const char* pData = &m_ReadBuf[nOffset];
+		size_t nAvail = m_nBuffered - nOffset;
 
-	if (!bOK || (szMsg.length()+1) != dwSent)
+		// a frame header may arrive split over several reads
+		uint32_t magic = kPipeFrameMagic;
+		size_t nMagic = nAvail < sizeof (magic) ? nAvail : sizeof (magic);
+		if (memcmp (pData, &magic, nMagic) != 0)
+		{
+			// legacy client: the command may arrive in several reads, it
+			// ends at a zero byte, with the client's write or when the
+			// client goes quiet
+			const char* pEnd = (const char*)memchr (pData, 0, nAvail);
+			if (!pEnd && m_bMessageEnded)
+				pEnd = pData + nAvail;
+			if (!pEnd)
+			{
+				if (nAvail > kPipeMaxFrameSize)
+				{
+					m_bBroken = true;
+					return;
+				}
+				m_bLegacyPending = true;
+				m_LegacyDeadline = std::chrono::steady_clock::now () + std::chrono::milliseconds (kPipeLegacyIdleTimeout);
+				break;
+			}
+
+			PipeRequest request;
+			request.session = m_nId;
+			request.payload.assign (pData, pEnd - pData);
+			m_Requests.push_back (request);
+			m_bLegacyPending = false;
+			nOffset += (pEnd - pData) + 1;	// past the zero byte, or the end
+			continue;
+		}
+
+		if (nAvail < sizeof (PipeFrameHeader))
+			break;
+
+		PipeFrameHeader header;
+		memcpy (&header, pData, sizeof (header));
+		if (header.length > kPipeMaxFrameSize)
+		{
+			// out of sync, nothing after this can be trusted
+			m_bBroken = true;
+			return;
+		}
+
+		size_t nFrameSize = sizeof (header) + header.length;
+		if (nAvail < nFrameSize)
+		{
+			// make room for the whole frame so it completes in few reads
+			if (m_ReadBuf.size () < nFrameSize + PIPE_READ_CHUNK)
+			{
+				consumeReadBuffer (nOffset);
+				nOffset = 0;
+				m_ReadBuf.resize (nFrameSize + PIPE_READ_CHUNK);
+			}
+			break;
+		}
+
+		PipeRequest request;
+		request.session = m_nId;
+		request.tag = header.tag;
+		request.framed = true;
+		request.binary = (header.flags & kPipeFrameBinary) != 0;
+		if (header.flags & kPipeFrameInRing)
+		{
+			// the client wrote the command into the ring before ringing;
+			// a missing, corrupt or oversized record ends the session
+			if (!m_pInRing || !m_pInRing->read (request.payload, kPipeMaxFrameSize))
+			{
+				m_bBroken = true;
+				return;
+			}
+		}
+		else
+			request.payload.assign (pData + sizeof (header), header.length);
+		m_Requests.push_back (request);
+
+		nOffset += nFrameSize;
+	}
+	consumeReadBuffer (nOffset);
+}
+
+//------------------------------------------------------------------------
+bool CNamedPipe::GetLegacyDeadline (std::chrono::steady_clock::time_point& deadline /*out*/) const
+{
+	if (!m_bLegacyPending || m_bBroken)
 		return false;
+	deadline = m_LegacyDeadline;
 	return true;
 }
 
 //------------------------------------------------------------------------
-void CNamedPipe::closePipe ()
+void CNamedPipe::flushLegacy ()
 {
-	if (m_hOutPipe != NULL && m_hOutPipe != INVALID_HANDLE_VALUE)
-		CloseHandle (m_hOutPipe);
-	m_hOutPipe = NULL;
+	if (!m_bLegacyPending)
+		return;
+	m_bLegacyPending = false;
 
-	if (m_hInPipe != NULL && m_hInPipe != INVALID_HANDLE_VALUE)
-		CloseHandle (m_hInPipe);
-	m_hInPipe;
-} 
+	// parseFrames () left the command alone at the start of the buffer
+	PipeRequest request;
+	request.session = m_nId;
+	request.payload.assign (&m_ReadBuf[0], m_nBuffered);
+	m_Requests.push_back (request);
+	m_nBuffered = 0;
+}
+
+//------------------------------------------------------------------------
+bool CNamedPipe::popRequest (PipeRequest& request /*out*/)
+{
+	// a legacy session is done after its one reply
+	if (m_Requests.empty () || m_bFinished)
+		return false;
+	request = m_Requests.front ();
+	request.subscribed = m_bSubscribed;
+	m_Requests.pop_front ();
+	return true;
+}
+
+//------------------------------------------------------------------------
+bool CNamedPipe::send (const PipeRequest& request, const string& szMsg)
+{
+	// without an _OUT pipe yet the reply waits in the queue
+	if (m_bBroken)
+		return false;
+
+	if (request.framed)
+	{
+		// binary requests get their result as a single string field
+		if (request.binary)
+		{
+			CPipeFieldWriter writer;
+			writer.addString8 (szMsg);
+			return sendFrame (kPipeFrameBinary, request.tag, writer.GetPayload ());
+		}
+		return sendFrame (0, request.tag, szMsg);
+	}
+
+	string szReply = szMsg;
+	bool bOK = queueWrite (szReply);
+
+	// legacy clients read the reply until the pipe closes (otherwise
+	// BaseHead freezes), the server drops the session once it is written
+	m_bFinished = true;
+
+	if (!bOK)
+		m_bBroken = true;
+	return bOK;
+}
+
+//------------------------------------------------------------------------
+bool CNamedPipe::sendEvent (uint32_t nCode, const string& szMsg)
+{
+	if (m_bBroken)
+		return false;
+	if (!m_bSubscribed || !hasOutPipe ())
+		return true;	// nothing to deliver to
+	return sendFrame (kPipeFrameEvent, nCode, szMsg);
+}
+
+//------------------------------------------------------------------------
+bool CNamedPipe::sendFrame (uint32_t nFlags, uint32_t nTag, const string& szPayload)
+{
+	PipeFrameHeader header;
+	header.magic = kPipeFrameMagic;
+	header.flags = nFlags;
+	header.tag = nTag;
+	header.length = (uint32_t)szPayload.length ();
+
+	bool bOK = false;
+
+	// bulk payloads skip the pipe, only the doorbell frame goes through it
+	if (m_pOutRing && szPayload.length () >= kPipeRingMinPayload
+		&& m_pOutRing->write (szPayload.data (), (uint32_t)szPayload.length ()))
+	{
+		header.flags |= kPipeFrameInRing;
+		header.length = 0;
+		string doorbell ((const char*)&header, sizeof (header));
+		bOK = queueWrite (doorbell);
+	}
+	else
+	{
+		// header and payload in one write, so the client sees one chunk
+		string frame;
+		frame.reserve (sizeof (header) + szPayload.length ());
+		frame.append ((const char*)&header, sizeof (header));
+		frame.append (szPayload);
+		bOK = queueWrite (frame);
+	}
+
+	if (!bOK)
+		m_bBroken = true;
+	return bOK;
+}
+
+//------------------------------------------------------------------------
+bool CNamedPipe::openRings (const string& szInName, const string& szOutName, uint64_t nCapacity)
+{
+	if (m_pInRing || m_pOutRing)
+		return false;
+
+	m_pInRing = new CSharedRing;
+	m_pOutRing = new CSharedRing;
+	if (m_pInRing->create (szInName, nCapacity) && m_pOutRing->create (szOutName, nCapacity))
+		return true;
+
+	delete m_pInRing;
+	delete m_pOutRing;
+	m_pInRing = NULL;
+	m_pOutRing = NULL;
+	return false;
+}
@@ -16,37 +16,181 @@
 #endif // _MSC_VER > 1000
 
 #include <string>
+#include <vector>
+#include <deque>
+#include <chrono>
+#include <stdint.h>
+#if defined(_WIN32)
 #include <Windows.h>
+#endif
 using namespace std;
 
+class CSharedRing;
+
+
+//------------------------------------------------------------------------
+// Framed messages start with this header, followed by 'length' bytes of
+// payload (all fields little-endian). Anything that does not start with
+// kPipeFrameMagic is treated as a legacy, unframed command string. It
+// ends at a zero byte, or else with the client's write: the _IN pipe is
+// in message mode, so a read that took the rest of a message ends the
+// command at once however many reads it took. Sockets have no message
+// boundaries, there an unterminated command ends once nothing more
+// arrived for kPipeLegacyIdleTimeout. Long commands should be framed or
+// zero terminated.
+//------------------------------------------------------------------------
+#define kPipeFrameMagic		0x46504842	/* "BHPF" */
+#define kPipeMaxFrameSize	(256*1024*1024)
+#define kPipeLegacyIdleTimeout	250		/* ms */
+
+// frame flags
+#define kPipeFrameInRing	0x0001	/* doorbell: payload is the next record in the shared ring */
+#define kPipeFrameBinary	0x0002	/* payload is binary encoded, see PipeCodec.h */
+#define kPipeFrameEvent		0x0004	/* unsolicited notification, tag is the SKI_* code */
+
+// replies from this size on go through the session's shared ring, if any
+#define kPipeRingMinPayload	(32*1024)
+// a session with more than this waiting to be written is disconnected
+#define kPipeMaxQueued		(16*1024*1024)
+#define kPipeRingCapacity	(16*1024*1024)
+
+struct PipeFrameHeader
+{
+	uint32_t magic;
+	uint32_t flags;		// kPipeFrame... bits
+	uint32_t tag;		// echoed back unchanged in the reply frame
+	uint32_t length;	// payload size in bytes
+};
+
+//------------------------------------------------------------------------
+// One command received from a client session. The reply is routed back
+// to the same session, in the format the command arrived in.
+//------------------------------------------------------------------------
+struct PipeRequest
+{
+	uint32_t session;
+	uint32_t tag;
+	bool framed;
+	bool binary;		// payload is binary encoded, replies will be too
+	bool subscribed;	// the session had notifications pushed when this arrived
+	string payload;
+
+	PipeRequest () : session (0), tag (0), framed (false), binary (false), subscribed (false) {}
+};
 
+//------------------------------------------------------------------------
+// CNamedPipe is the server end of one client session: its own read
+// buffer, the commands received but not yet dispatched, and the reply
+// path. Sessions are created and driven by CPipeServer. Nothing waits
+// for the client: replies and notifications go into a queue that is
+// written as fast as the client reads it, and a client that lets more
+// than kPipeMaxQueued bytes pile up is disconnected.
 //------------------------------------------------------------------------
 class CNamedPipe  
 {
 public:
 	//--------------------------------------------------------------------
-	CNamedPipe ();
+#if defined(_WIN32)
+	CNamedPipe (uint32_t nId, HANDLE hInPipe);
+
+	void   attachOutPipe (HANDLE hOutPipe) { m_hOutPipe = hOutPipe; }
+	bool   hasOutPipe () const { return m_hOutPipe != NULL; }
+	HANDLE GetReadEvent () const { return m_hReadEvent; }
+	HANDLE GetWriteEvent () const { return m_hWriteEvent; }	// only while isWritePending ()
+	bool   isWritePending () const { return m_bWritePending; }
+	ULONG  GetClientProcessId () const { return m_nClientPid; }
+#else
+	CNamedPipe (uint32_t nId, int nFd);
+
+	bool   hasOutPipe () const { return true; }
+	int    GetFd () const { return m_nFd; }
+	// whether the server's epoll set reports writability, kept by the server
+	bool   isWriteWatched () const { return m_bWriteWatched; }
+	void   setWriteWatched (bool bWatched) { m_bWriteWatched = bWatched; }
+#endif
 	virtual ~CNamedPipe ();	
 
-	bool initialize ();	
+	uint32_t GetId () const { return m_nId; }
+	bool isBroken () const { return m_bBroken; }
+	bool isFinished () const { return m_bFinished; }
+
+	bool startRead ();		// arms the next read, false if the session broke
+	bool onReadable ();		// collects received data into requests
+	bool onWritable ();		// continues writing the queue
+
+	bool hasQueuedWrites () const { return !m_OutQueue.empty (); }
+
+	bool hasRequests () const { return !m_Requests.empty (); }
+	bool popRequest (PipeRequest& request /*out*/);
+
+	// An unterminated legacy command is complete at deadline, unless more
+	// of it arrives first; false if none is waiting.
+	bool GetLegacyDeadline (std::chrono::steady_clock::time_point& deadline /*out*/) const;
+	// Turns the waiting legacy command into a request.
+	void flushLegacy ();
 
-	void   SetPipeName (string szName, string szHost = ".");
-	string GetPipeName () { return m_szFullPipeName; }
-	string GetRealPipeName (bool bIsServerInPipe);
+	bool send (const PipeRequest& request, const string& szMsg);
 
-	bool read (string& szMsg /*out*/);
-	bool send (string szMsg);
+	// Queues a notification if the session subscribed; false only if the
+	// session broke or fell too far behind.
+	bool sendEvent (uint32_t nCode, const string& szMsg);
+	void subscribe () { m_bSubscribed = true; }
+	bool isSubscribed () const { return m_bSubscribed; }
+
+	// Creates the two shared memory rings for bulk payloads: szInName is
+	// written by the client, szOutName by us.
+	bool openRings (const string& szInName, const string& szOutName, uint64_t nCapacity);
+
+	// Binary frames are only accepted once the client asked for them.
+	void enableBinary () { m_bBinary = true; }
+	bool isBinary () const { return m_bBinary; }
 
 //------------------------------------------------------------------------
 private:
-	void closePipe ();
+	void parseFrames ();
+	bool sendFrame (uint32_t nFlags, uint32_t nTag, const string& szPayload);
+	void consumeReadBuffer (size_t nBytes);
+	bool queueWrite (string& szData);
+	bool flushWrites ();
+	void onWritten (size_t nBytes);
 
-	string m_szPipeName;
-	string m_szPipeHost;
-	string m_szFullPipeName;
+	uint32_t m_nId;
 
+#if defined(_WIN32)
 	HANDLE m_hInPipe;
 	HANDLE m_hOutPipe;
+	HANDLE m_hReadEvent;
+	HANDLE m_hWriteEvent;
+	OVERLAPPED m_ReadOv;
+	OVERLAPPED m_WriteOv;
+	bool m_bWritePending;
+	bool m_bReadPending;
+	size_t m_nReadOffset;		// where the pending read stores its data
+	ULONG m_nClientPid;
+#else
+	int m_nFd;					// duplex, serves as in and out pipe
+	bool m_bWriteWatched;
+#endif
+
+	vector<char> m_ReadBuf;		// grows to the largest frame received
+	size_t m_nBuffered;			// valid bytes at the start of m_ReadBuf
+	deque<PipeRequest> m_Requests;
+
+	deque<string> m_OutQueue;	// front is being written
+	size_t m_nOutSent;			// bytes of the front already written
+	size_t m_nOutQueued;		// bytes still to write
+
+	bool m_bLegacyPending;		// m_ReadBuf holds an unterminated legacy command
+	bool m_bMessageEnded;		// the last read took the rest of a client write (Windows only)
+	std::chrono::steady_clock::time_point m_LegacyDeadline;
+
+	CSharedRing* m_pInRing;
+	CSharedRing* m_pOutRing;
+
+	bool m_bBinary;
+	bool m_bSubscribed;			// gets notifications pushed
+	bool m_bBroken;
+	bool m_bFinished;			// legacy client got its reply
 };
 
 #endif // !defined(NAMEDPIPE_H)
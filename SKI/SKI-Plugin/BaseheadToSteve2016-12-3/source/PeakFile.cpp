@@ -0,0 +1,491 @@
+//------------------------------------------------------------------------
+//
+// Project     : BaseHeadSKI
+// Filename    : PeakFile.cpp
+// Description : Min/max waveform overviews of the media we add, built in
+//				 the background and shared with BaseHead through the disk
+//
+//------------------------------------------------------------------------
+#include "PeakFile.h"
+#include "AudioHeader.h"
+#include "MappedFile.h"
+#include "UtfConvert.h"
+
+#include <math.h>
+#include <float.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(_WIN32)
+#include <windows.h>
+#else
+#include <unistd.h>
+#include <sys/stat.h>
+#endif
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define PEAKFILE_SSE2 1
+#include <emmintrin.h>
+#endif
+
+// decoded samples held at once while building level 0, in bytes; the
+// window of source audio mapped at once follows from it
+#define PEAK_WINDOW_BYTES	(4*1024*1024)
+
+//------------------------------------------------------------------------
+string getPeakFolder ()
+{
+#if defined(_WIN32)
+	const wchar_t* pLocal = _wgetenv (L"LOCALAPPDATA");
+	if (!pLocal || !*pLocal)
+		return string ();
+	wstring szFolder = wstring (pLocal) + L"\\BaseHead";
+	CreateDirectoryW (szFolder.c_str (), NULL);
+	szFolder += L"\\Peaks";
+	CreateDirectoryW (szFolder.c_str (), NULL);
+	return toUtf8 (u16string ((const char16_t*)szFolder.c_str ())) + "\\";
+#else
+	const char* pCache = getenv ("XDG_CACHE_HOME");
+	string szFolder;
+	if (pCache && *pCache)
+		szFolder = pCache;
+	else if (const char* pHome = getenv ("HOME"))
+		szFolder = string (pHome) + "/.cache";
+	else
+		return string ();
+	mkdir (szFolder.c_str (), 0755);
+	szFolder += "/BaseHead";
+	mkdir (szFolder.c_str (), 0755);
+	szFolder += "/Peaks";
+	mkdir (szFolder.c_str (), 0755);
+	return szFolder + "/";
+#endif
+}
+
+//------------------------------------------------------------------------
+string getPeakFileName (const string& szSourcePath)
+{
+	uint64_t nHash = 14695981039346656037ULL;
+	for (size_t i = 0; i < szSourcePath.size (); i++)
+	{
+		unsigned char c = (unsigned char)szSourcePath[i];
+		if (c >= 'A' && c <= 'Z')
+			c += 'a' - 'A';
+		else if (c == '/')
+			c = '\\';
+		nHash = (nHash ^ c) * 1099511628211ULL;
+	}
+	char szName[32];
+	snprintf (szName, sizeof (szName), "%016llx", (unsigned long long)nHash);
+	return string (szName) + kPeakFileExtension;
+}
+
+//------------------------------------------------------------------------
+bool isPeakFileCurrent (const string& szPeakPath, uint64_t nSourceSize, uint64_t nSourceModified)
+{
+	CMappedFile file;
+	if (file.open (szPeakPath) || file.GetSize () < sizeof (PeakFileHeader) || file.map (0, sizeof (PeakFileHeader)))
+		return false;
+
+	const PeakFileHeader* pHeader = (const PeakFileHeader*)file.GetData ();
+	return pHeader->magic == kPeakFileMagic && pHeader->version == kPeakFileVersion
+		&& pHeader->sourceSize == nSourceSize && pHeader->sourceModified == nSourceModified;
+}
+
+//------------------------------------------------------------------------
+// Sample decoders, all scaled to -1..1
+static inline int32_t getInt24 (const unsigned char* p, bool bBigEndian)
+{
+	int32_t n = bBigEndian ? (p[0] << 16) | (p[1] << 8) | p[2] : (p[2] << 16) | (p[1] << 8) | p[0];
+	return (n ^ 0x800000) - 0x800000;
+}
+
+template <class T>
+static inline T getSwapped (const unsigned char* p, bool bSwap)
+{
+	unsigned char bytes[sizeof (T)];
+	for (size_t i = 0; i < sizeof (T); i++)
+		bytes[i] = bSwap ? p[sizeof (T) - 1 - i] : p[i];
+	T value;
+	memcpy (&value, bytes, sizeof (T));
+	return value;
+}
+
+//------------------------------------------------------------------------
+// Splits nFrames interleaved frames into one row of floats per channel,
+// rows nStride floats apart
+template <class Decode>
+static void deinterleave (const unsigned char* pSource, size_t nFrames, const AudioFileInfo& info, float* pRows, size_t nStride, Decode decode)
+{
+	size_t nBytes = info.nBlockAlign / info.nChannels;
+	for (size_t nChannel = 0; nChannel < info.nChannels; nChannel++)
+	{
+		const unsigned char* p = pSource + nChannel * nBytes;
+		float* pRow = pRows + nChannel * nStride;
+		for (size_t i = 0; i < nFrames; i++, p += info.nBlockAlign)
+			pRow[i] = decode (p);
+	}
+}
+
+//------------------------------------------------------------------------
+static bool decodeFrames (const unsigned char* pSource, size_t nFrames, const AudioFileInfo& info, float* pRows, size_t nStride)
+{
+	// samples are little endian in WAV, big endian in AIFF, except 'sowt'
+	const uint16_t nOne = 1;
+	const bool bBig = info.bBigEndian;
+	const bool bSwap = bBig == (*(const unsigned char*)&nOne == 1);
+	switch (info.nBlockAlign / info.nChannels)
+	{
+		case 1:
+			if (info.format == kProbeFormatAiff)
+				deinterleave (pSource, nFrames, info, pRows, nStride, [] (const unsigned char* p) { return (int8_t)p[0] * (1.0f / 128.0f); });
+			else
+				deinterleave (pSource, nFrames, info, pRows, nStride, [] (const unsigned char* p) { return (p[0] - 128) * (1.0f / 128.0f); });
+			return true;
+		case 2:
+			deinterleave (pSource, nFrames, info, pRows, nStride, [bSwap] (const unsigned char* p) { return getSwapped<int16_t> (p, bSwap) * (1.0f / 32768.0f); });
+			return true;
+		case 3:
+			deinterleave (pSource, nFrames, info, pRows, nStride, [bBig] (const unsigned char* p) { return getInt24 (p, bBig) * (1.0f / 8388608.0f); });
+			return true;
+		case 4:
+			if (info.bFloat)
+				deinterleave (pSource, nFrames, info, pRows, nStride, [bSwap] (const unsigned char* p) { return getSwapped<float> (p, bSwap); });
+			else
+				deinterleave (pSource, nFrames, info, pRows, nStride, [bSwap] (const unsigned char* p) { return getSwapped<int32_t> (p, bSwap) * (1.0f / 2147483648.0f); });
+			return true;
+		case 8:
+			if (!info.bFloat)
+				return false;
+			deinterleave (pSource, nFrames, info, pRows, nStride, [bSwap] (const unsigned char* p) { return (float)getSwapped<double> (p, bSwap); });
+			return true;
+	}
+	return false;
+}
+
+//------------------------------------------------------------------------
+static void getMinMax (const float* p, size_t n, float& fMin /*out*/, float& fMax /*out*/)
+{
+	size_t i = 0;
+	fMin = FLT_MAX;
+	fMax = -FLT_MAX;
+#if PEAKFILE_SSE2
+	if (n >= 4)
+	{
+		__m128 vMin = _mm_set1_ps (FLT_MAX);
+		__m128 vMax = _mm_set1_ps (-FLT_MAX);
+		for (; i + 4 <= n; i += 4)
+		{
+			__m128 v = _mm_loadu_ps (p + i);
+			vMin = _mm_min_ps (vMin, v);
+			vMax = _mm_max_ps (vMax, v);
+		}
+		float mins[4], maxs[4];
+		_mm_storeu_ps (mins, vMin);
+		_mm_storeu_ps (maxs, vMax);
+		for (int j = 0; j < 4; j++)
+		{
+			fMin = mins[j] < fMin ? mins[j] : fMin;
+			fMax = maxs[j] > fMax ? maxs[j] : fMax;
+		}
+	}
+#endif
+	for (; i < n; i++)
+	{
+		fMin = p[i] < fMin ? p[i] : fMin;
+		fMax = p[i] > fMax ? p[i] : fMax;
+	}
+}
+
+//------------------------------------------------------------------------
+static inline int16_t toPeak (float value, bool bRoundUp)
+{
+	float scaled = value * 32768.0f;
+	scaled = bRoundUp ? ceilf (scaled) : floorf (scaled);
+	if (!(scaled > -32768.0f))		// NaN as well
+		return -32768;
+	if (scaled > 32767.0f)
+		return 32767;
+	return (int16_t)scaled;
+}
+
+//------------------------------------------------------------------------
+// One peak of the next level from up to kPeakLevelFactor peaks of nValues
+// int16 each, alternating min and max
+static void combinePeaks (const int16_t* pIn, size_t nInPeaks, size_t nValues, int16_t* pOut)
+{
+	size_t nOutPeaks = (nInPeaks + kPeakLevelFactor - 1) / kPeakLevelFactor;
+	for (size_t nPeak = 0; nPeak < nOutPeaks; nPeak++)
+	{
+		const int16_t* pRows = pIn + nPeak * kPeakLevelFactor * nValues;
+		size_t nRows = nInPeaks - nPeak * kPeakLevelFactor;
+		if (nRows > kPeakLevelFactor)
+			nRows = kPeakLevelFactor;
+		int16_t* pPeak = pOut + nPeak * nValues;
+
+		size_t i = 0;
+#if PEAKFILE_SSE2
+		// even lanes take the minimum, odd lanes the maximum
+		const __m128i vEven = _mm_set1_epi32 (0x0000FFFF);
+		for (; i + 8 <= nValues; i += 8)
+		{
+			__m128i vMin = _mm_loadu_si128 ((const __m128i*)(pRows + i));
+			__m128i vMax = vMin;
+			for (size_t nRow = 1; nRow < nRows; nRow++)
+			{
+				__m128i v = _mm_loadu_si128 ((const __m128i*)(pRows + nRow * nValues + i));
+				vMin = _mm_min_epi16 (vMin, v);
+				vMax = _mm_max_epi16 (vMax, v);
+			}
+			_mm_storeu_si128 ((__m128i*)(pPeak + i), _mm_or_si128 (_mm_and_si128 (vEven, vMin), _mm_andnot_si128 (vEven, vMax)));
+		}
+#endif
+		for (; i < nValues; i += 2)
+		{
+			int16_t nMin = pRows[i];
+			int16_t nMax = pRows[i + 1];
+			for (size_t nRow = 1; nRow < nRows; nRow++)
+			{
+				const int16_t* pRow = pRows + nRow * nValues;
+				nMin = pRow[i] < nMin ? pRow[i] : nMin;
+				nMax = pRow[i + 1] > nMax ? pRow[i + 1] : nMax;
+			}
+			pPeak[i] = nMin;
+			pPeak[i + 1] = nMax;
+		}
+	}
+}
+
+//------------------------------------------------------------------------
+static bool replaceFile (const string& szFrom, const string& szTo)
+{
+#if defined(_WIN32)
+	u16string szWideFrom = toUtf16 (szFrom);
+	u16string szWideTo = toUtf16 (szTo);
+	return MoveFileExW ((LPCWSTR)szWideFrom.c_str (), (LPCWSTR)szWideTo.c_str (), MOVEFILE_REPLACE_EXISTING) != 0;
+#else
+	return rename (szFrom.c_str (), szTo.c_str ()) == 0;
+#endif
+}
+
+//------------------------------------------------------------------------
+static void deleteFile (const string& szPath)
+{
+#if defined(_WIN32)
+	u16string szWidePath = toUtf16 (szPath);
+	DeleteFileW ((LPCWSTR)szWidePath.c_str ());
+#else
+	unlink (szPath.c_str ());
+#endif
+}
+
+//------------------------------------------------------------------------
+// Level 0 from the source audio, mapped a window at a time
+static const char* buildBaseLevel (CMappedFile& source, const AudioFileInfo& info, int16_t* pPeaks, const std::atomic<bool>* pCancel)
+{
+	const size_t nGranularity = CMappedFile::GetGranularity ();
+	size_t nWindowPeaks = PEAK_WINDOW_BYTES / (sizeof (float) * kPeakBaseFrames * info.nChannels);
+	const size_t nWindowFrames = (size_t)kPeakBaseFrames * (nWindowPeaks > 0 ? nWindowPeaks : 1);
+	std::vector<float> rows (nWindowFrames * info.nChannels);
+
+	for (uint64_t nFrame = 0; nFrame < info.nFrames; nFrame += nWindowFrames)
+	{
+		if (pCancel && *pCancel)
+			return "Cancelled";
+
+		size_t nFrames = (size_t)(info.nFrames - nFrame < nWindowFrames ? info.nFrames - nFrame : nWindowFrames);
+		uint64_t nStart = info.nDataOffset + nFrame * info.nBlockAlign;
+		uint64_t nMapStart = nStart - nStart % nGranularity;
+		size_t nSkip = (size_t)(nStart - nMapStart);
+		const char* error = source.map (nMapStart, nSkip + nFrames * info.nBlockAlign);
+		if (error)
+			return error;
+		if (source.GetMappedSize () < nSkip + nFrames * info.nBlockAlign)
+			return "File is shorter than its header says";
+
+		if (!decodeFrames (source.GetData () + nSkip, nFrames, info, rows.data (), nWindowFrames))
+			return "Unsupported sample format";
+
+		size_t nFirstPeak = (size_t)(nFrame / kPeakBaseFrames);
+		for (size_t nOffset = 0; nOffset < nFrames; nOffset += kPeakBaseFrames)
+		{
+			size_t nCount = nFrames - nOffset < kPeakBaseFrames ? nFrames - nOffset : kPeakBaseFrames;
+			int16_t* pPeak = pPeaks + (nFirstPeak + nOffset / kPeakBaseFrames) * info.nChannels * 2;
+			for (size_t nChannel = 0; nChannel < info.nChannels; nChannel++)
+			{
+				float fMin, fMax;
+				getMinMax (rows.data () + nChannel * nWindowFrames + nOffset, nCount, fMin, fMax);
+				pPeak[nChannel * 2] = toPeak (fMin, false);
+				pPeak[nChannel * 2 + 1] = toPeak (fMax, true);
+			}
+		}
+	}
+	source.unmap ();
+	return 0;
+}
+
+//------------------------------------------------------------------------
+const char* buildPeakFile (const string& szSourcePath, const string& szPeakPath, const std::atomic<bool>* pCancel)
+{
+	AudioFileInfo info;
+	const char* error = CAudioInfoCache::shared ().getInfo (szSourcePath, info);
+	if (error)
+		return error;
+	if (info.bCompressed)
+		return "Compressed audio";
+	if (info.nFrames == 0)
+		return "No audio";
+	if (info.nChannels > kPeakMaxChannels)
+		return "Too many channels";
+	if (info.nBlockAlign % info.nChannels != 0)
+		return "Unsupported sample format";
+
+	CMappedFile source;
+	if ((error = source.open (szSourcePath)) != 0)
+		return error;
+
+	// the layout, level by level down to a single peak
+	PeakFileLevel levels[kPeakMaxLevels];
+	uint16_t nLevels = 0;
+	uint64_t nOffset = sizeof (PeakFileHeader) + kPeakMaxLevels * sizeof (PeakFileLevel);
+	uint64_t nFramesPerPeak = kPeakBaseFrames;
+	uint64_t nPeaks = (info.nFrames + kPeakBaseFrames - 1) / kPeakBaseFrames;
+	while (nLevels < kPeakMaxLevels)
+	{
+		PeakFileLevel& level = levels[nLevels++];
+		memset (&level, 0, sizeof (level));
+		level.framesPerPeak = (uint32_t)nFramesPerPeak;
+		level.peakCount = nPeaks;
+		level.offset = nOffset;
+		nOffset += nPeaks * info.nChannels * 2 * sizeof (int16_t);
+		nOffset = (nOffset + 15) & ~(uint64_t)15;
+		if (nPeaks <= 1 || nFramesPerPeak * kPeakLevelFactor > 0xFFFFFFFF)
+			break;
+		nPeaks = (nPeaks + kPeakLevelFactor - 1) / kPeakLevelFactor;
+		nFramesPerPeak *= kPeakLevelFactor;
+	}
+
+	string szTempPath = szPeakPath + ".tmp";
+	CMappedFile peaks;
+	error = peaks.create (szTempPath, nOffset);
+	if (!error)
+		error = peaks.map (0, (size_t)nOffset);
+	if (!error)
+		error = buildBaseLevel (source, info, (int16_t*)(peaks.GetData () + levels[0].offset), pCancel);
+	if (!error)
+	{
+		for (uint16_t i = 1; i < nLevels; i++)
+		{
+			combinePeaks ((const int16_t*)(peaks.GetData () + levels[i - 1].offset), (size_t)levels[i - 1].peakCount,
+				info.nChannels * 2, (int16_t*)(peaks.GetData () + levels[i].offset));
+		}
+
+		PeakFileHeader header;
+		memset (&header, 0, sizeof (header));
+		header.magic = kPeakFileMagic;
+		header.version = kPeakFileVersion;
+		header.sourceSize = source.GetSize ();
+		header.sourceModified = source.GetModified ();
+		header.frames = info.nFrames;
+		header.sampleRate = info.nSampleRate;
+		header.channels = info.nChannels;
+		header.levelCount = nLevels;
+		memcpy (peaks.GetData () + sizeof (PeakFileHeader), levels, nLevels * sizeof (PeakFileLevel));
+		memcpy (peaks.GetData (), &header, sizeof (header));
+	}
+	peaks.close ();
+	source.close ();
+
+	if (!error && !replaceFile (szTempPath, szPeakPath))
+		error = "Couldn't rename peak file";
+	if (error)
+		deleteFile (szTempPath);
+	return error;
+}
+
+//------------------------------------------------------------------------
+CPeakBuilder::CPeakBuilder (unsigned int nMaxThreads)
+: m_nMaxThreads (nMaxThreads > 0 ? nMaxThreads : 1)
+, m_bShutDown (false)
+{
+}
+
+//------------------------------------------------------------------------
+CPeakBuilder::~CPeakBuilder ()
+{
+	{
+		std::lock_guard<std::mutex> guard (m_Lock);
+		m_bShutDown = true;
+		m_Waiting.clear ();
+	}
+	m_FileAdded.notify_all ();
+
+	for (size_t i = 0; i < m_Threads.size (); i++)
+		m_Threads[i].join ();
+}
+
+//------------------------------------------------------------------------
+void CPeakBuilder::add (const string& szSourcePath)
+{
+	{
+		std::lock_guard<std::mutex> guard (m_Lock);
+		if (m_bShutDown || !m_Pending.insert (szSourcePath).second)
+			return;
+		m_Waiting.push_back (szSourcePath);
+		while (m_Threads.size () < m_nMaxThreads)
+			m_Threads.push_back (std::thread (&CPeakBuilder::work, this));
+	}
+	m_FileAdded.notify_one ();
+}
+
+//------------------------------------------------------------------------
+void CPeakBuilder::add (const std::vector<string>& paths)
+{
+	for (size_t i = 0; i < paths.size (); i++)
+		add (paths[i]);
+}
+
+//------------------------------------------------------------------------
+void CPeakBuilder::work ()
+{
+#if defined(_WIN32)
+	// never compete with the audio engine or the host's own disk access
+	SetThreadPriority (GetCurrentThread (), THREAD_PRIORITY_LOWEST);
+#endif
+	string szFolder = getPeakFolder ();
+
+	std::unique_lock<std::mutex> lock (m_Lock);
+	while (true)
+	{
+		m_FileAdded.wait (lock, [this] { return m_bShutDown || !m_Waiting.empty (); });
+		if (m_bShutDown)
+			break;
+
+		string szSourcePath = m_Waiting.front ();
+		m_Waiting.pop_front ();
+
+		lock.unlock ();
+		if (!szFolder.empty ())
+		{
+			// a file that cannot be built (out of memory or disk space)
+			// is dropped, the host must not go down with it
+			try
+			{
+				string szPeakPath = szFolder + getPeakFileName (szSourcePath);
+				CMappedFile source;
+				if (!source.open (szSourcePath) && !isPeakFileCurrent (szPeakPath, source.GetSize (), source.GetModified ()))
+				{
+					source.close ();
+					buildPeakFile (szSourcePath, szPeakPath, &m_bShutDown);
+				}
+			}
+			catch (...)
+			{
+			}
+		}
+		lock.lock ();
+
+		m_Pending.erase (szSourcePath);
+	}
+}
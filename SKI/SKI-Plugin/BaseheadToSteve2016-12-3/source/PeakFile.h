@@ -0,0 +1,122 @@
+//------------------------------------------------------------------------
+//
+// Project     : BaseHeadSKI
+// Filename    : PeakFile.h
+// Description : Min/max waveform overviews of the media we add, built in
+//				 the background and shared with BaseHead through the disk
+//
+//------------------------------------------------------------------------
+#if !defined(PEAKFILE_H)
+#define PEAKFILE_H
+
+#if _MSC_VER > 1000
+#pragma once
+#endif // _MSC_VER > 1000
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <set>
+#include <string>
+#include <thread>
+#include <vector>
+#include <stdint.h>
+using namespace std;
+
+
+//------------------------------------------------------------------------
+// A peak file holds level 0 with one min/max pair per channel for every
+// kPeakBaseFrames frames, and every further level combines
+// kPeakLevelFactor peaks of the level below, down to a single peak.
+// BaseHead maps the file and reads it in place:
+//
+//   PeakFileHeader
+//   PeakFileLevel[levelCount]
+//   level data, each at its offset: peakCount * channels * {int16 min, int16 max}
+//
+// All fields are little endian. Samples are scaled to -32768..32767. A
+// peak file is written under a temporary name and renamed when complete,
+// so a file with the right name is always whole. It is current while
+// sourceSize and sourceModified (the file time as the OS reports it)
+// match the audio file. The name is the FNV-1a 64 hash of the UTF-8 path
+// with ASCII letters in lower case and '/' turned into '\', as 16 lower
+// case hex digits and kPeakFileExtension, in the folder of getPeakFolder ().
+//------------------------------------------------------------------------
+#define kPeakFileMagic		0x4B504842	/* "BHPK" */
+#define kPeakFileVersion	1
+#define kPeakFileExtension	".bhpk"
+#define kPeakBaseFrames		256
+#define kPeakLevelFactor	4
+#define kPeakMaxLevels		16
+#define kPeakMaxChannels	256		/* files with more get no peak file */
+
+struct PeakFileHeader
+{
+	uint32_t magic;
+	uint32_t version;
+	uint64_t sourceSize;
+	uint64_t sourceModified;
+	uint64_t frames;
+	uint32_t sampleRate;
+	uint16_t channels;
+	uint16_t levelCount;
+	uint32_t reserved[6];
+};
+
+struct PeakFileLevel
+{
+	uint32_t framesPerPeak;
+	uint32_t reserved;
+	uint64_t peakCount;
+	uint64_t offset;		// from the start of the file
+};
+
+static_assert (sizeof (PeakFileHeader) == 64, "PeakFileHeader is read by BaseHead");
+static_assert (sizeof (PeakFileLevel) == 24, "PeakFileLevel is read by BaseHead");
+
+// Where peak files are kept, created on first use; empty if there is no
+// such folder
+string getPeakFolder ();
+string getPeakFileName (const string& szSourcePath);
+
+// true if szPeakPath was built from the source as it is now
+bool isPeakFileCurrent (const string& szPeakPath, uint64_t nSourceSize, uint64_t nSourceModified);
+
+// Builds the peak file of the PCM or float audio file szSourcePath;
+// returns 0 or what went wrong. Stops early when *pCancel gets set.
+const char* buildPeakFile (const string& szSourcePath, const string& szPeakPath, const std::atomic<bool>* pCancel = 0);
+
+// threads building peak files at once
+#define PEAK_BUILDER_THREADS	2
+
+//------------------------------------------------------------------------
+// Builds the peak files of added media on background threads, started
+// with the first file. Files are built in the order they were added;
+// adding one that is waiting or being built already does nothing.
+//------------------------------------------------------------------------
+class CPeakBuilder
+{
+public:
+	//--------------------------------------------------------------------
+	CPeakBuilder (unsigned int nMaxThreads = PEAK_BUILDER_THREADS);
+	virtual ~CPeakBuilder ();	// drops waiting files, stops the ones being built
+
+	// any thread
+	void add (const string& szSourcePath);
+	void add (const std::vector<string>& paths);
+
+//------------------------------------------------------------------------
+private:
+	void work ();
+
+	std::mutex m_Lock;
+	std::condition_variable m_FileAdded;
+	std::deque<string> m_Waiting;		// guarded by m_Lock
+	std::set<string> m_Pending;			// waiting or being built, guarded by m_Lock
+	std::vector<std::thread> m_Threads;
+	unsigned int m_nMaxThreads;
+	std::atomic<bool> m_bShutDown;
+};
+
+#endif // !defined(PEAKFILE_H)
@@ -0,0 +1,190 @@
+//------------------------------------------------------------------------
+//
+// Project     : BaseHeadSKI
+// Filename    : PipeCodec.cpp
+// Description : Binary command encoding, an alternative to the
+//				 tab separated text commands
+//
+//------------------------------------------------------------------------
+#include "PipeCodec.h"
+#include "UtfConvert.h"
+
+#include <string.h>
+
+//------------------------------------------------------------------------
+// explicit byte order, the payload layout does not depend on the host
+static uint16_t readLE16 (const char* p)
+{
+	const unsigned char* b = (const unsigned char*)p;
+	return (uint16_t)(b[0] | (b[1] << 8));
+}
+
+static uint32_t readLE32 (const char* p)
+{
+	const unsigned char* b = (const unsigned char*)p;
+	return (uint32_t)b[0] | ((uint32_t)b[1] << 8) | ((uint32_t)b[2] << 16) | ((uint32_t)b[3] << 24);
+}
+
+static uint64_t readLE64 (const char* p)
+{
+	return (uint64_t)readLE32 (p) | ((uint64_t)readLE32 (p + 4) << 32);
+}
+
+static void appendLE (string& szOut, uint64_t nValue, int nBytes)
+{
+	for (int i = 0; i < nBytes; i++)
+		szOut += (char)((nValue >> (8 * i)) & 0xFF);
+}
+
+//------------------------------------------------------------------------
+bool PipeField::getUInt32 (uint32_t& nValue /*out*/) const
+{
+	if (type != kPipeFieldUInt32 || length != 4)
+		return false;
+	nValue = readLE32 (data);
+	return true;
+}
+
+//------------------------------------------------------------------------
+bool PipeField::getFloat64 (double& fValue /*out*/) const
+{
+	if (type != kPipeFieldFloat64 || length != 8)
+		return false;
+	uint64_t nBits = readLE64 (data);
+	memcpy (&fValue, &nBits, sizeof (fValue));
+	return true;
+}
+
+//------------------------------------------------------------------------
+bool PipeField::getString8 (string& szValue /*out*/) const
+{
+	if (type == kPipeFieldString8)
+	{
+		szValue.assign (data, length);
+		return true;
+	}
+	u16string szUnits;
+	if (!getString16 (szUnits))
+		return false;
+
+	// unpaired surrogates come out as U+FFFD, which is good enough for text
+	utf16ToUtf8 (szUnits, szValue);
+	return true;
+}
+
+//------------------------------------------------------------------------
+bool PipeField::getString16 (u16string& szValue /*out*/) const
+{
+	szValue.clear ();
+	if (type == kPipeFieldString16)
+	{
+		if (length & 1)
+			return false;
+		szValue.reserve (length / 2);
+		for (uint32_t i = 0; i < length; i += 2)
+			szValue += (char16_t)readLE16 (data + i);
+		return true;
+	}
+	if (type != kPipeFieldString8)
+		return false;
+
+	return utf8ToUtf16 (data, length, szValue);
+}
+
+//------------------------------------------------------------------------
+CPipeFieldReader::CPipeFieldReader (const char* pData, size_t nSize)
+: m_pData (pData)
+, m_nSize (nSize)
+, m_nOffset (sizeof (PipeBinaryHeader))
+, m_nFieldCount (0)
+, m_nFieldsRead (0)
+, m_bValid (false)
+{
+	if (nSize < sizeof (PipeBinaryHeader) || readLE16 (pData) != kPipeBinaryVersion)
+		return;
+	m_nFieldCount = readLE16 (pData + 2);
+	m_bValid = true;
+}
+
+//------------------------------------------------------------------------
+bool CPipeFieldReader::next (PipeField& field /*out*/)
+{
+	if (!m_bValid || m_nFieldsRead >= m_nFieldCount)
+		return false;
+	if (m_nSize - m_nOffset < sizeof (PipeFieldHeader))
+	{
+		m_bValid = false;
+		return false;
+	}
+
+	const char* pField = m_pData + m_nOffset;
+	uint32_t nLength = readLE32 (pField + 4);
+	if (m_nSize - m_nOffset - sizeof (PipeFieldHeader) < nLength)
+	{
+		m_bValid = false;
+		return false;
+	}
+
+	field.type = (uint8_t)pField[0];
+	field.data = pField + sizeof (PipeFieldHeader);
+	field.length = nLength;
+
+	m_nOffset += sizeof (PipeFieldHeader) + nLength;
+	m_nFieldsRead++;
+	return true;
+}
+
+//------------------------------------------------------------------------
+CPipeFieldWriter::CPipeFieldWriter ()
+: m_nFieldCount (0)
+{
+	appendLE (m_szPayload, kPipeBinaryVersion, 2);
+	appendLE (m_szPayload, 0, 2);
+}
+
+//------------------------------------------------------------------------
+void CPipeFieldWriter::addString8 (const string& szValue)
+{
+	addField (kPipeFieldString8, szValue.data (), (uint32_t)szValue.length ());
+}
+
+//------------------------------------------------------------------------
+void CPipeFieldWriter::addString16 (const u16string& szValue)
+{
+	string szBytes;
+	szBytes.reserve (szValue.length () * 2);
+	for (size_t i = 0; i < szValue.length (); i++)
+		appendLE (szBytes, szValue[i], 2);
+	addField (kPipeFieldString16, szBytes.data (), (uint32_t)szBytes.length ());
+}
+
+//------------------------------------------------------------------------
+void CPipeFieldWriter::addUInt32 (uint32_t nValue)
+{
+	string szBytes;
+	appendLE (szBytes, nValue, 4);
+	addField (kPipeFieldUInt32, szBytes.data (), 4);
+}
+
+//------------------------------------------------------------------------
+void CPipeFieldWriter::addFloat64 (double fValue)
+{
+	uint64_t nBits = 0;
+	memcpy (&nBits, &fValue, sizeof (nBits));
+	string szBytes;
+	appendLE (szBytes, nBits, 8);
+	addField (kPipeFieldFloat64, szBytes.data (), 8);
+}
+
+//------------------------------------------------------------------------
+void CPipeFieldWriter::addField (uint8_t nType, const void* pData, uint32_t nLength)
+{
+	m_szPayload += (char)nType;
+	m_szPayload.append (3, '\0');
+	appendLE (m_szPayload, nLength, 4);
+	m_szPayload.append ((const char*)pData, nLength);
+
+	m_nFieldCount++;
+	m_szPayload[2] = (char)(m_nFieldCount & 0xFF);
+	m_szPayload[3] = (char)(m_nFieldCount >> 8);
+}
@@ -0,0 +1,121 @@
+//------------------------------------------------------------------------
+//
+// Project     : BaseHeadSKI
+// Filename    : PipeCodec.h
+// Description : Binary command encoding, an alternative to the
+//				 tab separated text commands
+//
+//------------------------------------------------------------------------
+#if !defined(PIPECODEC_H)
+#define PIPECODEC_H
+
+#if _MSC_VER > 1000
+#pragma once
+#endif // _MSC_VER > 1000
+
+#include <string>
+#include <stdint.h>
+using namespace std;
+
+
+//------------------------------------------------------------------------
+// A binary payload (frame flag kPipeFrameBinary) is a PipeBinaryHeader
+// followed by 'fieldCount' fields. Every field is a PipeFieldHeader and
+// 'length' bytes of data, without padding. All numbers are little-endian.
+// The first field of a command is its name as string8, the remaining
+// ones are the arguments in the same order as in the text protocol.
+// Replies carry a single string8 field with the result text.
+//
+// A session has to send the text command PIPE_HELLO_BINARY_COMMAND
+// before its first binary frame; text commands keep working afterwards.
+//------------------------------------------------------------------------
+#define kPipeBinaryVersion	1
+
+// field types
+#define kPipeFieldString8	1	/* UTF-8, not terminated */
+#define kPipeFieldString16	2	/* UTF-16LE, not terminated */
+#define kPipeFieldUInt32	3
+#define kPipeFieldFloat64	4	/* IEEE 754 double */
+
+struct PipeBinaryHeader
+{
+	uint16_t version;
+	uint16_t fieldCount;
+};
+
+struct PipeFieldHeader
+{
+	uint8_t type;		// kPipeField...
+	uint8_t reserved[3];
+	uint32_t length;	// data size in bytes
+};
+
+//------------------------------------------------------------------------
+// View of one field inside a payload; nothing is copied, the payload has
+// to outlive it.
+//------------------------------------------------------------------------
+struct PipeField
+{
+	uint8_t type;
+	const char* data;
+	uint32_t length;
+
+	PipeField () : type (0), data (NULL), length (0) {}
+
+	bool isString () const { return type == kPipeFieldString8 || type == kPipeFieldString16; }
+
+	bool getUInt32 (uint32_t& nValue /*out*/) const;
+	bool getFloat64 (double& fValue /*out*/) const;
+
+	// string fields in either encoding, converted if necessary
+	bool getString8 (string& szValue /*out*/) const;
+	bool getString16 (u16string& szValue /*out*/) const;
+};
+
+//------------------------------------------------------------------------
+class CPipeFieldReader
+{
+public:
+	//--------------------------------------------------------------------
+	CPipeFieldReader (const char* pData, size_t nSize);
+
+	// false if the header is missing or from an unknown version
+	bool isValid () const { return m_bValid; }
+	uint16_t countFields () const { return m_nFieldCount; }
+
+	// false after the last field or if the payload is truncated
+	bool next (PipeField& field /*out*/);
+
+//------------------------------------------------------------------------
+private:
+	const char* m_pData;
+	size_t m_nSize;
+	size_t m_nOffset;
+	uint16_t m_nFieldCount;
+	uint16_t m_nFieldsRead;
+	bool m_bValid;
+};
+
+//------------------------------------------------------------------------
+class CPipeFieldWriter
+{
+public:
+	//--------------------------------------------------------------------
+	CPipeFieldWriter ();
+
+	void addString8 (const string& szValue);
+	void addString16 (const u16string& szValue);
+	void addUInt32 (uint32_t nValue);
+	void addFloat64 (double fValue);
+
+	const string& GetPayload () const { return m_szPayload; }
+
+//------------------------------------------------------------------------
+private:
+	void addField (uint8_t nType, const void* pData, uint32_t nLength);
+
+	string m_szPayload;
+	uint16_t m_nFieldCount;
+};
+
+#endif // !defined(PIPECODEC_H)
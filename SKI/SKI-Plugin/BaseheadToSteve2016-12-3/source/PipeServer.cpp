@@ -0,0 +1,807 @@
+//------------------------------------------------------------------------
+//
+// Project     : BaseHeadSKI
+// Filename    : PipeServer.cpp
+// Description : Accepts any number of BaseHead client sessions on the
+//				 command pipe and hands their commands out one at a time
+//
+//------------------------------------------------------------------------
+#include "PipeServer.h"
+#include "PipeCodec.h"
+
+#include <stdio.h>
+#include <string.h>
+
+#if !defined(_WIN32)
+#include <errno.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#endif
+
+#define PIPE_BUF_SIZE (64*1024)		/*pipe quota*/
+#define PIPE_TIMEOUT  (120*1000) /*120 seconds*/
+#define WAIT_FOREVER  0xFFFFFFFF
+#define MAX_PENDING_EVENTS 256
+
+#if defined(_WIN32)
+// stop and wake events and both listeners share the wait set with the
+// sessions, which wait for reading and writing
+#define MAX_SESSIONS  ((MAXIMUM_WAIT_OBJECTS - 4) / 2)
+#else
+#define MAX_SESSIONS  64
+#endif
+
+//------------------------------------------------------------------------
+CPipeServer::CPipeServer ()
+: m_nNextSession (0)
+, m_nNextId (1)
+, m_bStopped (false)
+{
+	m_szPipeName = "";
+	m_szPipeHost = ".";
+#if defined(_WIN32)
+	m_szFullPipeName = "\\\\.\\PIPE\\";
+
+	memset (&m_ListenIn, 0, sizeof (m_ListenIn));
+	memset (&m_ListenOut, 0, sizeof (m_ListenOut));
+	m_ListenIn.hEvent = CreateEvent (NULL, TRUE, FALSE, NULL);
+	m_ListenOut.hEvent = CreateEvent (NULL, TRUE, FALSE, NULL);
+	m_hStopEvent = CreateEvent (NULL, TRUE, FALSE, NULL);
+	m_hWakeEvent = CreateEvent (NULL, TRUE, FALSE, NULL);
+#else
+	m_szFullPipeName = "/tmp/";
+
+	m_nListenFd = -1;
+	m_nEpollFd = -1;
+	m_nStopFd = eventfd (0, EFD_CLOEXEC);
+	m_nWakeFd = eventfd (0, EFD_CLOEXEC | EFD_NONBLOCK);
+#endif
+}
+
+//------------------------------------------------------------------------
+CPipeServer::~CPipeServer ()
+{
+	closeServer ();
+
+#if defined(_WIN32)
+	if (m_ListenIn.hEvent)
+		CloseHandle (m_ListenIn.hEvent);
+	if (m_ListenOut.hEvent)
+		CloseHandle (m_ListenOut.hEvent);
+	if (m_hStopEvent)
+		CloseHandle (m_hStopEvent);
+	if (m_hWakeEvent)
+		CloseHandle (m_hWakeEvent);
+#else
+	if (m_nStopFd >= 0)
+		close (m_nStopFd);
+	if (m_nWakeFd >= 0)
+		close (m_nWakeFd);
+#endif
+}
+
+//------------------------------------------------------------------------
+bool CPipeServer::read (PipeRequest& request /*out*/)
+{
+	while (!m_bStopped)
+	{
+		flushReplies ();
+		uint32_t nTimeout = flushLegacy ();
+		if (nextRequest (request))
+		{
+			if (request.framed && !request.binary && request.payload == PIPE_OPEN_RING_COMMAND)
+			{
+				openRings (request);
+				continue;
+			}
+			if (request.framed && !request.binary && request.payload == PIPE_HELLO_BINARY_COMMAND)
+			{
+				enableBinary (request);
+				continue;
+			}
+			if (request.framed && !request.binary && request.payload == PIPE_SUBSCRIBE_COMMAND)
+			{
+				subscribe (request);
+				continue;
+			}
+			if (request.binary)
+			{
+				CNamedPipe* pSession = findSession (request.session);
+				if (!pSession || !pSession->isBinary ())
+				{
+					request.binary = false;
+					send (request, "Binary encoding not negotiated");
+					continue;
+				}
+			}
+			return true;
+		}
+		if (!waitForEvents (nTimeout))
+			return false;
+	}
+	return false;
+}
+
+//------------------------------------------------------------------------
+// Completes the unterminated legacy commands whose clients went quiet;
+// returns how long to wait for the next one to do so.
+uint32_t CPipeServer::flushLegacy ()
+{
+	typedef std::chrono::steady_clock Clock;
+	Clock::time_point now = Clock::now ();
+	uint32_t nTimeout = WAIT_FOREVER;
+	for (size_t i = 0; i < m_Sessions.size (); i++)
+	{
+		Clock::time_point deadline;
+		if (!m_Sessions[i]->GetLegacyDeadline (deadline))
+			continue;
+		if (deadline <= now)
+		{
+			m_Sessions[i]->flushLegacy ();
+			continue;
+		}
+
+		uint32_t nLeft = (uint32_t)std::chrono::duration_cast<std::chrono::milliseconds> (deadline - now).count () + 1;
+		if (nLeft < nTimeout)
+			nTimeout = nLeft;
+	}
+	return nTimeout;
+}
+
+//------------------------------------------------------------------------
+bool CPipeServer::send (const PipeRequest& request, string szMsg)
+{
+	// the client may open its _OUT pipe only after sending the command,
+	// the reply then waits in the session's queue until pairOutPipes ()
+	CNamedPipe* pSession = findSession (request.session);
+	if (!pSession)
+		return false;
+
+	bool bOK = pSession->send (request, szMsg);
+	keepSession (pSession);
+	return bOK;
+}
+
+//------------------------------------------------------------------------
+void CPipeServer::postReply (const PipeRequest& request, const string& szMsg)
+{
+	{
+		std::lock_guard<std::mutex> guard (m_ReplyLock);
+		PendingReply reply;
+		reply.request = request;
+		reply.szMsg = szMsg;
+		m_Replies.push_back (reply);
+	}
+	wake ();
+}
+
+//------------------------------------------------------------------------
+void CPipeServer::postEvent (uint32_t nCode, const string& szMsg)
+{
+	{
+		std::lock_guard<std::mutex> guard (m_ReplyLock);
+		if (m_Events.size () >= MAX_PENDING_EVENTS)
+			m_Events.pop_front ();
+		PendingEvent event;
+		event.nCode = nCode;
+		event.szMsg = szMsg;
+		m_Events.push_back (event);
+	}
+	wake ();
+}
+
+//------------------------------------------------------------------------
+void CPipeServer::wake ()
+{
+#if defined(_WIN32)
+	if (m_hWakeEvent)
+		SetEvent (m_hWakeEvent);
+#else
+	if (m_nWakeFd >= 0)
+	{
+		uint64_t nOne = 1;
+		ssize_t nDummy = write (m_nWakeFd, &nOne, sizeof (nOne));
+		(void)nDummy;
+	}
+#endif
+}
+
+//------------------------------------------------------------------------
+// Writes the replies queued by postReply () and the notifications queued
+// by postEvent (). The wake signal is cleared in waitForEvents () before
+// this runs, so anything posted meanwhile either shows up here or
+// signals again.
+void CPipeServer::flushReplies ()
+{
+	vector<PendingReply> replies;
+	deque<PendingEvent> events;
+	{
+		std::lock_guard<std::mutex> guard (m_ReplyLock);
+		if (m_Replies.empty () && m_Events.empty ())
+			return;
+		replies.swap (m_Replies);
+		events.swap (m_Events);
+	}
+
+	for (size_t i = 0; i < replies.size () && !m_bStopped; i++)
+		send (replies[i].request, replies[i].szMsg);
+
+	for (size_t i = 0; i < events.size () && !m_bStopped; i++)
+	{
+		for (size_t j = 0; j < m_Sessions.size (); )
+		{
+			CNamedPipe* pSession = m_Sessions[j];
+			if (pSession->isSubscribed ())
+				pSession->sendEvent (events[i].nCode, events[i].szMsg);
+			if (keepSession (pSession))
+				j++;
+		}
+	}
+}
+
+//------------------------------------------------------------------------
+bool CPipeServer::nextRequest (PipeRequest& request /*out*/)
+{
+	size_t nSessions = m_Sessions.size ();
+	for (size_t i = 0; i < nSessions; i++)
+	{
+		size_t nIndex = (m_nNextSession + i) % nSessions;
+		if (m_Sessions[nIndex]->popRequest (request))
+		{
+			m_nNextSession = nIndex + 1;
+			return true;
+		}
+	}
+	return false;
+}
+
+//------------------------------------------------------------------------
+// Sets up the shared memory rings of a session. The names are unique per
+// process and session, so several hosts and clients can coexist.
+void CPipeServer::openRings (const PipeRequest& request)
+{
+	CNamedPipe* pSession = findSession (request.session);
+	if (!pSession)
+		return;
+
+#if defined(_WIN32)
+	unsigned long nProcessId = GetCurrentProcessId ();
+#else
+	unsigned long nProcessId = (unsigned long)getpid ();
+#endif
+	char szSuffix[64];
+	snprintf (szSuffix, sizeof (szSuffix), "_%lu_%u", nProcessId, request.session);
+	string szInName = m_szPipeName + szSuffix + "_in";
+	string szOutName = m_szPipeName + szSuffix + "_out";
+
+	if (pSession->openRings (szInName, szOutName, kPipeRingCapacity))
+		send (request, "ok\t" + szInName + "\t" + szOutName);
+	else
+		send (request, "Couldn't create shared memory rings");
+}
+
+//------------------------------------------------------------------------
+void CPipeServer::enableBinary (const PipeRequest& request)
+{
+	CNamedPipe* pSession = findSession (request.session);
+	if (!pSession)
+		return;
+
+	pSession->enableBinary ();
+	char szReply[32];
+	snprintf (szReply, sizeof (szReply), "ok\t%d", kPipeBinaryVersion);
+	send (request, szReply);
+}
+
+//------------------------------------------------------------------------
+void CPipeServer::subscribe (const PipeRequest& request)
+{
+	CNamedPipe* pSession = findSession (request.session);
+	if (!pSession)
+		return;
+
+	pSession->subscribe ();
+	send (request, "ok");
+}
+
+//------------------------------------------------------------------------
+CNamedPipe* CPipeServer::findSession (uint32_t nId)
+{
+	for (size_t i = 0; i < m_Sessions.size (); i++)
+	{
+		if (m_Sessions[i]->GetId () == nId)
+			return m_Sessions[i];
+	}
+	return NULL;
+}
+
+//------------------------------------------------------------------------
+// Removes pSession once it broke, or once a legacy session has its reply
+// written; otherwise makes sure its queued writes get serviced. Returns
+// false if the session is gone.
+bool CPipeServer::keepSession (CNamedPipe* pSession)
+{
+	if (pSession->isBroken () || (pSession->isFinished () && !pSession->hasQueuedWrites ()))
+	{
+		removeSession (pSession);
+		return false;
+	}
+
+#if !defined(_WIN32)
+	bool bWatch = pSession->hasQueuedWrites ();
+	if (bWatch != pSession->isWriteWatched ())
+	{
+		struct epoll_event ev;
+		memset (&ev, 0, sizeof (ev));
+		ev.events = bWatch ? (EPOLLIN | EPOLLOUT) : EPOLLIN;
+		ev.data.fd = pSession->GetFd ();
+		epoll_ctl (m_nEpollFd, EPOLL_CTL_MOD, pSession->GetFd (), &ev);
+		pSession->setWriteWatched (bWatch);
+	}
+#endif
+	return true;
+}
+
+//------------------------------------------------------------------------
+void CPipeServer::removeSession (CNamedPipe* pSession)
+{
+	for (size_t i = 0; i < m_Sessions.size (); i++)
+	{
+		if (m_Sessions[i] != pSession)
+			continue;
+
+		m_Sessions.erase (m_Sessions.begin () + i);
+		if (m_nNextSession > i)
+			m_nNextSession--;
+#if !defined(_WIN32)
+		epoll_ctl (m_nEpollFd, EPOLL_CTL_DEL, pSession->GetFd (), NULL);
+#endif
+		delete pSession;
+		break;
+	}
+
+#if defined(_WIN32)
+	// a slot became free again
+	if (m_ListenIn.hPipe == NULL && !m_bStopped)
+		listen (m_ListenIn, true);
+#endif
+}
+
+#if defined(_WIN32)
+//------------------------------------------------------------------------
+bool CPipeServer::initialize ()
+{
+	if (!listen (m_ListenIn, true))
+		return false;
+	if (!listen (m_ListenOut, false))
+	{
+		closeServer ();
+		return false;
+	}
+	return true;
+}
+
+//------------------------------------------------------------------------
+void CPipeServer::interrupt ()
+{
+	if (m_hStopEvent)
+		SetEvent (m_hStopEvent);
+}
+
+//------------------------------------------------------------------------
+void CPipeServer::SetPipeName (string szName, string szHost/* = "."*/)
+{
+	m_szPipeName = szName;
+	m_szPipeHost = szHost;
+	m_szFullPipeName = "\\\\";
+	m_szFullPipeName += m_szPipeHost;
+	m_szFullPipeName += "\\PIPE\\";
+	m_szFullPipeName += m_szPipeName;
+}
+
+//------------------------------------------------------------------------
+string CPipeServer::GetRealPipeName (bool bIsServerInPipe)
+{
+	string szRetVal = m_szFullPipeName;
+	szRetVal += bIsServerInPipe?"_IN":"_OUT";
+	return szRetVal;
+}
+
+//------------------------------------------------------------------------
+// Creates a new pipe instance and waits (overlapped) for a client on it.
+bool CPipeServer::listen (Listener& listener, bool bIn)
+{
+	listener.hPipe = CreateNamedPipe (
+		GetRealPipeName (bIn).c_str (),
+		(bIn ? PIPE_ACCESS_INBOUND : PIPE_ACCESS_OUTBOUND) | FILE_FLAG_OVERLAPPED,
+		// client writes stay apart on _IN, see CNamedPipe::parseFrames ()
+		bIn ? (PIPE_TYPE_MESSAGE | PIPE_READMODE_MESSAGE | PIPE_WAIT) : PIPE_WAIT,
+		PIPE_UNLIMITED_INSTANCES,
+		PIPE_BUF_SIZE,
+		PIPE_BUF_SIZE,
+		PIPE_TIMEOUT,
+		NULL);
+	if (listener.hPipe == INVALID_HANDLE_VALUE)
+		listener.hPipe = NULL;
+	if (listener.hPipe == NULL)
+		return false;
+
+	HANDLE hEvent = listener.hEvent;
+	memset (&listener.ov, 0, sizeof (listener.ov));
+	listener.ov.hEvent = hEvent;
+	listener.bConnected = false;
+	ResetEvent (hEvent);
+
+	if (!ConnectNamedPipe (listener.hPipe, &listener.ov))
+	{
+		DWORD dwError = GetLastError ();
+		if (dwError == ERROR_PIPE_CONNECTED)
+		{
+			// the client was faster, handled like any other connect
+			listener.bConnected = true;
+			SetEvent (hEvent);
+		}
+		else if (dwError != ERROR_IO_PENDING)
+		{
+			CloseHandle (listener.hPipe);
+			listener.hPipe = NULL;
+			return false;
+		}
+	}
+	return true;
+}
+
+//------------------------------------------------------------------------
+void CPipeServer::onConnected (Listener& listener, bool bIn)
+{
+	HANDLE hPipe = listener.hPipe;
+	listener.hPipe = NULL;
+
+	DWORD dwDummy = 0;
+	if (!listener.bConnected && !GetOverlappedResult (hPipe, &listener.ov, &dwDummy, FALSE))
+	{
+		CloseHandle (hPipe);
+	}
+	else if (isPairingPending (hPipe, bIn))
+	{
+		// its _OUT could not be told from the one of the waiting session
+		DisconnectNamedPipe (hPipe);
+		CloseHandle (hPipe);
+	}
+	else if (bIn)
+	{
+		CNamedPipe* pSession = new CNamedPipe (m_nNextId++, hPipe);
+		m_Sessions.push_back (pSession);
+		pSession->startRead ();
+	}
+	else
+	{
+		UnpairedOut out;
+		out.hPipe = hPipe;
+		out.nClientPid = 0;
+		GetNamedPipeClientProcessId (hPipe, &out.nClientPid);
+		m_UnpairedOut.push_back (out);
+
+		// clients that never open their _IN pipe must not pile up
+		if (m_UnpairedOut.size () > MAX_SESSIONS)
+		{
+			CloseHandle (m_UnpairedOut.front ().hPipe);
+			m_UnpairedOut.erase (m_UnpairedOut.begin ());
+		}
+	}
+	pairOutPipes ();
+
+	// keep one instance armed for the next client, unless the wait set is full
+	if (!bIn || m_Sessions.size () < MAX_SESSIONS)
+		listen (listener, bIn);
+}
+
+//------------------------------------------------------------------------
+// Pipes are paired by client process only, so a process may have one
+// session or one _OUT instance at a time waiting for its counterpart.
+bool CPipeServer::isPairingPending (HANDLE hPipe, bool bIn)
+{
+	ULONG nClientPid = 0;
+	if (!GetNamedPipeClientProcessId (hPipe, &nClientPid))
+		return false;
+
+	if (bIn)
+	{
+		for (size_t i = 0; i < m_Sessions.size (); i++)
+		{
+			if (!m_Sessions[i]->hasOutPipe () && m_Sessions[i]->GetClientProcessId () == nClientPid)
+				return true;
+		}
+	}
+	else
+	{
+		for (size_t i = 0; i < m_UnpairedOut.size (); i++)
+		{
+			if (m_UnpairedOut[i].nClientPid == nClientPid)
+				return true;
+		}
+	}
+	return false;
+}
+
+//------------------------------------------------------------------------
+// Hands every connected _OUT instance to the oldest session of the same
+// client process that has no reply pipe yet.
+void CPipeServer::pairOutPipes ()
+{
+	for (size_t i = 0; i < m_UnpairedOut.size (); )
+	{
+		CNamedPipe* pSession = NULL;
+		for (size_t j = 0; j < m_Sessions.size (); j++)
+		{
+			if (!m_Sessions[j]->hasOutPipe () && m_Sessions[j]->GetClientProcessId () == m_UnpairedOut[i].nClientPid)
+			{
+				pSession = m_Sessions[j];
+				break;
+			}
+		}
+
+		if (pSession)
+		{
+			pSession->attachOutPipe (m_UnpairedOut[i].hPipe);
+			pSession->onWritable ();
+			m_UnpairedOut.erase (m_UnpairedOut.begin () + i);
+		}
+		else
+			i++;
+	}
+}
+
+//------------------------------------------------------------------------
+// Waits until something happens on any pipe and services it. Returns
+// false once interrupt () was called.
+bool CPipeServer::waitForEvents (uint32_t nTimeout)
+{
+	if (m_bStopped)
+		return false;
+
+	HANDLE hWait[MAXIMUM_WAIT_OBJECTS];
+	DWORD nWait = 0;
+	hWait[nWait++] = m_hStopEvent;
+	hWait[nWait++] = m_hWakeEvent;
+	if (m_ListenIn.hPipe)
+		hWait[nWait++] = m_ListenIn.hEvent;
+	if (m_ListenOut.hPipe)
+		hWait[nWait++] = m_ListenOut.hEvent;
+	for (size_t i = 0; i < m_Sessions.size () && nWait < MAXIMUM_WAIT_OBJECTS; i++)
+	{
+		hWait[nWait++] = m_Sessions[i]->GetReadEvent ();
+		if (m_Sessions[i]->isWritePending () && nWait < MAXIMUM_WAIT_OBJECTS)
+			hWait[nWait++] = m_Sessions[i]->GetWriteEvent ();
+	}
+
+	DWORD dwResult = WaitForMultipleObjects (nWait, hWait, FALSE, nTimeout);
+	if (dwResult == WAIT_TIMEOUT)
+		return true;
+	if (dwResult == WAIT_OBJECT_0 || dwResult == WAIT_FAILED)
+	{
+		m_bStopped = true;
+		return false;
+	}
+
+	// queued replies are written by read ()
+	if (WaitForSingleObject (m_hWakeEvent, 0) == WAIT_OBJECT_0)
+		ResetEvent (m_hWakeEvent);
+
+	// service every signalled source, not only the first one reported,
+	// so a busy session cannot starve the others
+	if (m_ListenIn.hPipe && WaitForSingleObject (m_ListenIn.hEvent, 0) == WAIT_OBJECT_0)
+		onConnected (m_ListenIn, true);
+	if (m_ListenOut.hPipe && WaitForSingleObject (m_ListenOut.hEvent, 0) == WAIT_OBJECT_0)
+		onConnected (m_ListenOut, false);
+
+	for (size_t i = 0; i < m_Sessions.size (); )
+	{
+		CNamedPipe* pSession = m_Sessions[i];
+		if (WaitForSingleObject (pSession->GetReadEvent (), 0) == WAIT_OBJECT_0)
+			pSession->onReadable ();
+		if (pSession->isWritePending () && WaitForSingleObject (pSession->GetWriteEvent (), 0) == WAIT_OBJECT_0)
+			pSession->onWritable ();
+
+		if (keepSession (pSession))
+			i++;
+	}
+	return true;
+}
+
+//------------------------------------------------------------------------
+void CPipeServer::closeServer ()
+{
+	for (size_t i = 0; i < m_Sessions.size (); i++)
+		delete m_Sessions[i];
+	m_Sessions.clear ();
+
+	for (size_t i = 0; i < m_UnpairedOut.size (); i++)
+		CloseHandle (m_UnpairedOut[i].hPipe);
+	m_UnpairedOut.clear ();
+
+	Listener* listeners[2] = { &m_ListenIn, &m_ListenOut };
+	for (int i = 0; i < 2; i++)
+	{
+		if (listeners[i]->hPipe == NULL)
+			continue;
+		if (!listeners[i]->bConnected)
+		{
+			CancelIo (listeners[i]->hPipe);
+			DWORD dwDummy = 0;
+			GetOverlappedResult (listeners[i]->hPipe, &listeners[i]->ov, &dwDummy, TRUE);
+		}
+		CloseHandle (listeners[i]->hPipe);
+		listeners[i]->hPipe = NULL;
+	}
+}
+
+#else
+//------------------------------------------------------------------------
+bool CPipeServer::initialize ()
+{
+	if (m_nStopFd < 0 || m_nWakeFd < 0)
+		return false;
+
+	string szPath = GetRealPipeName (true);
+	struct sockaddr_un addr;
+	memset (&addr, 0, sizeof (addr));
+	addr.sun_family = AF_UNIX;
+	if (szPath.length () >= sizeof (addr.sun_path))
+		return false;
+	strcpy (addr.sun_path, szPath.c_str ());
+
+	m_nListenFd = socket (AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+	if (m_nListenFd < 0)
+		return false;
+
+	// a previous instance may have left its socket file behind
+	unlink (addr.sun_path);
+	if (bind (m_nListenFd, (struct sockaddr*)&addr, sizeof (addr)) != 0
+		|| ::listen (m_nListenFd, SOMAXCONN) != 0)
+	{
+		closeServer ();
+		return false;
+	}
+
+	m_nEpollFd = epoll_create1 (EPOLL_CLOEXEC);
+	if (m_nEpollFd < 0)
+	{
+		closeServer ();
+		return false;
+	}
+
+	struct epoll_event ev;
+	memset (&ev, 0, sizeof (ev));
+	ev.events = EPOLLIN;
+	ev.data.fd = m_nStopFd;
+	epoll_ctl (m_nEpollFd, EPOLL_CTL_ADD, m_nStopFd, &ev);
+	ev.data.fd = m_nWakeFd;
+	epoll_ctl (m_nEpollFd, EPOLL_CTL_ADD, m_nWakeFd, &ev);
+	ev.data.fd = m_nListenFd;
+	epoll_ctl (m_nEpollFd, EPOLL_CTL_ADD, m_nListenFd, &ev);
+	return true;
+}
+
+//------------------------------------------------------------------------
+void CPipeServer::interrupt ()
+{
+	if (m_nStopFd >= 0)
+	{
+		uint64_t nOne = 1;
+		ssize_t nDummy = write (m_nStopFd, &nOne, sizeof (nOne));
+		(void)nDummy;
+	}
+}
+
+//------------------------------------------------------------------------
+void CPipeServer::SetPipeName (string szName, string szHost/* = "."*/)
+{
+	// Unix domain sockets are local only, szHost is ignored
+	m_szPipeName = szName;
+	m_szPipeHost = szHost;
+	m_szFullPipeName = "/tmp/";
+	m_szFullPipeName += m_szPipeName;
+}
+
+//------------------------------------------------------------------------
+string CPipeServer::GetRealPipeName (bool /*bIsServerInPipe*/)
+{
+	// one duplex socket per session serves both directions
+	return m_szFullPipeName + ".sock";
+}
+
+//------------------------------------------------------------------------
+bool CPipeServer::waitForEvents (uint32_t nTimeout)
+{
+	if (m_bStopped)
+		return false;
+
+	struct epoll_event events[MAX_SESSIONS + 3];
+	int nEvents = epoll_wait (m_nEpollFd, events, MAX_SESSIONS + 3, nTimeout == WAIT_FOREVER ? -1 : (int)nTimeout);
+	if (nEvents < 0)
+	{
+		if (errno == EINTR)
+			return true;
+		m_bStopped = true;
+		return false;
+	}
+
+	for (int i = 0; i < nEvents; i++)
+	{
+		int fd = events[i].data.fd;
+		if (fd == m_nStopFd)
+		{
+			m_bStopped = true;
+			return false;
+		}
+
+		if (fd == m_nWakeFd)
+		{
+			// queued replies are written by read ()
+			uint64_t nCount = 0;
+			ssize_t nDummy = ::read (m_nWakeFd, &nCount, sizeof (nCount));
+			(void)nDummy;
+			continue;
+		}
+
+		if (fd == m_nListenFd)
+		{
+			int nConnFd = accept4 (m_nListenFd, NULL, NULL, SOCK_CLOEXEC);
+			if (nConnFd < 0)
+				continue;
+			if (m_Sessions.size () >= MAX_SESSIONS)
+			{
+				close (nConnFd);
+				continue;
+			}
+
+			CNamedPipe* pSession = new CNamedPipe (m_nNextId++, nConnFd);
+			m_Sessions.push_back (pSession);
+
+			struct epoll_event ev;
+			memset (&ev, 0, sizeof (ev));
+			ev.events = EPOLLIN;
+			ev.data.fd = nConnFd;
+			epoll_ctl (m_nEpollFd, EPOLL_CTL_ADD, nConnFd, &ev);
+			continue;
+		}
+
+		for (size_t j = 0; j < m_Sessions.size (); j++)
+		{
+			CNamedPipe* pSession = m_Sessions[j];
+			if (pSession->GetFd () != fd)
+				continue;
+			if (events[i].events & EPOLLOUT)
+				pSession->onWritable ();
+			if (events[i].events & (EPOLLIN | EPOLLHUP | EPOLLERR))
+				pSession->onReadable ();
+			keepSession (pSession);
+			break;
+		}
+	}
+	return true;
+}
+
+//------------------------------------------------------------------------
+void CPipeServer::closeServer ()
+{
+	for (size_t i = 0; i < m_Sessions.size (); i++)
+		delete m_Sessions[i];
+	m_Sessions.clear ();
+
+	if (m_nListenFd >= 0)
+	{
+		close (m_nListenFd);
+		unlink (GetRealPipeName (true).c_str ());
+	}
+	m_nListenFd = -1;
+
+	if (m_nEpollFd >= 0)
+		close (m_nEpollFd);
+	m_nEpollFd = -1;
+}
+#endif
@@ -0,0 +1,144 @@
+//------------------------------------------------------------------------
+//
+// Project     : BaseHeadSKI
+// Filename    : PipeServer.h
+// Description : Accepts any number of BaseHead client sessions on the
+//				 command pipe and hands their commands out one at a time
+//
+//------------------------------------------------------------------------
+#if !defined(PIPESERVER_H)
+#define PIPESERVER_H
+
+#if _MSC_VER > 1000
+#pragma once
+#endif // _MSC_VER > 1000
+
+#include "NamedPipe.h"
+
+#include <mutex>
+
+// handled by the server itself, replies "ok\t<in ring>\t<out ring>"
+#define PIPE_OPEN_RING_COMMAND "open ring"
+// handled by the server itself, allows binary frames (PipeCodec.h) on
+// this session; replies "ok\t<binary version>"
+#define PIPE_HELLO_BINARY_COMMAND "hello binary"
+// handled by the server itself, the session gets the SKI_* notifications
+// pushed as kPipeFrameEvent frames from now on; replies "ok"
+#define PIPE_SUBSCRIBE_COMMAND "subscribe notifications"
+
+//------------------------------------------------------------------------
+// On Windows every session owns one _IN and one _OUT pipe instance. A
+// fresh listening instance of each is kept armed, and an _OUT instance is
+// paired with the _IN session of the same client process. While one of a
+// process's sessions waits for its _OUT, further _IN instances of that
+// process are disconnected, and likewise for a waiting _OUT, since their
+// replies could end up with the wrong client thread. Elsewhere a
+// Unix domain socket is used and every accepted connection is a session.
+// All waiting happens in read (), which returns false once interrupt ()
+// was called; send () only queues.
+//------------------------------------------------------------------------
+class CPipeServer
+{
+public:
+	//--------------------------------------------------------------------
+	CPipeServer ();
+	virtual ~CPipeServer ();
+
+	bool initialize ();
+	void interrupt ();	// ends all current and future waits, used on shutdown
+
+	void   SetPipeName (string szName, string szHost = ".");
+	string GetPipeName () { return m_szFullPipeName; }
+	string GetRealPipeName (bool bIsServerInPipe);
+
+	// Blocks until any session has a complete command. Sessions with
+	// pending commands are served round-robin, one command per turn.
+	bool read (PipeRequest& request /*out*/);
+
+	// Replies to request on the session it came from. Must be called on
+	// the thread that calls read ().
+	bool send (const PipeRequest& request, string szMsg);
+
+	// Queues a reply from any thread. It is written by the thread blocked
+	// in read (), so replies may leave in a different order than their
+	// requests arrived; clients match them by the frame tag.
+	void postReply (const PipeRequest& request, const string& szMsg);
+
+	// Queues a notification for all subscribed sessions, from any thread.
+	// Never blocks; if the queue is full the oldest notification is lost,
+	// and a session that stopped reading is dropped (see CNamedPipe).
+	void postEvent (uint32_t nCode, const string& szMsg);
+
+	size_t countSessions () const { return m_Sessions.size (); }
+
+//------------------------------------------------------------------------
+private:
+	bool waitForEvents (uint32_t nTimeout);
+	uint32_t flushLegacy ();
+	bool nextRequest (PipeRequest& request /*out*/);
+	void flushReplies ();
+	void wake ();
+	void openRings (const PipeRequest& request);
+	void enableBinary (const PipeRequest& request);
+	void subscribe (const PipeRequest& request);
+	CNamedPipe* findSession (uint32_t nId);
+	bool keepSession (CNamedPipe* pSession);
+	void removeSession (CNamedPipe* pSession);
+	void closeServer ();
+
+	string m_szPipeName;
+	string m_szPipeHost;
+	string m_szFullPipeName;
+
+	vector<CNamedPipe*> m_Sessions;
+	size_t m_nNextSession;		// round-robin position for nextRequest ()
+	uint32_t m_nNextId;
+	bool m_bStopped;
+
+	struct PendingReply
+	{
+		PipeRequest request;
+		string szMsg;
+	};
+	struct PendingEvent
+	{
+		uint32_t nCode;
+		string szMsg;
+	};
+	std::mutex m_ReplyLock;
+	vector<PendingReply> m_Replies;	// filled by postReply (), guarded by m_ReplyLock
+	deque<PendingEvent> m_Events;	// filled by postEvent (), guarded by m_ReplyLock
+
+#if defined(_WIN32)
+	struct Listener
+	{
+		HANDLE hPipe;
+		HANDLE hEvent;
+		OVERLAPPED ov;
+		bool bConnected;	// client attached before the overlapped wait
+	};
+	struct UnpairedOut
+	{
+		HANDLE hPipe;
+		ULONG nClientPid;
+	};
+
+	bool listen (Listener& listener, bool bIn);
+	void onConnected (Listener& listener, bool bIn);
+	bool isPairingPending (HANDLE hPipe, bool bIn);
+	void pairOutPipes ();
+
+	Listener m_ListenIn;
+	Listener m_ListenOut;
+	vector<UnpairedOut> m_UnpairedOut;	// _OUT connected before its _IN
+	HANDLE m_hStopEvent;
+	HANDLE m_hWakeEvent;		// set by postReply ()
+#else
+	int m_nListenFd;
+	int m_nEpollFd;
+	int m_nStopFd;				// eventfd, set by interrupt ()
+	int m_nWakeFd;				// eventfd, set by postReply ()
+#endif
+};
+
+#endif // !defined(PIPESERVER_H)
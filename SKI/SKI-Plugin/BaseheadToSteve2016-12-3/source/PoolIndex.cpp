@@ -0,0 +1,155 @@
+//-----------------------------------------------------------------------------
+// Project      : BaseHeadSKI
+// Filename     : PoolIndex.cpp
+// Description  : Hashed index of the media in a project's media pool,
+//				  keyed by file path
+//-----------------------------------------------------------------------------
+
+#include "PoolIndex.h"
+#include "pluginterfaces/host/ski.h"
+#include "pluginterfaces/host/frame/ipath.h"
+#include "UtfConvert.h"
+
+
+//------------------------------------------------------------------------
+MediaPoolIndex::MediaPoolIndex ()
+: indexedPool (0)
+, indexedItems (-1)
+{
+}
+
+//------------------------------------------------------------------------
+MediaPoolIndex::~MediaPoolIndex ()
+{
+	clear ();
+}
+
+//------------------------------------------------------------------------
+void MediaPoolIndex::update (IMediaPool* pool)
+{
+	if (pool != indexedPool || pool->countMediaItems () != indexedItems)
+		rebuild (pool);
+}
+
+//------------------------------------------------------------------------
+void MediaPoolIndex::rebuild (IMediaPool* pool)
+{
+	clear ();
+	int32 itemCount = pool->countMediaItems ();
+	media.reserve (itemCount);
+
+	std::string pathString;
+	for (int32 i = 0; i < itemCount; i++)
+	{
+		IMedium* medium = pool->getMediumByIndex (i);
+		if (medium && getPathString (medium->getFilePath (), pathString))
+			insert (pathString, medium, i);
+	}
+	indexedPool = pool;
+	indexedItems = itemCount;
+}
+
+//------------------------------------------------------------------------
+IMedium* MediaPoolIndex::find (std::string_view path)
+{
+	std::string key = normalizePath (path);
+	auto it = media.find (key);
+	if (it == media.end ())
+	{
+		if (!indexedPool || isTailIndexed ())
+			return 0;
+	}
+	else if (isInPool (it->second))
+		return it->second.medium;
+	if (!indexedPool)
+		return 0;
+
+	// the pool changed behind the index, and what else changed is unknown
+	rebuild (indexedPool);
+	it = media.find (key);
+	return it != media.end () ? it->second.medium : 0;
+}
+
+//------------------------------------------------------------------------
+bool MediaPoolIndex::isInPool (const Entry& entry) const
+{
+	return indexedPool && entry.position < indexedItems
+		&& indexedPool->getMediumByIndex (entry.position) == entry.medium;
+}
+
+//------------------------------------------------------------------------
+// Whether the paths of the media at the end of the pool are indexed; one
+// the user added since the index was built would not be
+bool MediaPoolIndex::isTailIndexed () const
+{
+	std::string pathString;
+	int32 first = indexedItems > kConfirmItems ? indexedItems - kConfirmItems : 0;
+	for (int32 i = first; i < indexedItems; i++)
+	{
+		IMedium* medium = indexedPool->getMediumByIndex (i);
+		if (!medium || !getPathString (medium->getFilePath (), pathString))
+			continue;	// not indexed by rebuild () either
+
+		// a second medium of an indexed path counts as indexed, see insert ()
+		if (media.find (normalizePath (pathString)) == media.end ())
+			return false;
+	}
+	return true;
+}
+
+//------------------------------------------------------------------------
+void MediaPoolIndex::add (std::string_view path, IMedium* medium)
+{
+	// the pool appends new media; if it does not, find () rebuilds
+	insert (path, medium, indexedItems);
+	if (indexedItems >= 0)
+		indexedItems++;
+}
+
+//------------------------------------------------------------------------
+void MediaPoolIndex::clear ()
+{
+	for (auto it = media.begin (); it != media.end (); ++it)
+		it->second.medium->release ();
+	media.clear ();
+	indexedPool = 0;
+	indexedItems = -1;
+}
+
+//------------------------------------------------------------------------
+void MediaPoolIndex::insert (std::string_view path, IMedium* medium, int32 position)
+{
+	// the first medium of a path wins, like getMediumByPath
+	Entry entry = { medium, position };
+	if (media.emplace (normalizePath (path), entry).second)
+		medium->addRef ();
+}
+
+//------------------------------------------------------------------------
+std::string MediaPoolIndex::normalizePath (std::string_view path)
+{
+	std::string result (path);
+	for (size_t i = 0; i < result.length (); i++)
+	{
+		char c = result[i];
+		if (c >= 'A' && c <= 'Z')
+			result[i] = (char)(c + ('a' - 'A'));
+		else if (c == '/')
+			result[i] = '\\';
+	}
+	return result;
+}
+
+//------------------------------------------------------------------------
+bool MediaPoolIndex::getPathString (IPath* path, std::string& result /*out*/)
+{
+	result.clear ();
+	if (!path)
+		return false;
+
+	tchar buffer[kIPPathNameMax] = {0};
+	if (path->getFullPath (buffer) != kResultOk)
+		return false;
+	utf16ToUtf8 ((const char16_t*)buffer, result);
+	return !result.empty ();
+}
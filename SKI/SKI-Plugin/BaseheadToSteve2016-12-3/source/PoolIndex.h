@@ -0,0 +1,85 @@
+//-----------------------------------------------------------------------------
+// Project      : BaseHeadSKI
+// Filename     : PoolIndex.h
+// Description  : Hashed index of the media in a project's media pool,
+//				  keyed by file path
+//-----------------------------------------------------------------------------
+
+#ifndef __poolindex__
+#define __poolindex__
+
+#include "pluginterfaces/base/ftypes.h"
+
+#include <string>
+#include <string_view>
+#include <unordered_map>
+
+namespace Steinberg {
+class IMediaPool;
+class IMedium;
+class IPath;
+}
+using namespace Steinberg;
+
+
+//------------------------------------------------------------------------
+// Keys are UTF-8 paths with ASCII letters folded to lower case and '/'
+// turned into '\', so lookups match the case insensitive compare the
+// pool scan used to do. The index is built from the pool on first use
+// and rebuilt when the pool's item count no longer matches what was
+// indexed (media added or removed by the user); media added through
+// add () keep it current without a rebuild. Every entry remembers its
+// pool position, and find () only returns a medium that is still found
+// there; otherwise the user removed and added media without changing
+// the count, and the index is rebuilt. The pool has no modification
+// stamp, so a path that is not indexed is confirmed against the last
+// kConfirmItems pool positions, where media the user added end up; if
+// the path of any of them is not indexed, the index is rebuilt. That keeps
+// lookups of new files cheap and stops them adding a duplicate. Indexed
+// media are referenced until the index is cleared, so a stale entry is
+// never dangling.
+//------------------------------------------------------------------------
+class MediaPoolIndex
+{
+public:
+	MediaPoolIndex ();
+	~MediaPoolIndex ();
+
+	// Rebuilds the index if it does not cover the pool's media any more
+	void update (IMediaPool* pool);
+
+	// Pool medium with the given path, 0 if there is none
+	IMedium* find (std::string_view path);
+	bool contains (std::string_view path) { return find (path) != 0; }
+
+	// Call after medium was added to the pool successfully
+	void add (std::string_view path, IMedium* medium);
+
+	void clear ();
+
+	static std::string normalizePath (std::string_view path);
+	static bool getPathString (IPath* path, std::string& result /*out*/);
+
+protected:
+	MediaPoolIndex (const MediaPoolIndex&) = delete;
+	MediaPoolIndex& operator= (const MediaPoolIndex&) = delete;
+
+	struct Entry
+	{
+		IMedium* medium;
+		int32 position;		// in the pool when it was indexed
+	};
+
+	enum { kConfirmItems = 16 };
+
+	void rebuild (IMediaPool* pool);
+	void insert (std::string_view path, IMedium* medium, int32 position);
+	bool isInPool (const Entry& entry) const;
+	bool isTailIndexed () const;
+
+	std::unordered_map<std::string, Entry> media;
+	IMediaPool* indexedPool;	// owned by the project, which outlives the index
+	int32 indexedItems;		// pool item count the index corresponds to, -1 if not built
+};
+
+#endif
@@ -0,0 +1,291 @@
+//------------------------------------------------------------------------
+//
+// Project     : BaseHeadSKI
+// Filename    : SharedRing.cpp
+// Description : Single-producer/single-consumer ring buffer in a named
+//				 shared memory segment, for payloads too big for the pipe
+//
+//------------------------------------------------------------------------
+#include "SharedRing.h"
+
+#include <string.h>
+
+#if !defined(_WIN32)
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
+
+#define RING_DATA_OFFSET  ((sizeof (SharedRingHeader) + 63) & ~(size_t)63)
+
+//------------------------------------------------------------------------
+CSharedRing::CSharedRing ()
+: m_pHeader (NULL)
+, m_pData (NULL)
+, m_nCapacity (0)
+, m_nMappedSize (0)
+, m_bOwner (false)
+{
+#if defined(_WIN32)
+	m_hMapping = NULL;
+#endif
+}
+
+//------------------------------------------------------------------------
+CSharedRing::~CSharedRing ()
+{
+	close ();
+}
+
+//------------------------------------------------------------------------
+bool CSharedRing::create (string szName, uint64_t nCapacity)
+{
+	close ();
+
+	uint64_t nPow2 = 4096;
+	while (nPow2 < nCapacity)
+		nPow2 <<= 1;
+
+	m_szName = szName;
+	m_bOwner = true;
+	if (!map (true, nPow2))
+		return false;
+
+	m_nCapacity = nPow2;
+	m_pHeader->capacity = nPow2;
+	m_pHeader->head.store (0, memory_order_relaxed);
+	m_pHeader->tail.store (0, memory_order_relaxed);
+	m_pHeader->version = kSharedRingVersion;
+	// publish the magic last, the other side checks it in open ()
+	atomic_thread_fence (memory_order_release);
+	m_pHeader->magic = kSharedRingMagic;
+	return true;
+}
+
+//------------------------------------------------------------------------
+bool CSharedRing::open (string szName)
+{
+	close ();
+
+	m_szName = szName;
+	m_bOwner = false;
+	if (!map (false, 0))
+		return false;
+
+	if (m_pHeader->magic != kSharedRingMagic || m_pHeader->version != kSharedRingVersion)
+	{
+		close ();
+		return false;
+	}
+	return true;
+}
+
+#if defined(_WIN32)
+//------------------------------------------------------------------------
+bool CSharedRing::map (bool bCreate, uint64_t nCapacity)
+{
+	string szMapping = "Local\\" + m_szName;
+	if (bCreate)
+	{
+		uint64_t nSize = RING_DATA_OFFSET + nCapacity;
+		m_hMapping = CreateFileMappingA (INVALID_HANDLE_VALUE, NULL, PAGE_READWRITE,
+			(DWORD)(nSize >> 32), (DWORD)(nSize & 0xFFFFFFFF), szMapping.c_str ());
+	}
+	else
+		m_hMapping = OpenFileMappingA (FILE_MAP_ALL_ACCESS, FALSE, szMapping.c_str ());
+	if (m_hMapping == NULL)
+		return false;
+
+	// the size of an opened segment is only known after mapping its header
+	void* pView = MapViewOfFile (m_hMapping, FILE_MAP_ALL_ACCESS, 0, 0, 0);
+	if (pView == NULL)
+	{
+		close ();
+		return false;
+	}
+
+	MEMORY_BASIC_INFORMATION info;
+	VirtualQuery (pView, &info, sizeof (info));
+	m_nMappedSize = info.RegionSize;
+	m_pHeader = (SharedRingHeader*)pView;
+	m_pData = (char*)pView + RING_DATA_OFFSET;
+
+	if (!bCreate && !checkCapacity ())
+	{
+		close ();
+		return false;
+	}
+	return true;
+}
+
+//------------------------------------------------------------------------
+void CSharedRing::close ()
+{
+	if (m_pHeader)
+		UnmapViewOfFile (m_pHeader);
+	m_pHeader = NULL;
+	m_pData = NULL;
+	m_nCapacity = 0;
+	m_nMappedSize = 0;
+
+	if (m_hMapping)
+		CloseHandle (m_hMapping);
+	m_hMapping = NULL;
+}
+
+#else
+//------------------------------------------------------------------------
+bool CSharedRing::map (bool bCreate, uint64_t nCapacity)
+{
+	string szShm = "/" + m_szName;
+	int fd = shm_open (szShm.c_str (), bCreate ? (O_CREAT | O_EXCL | O_RDWR) : O_RDWR, 0600);
+	if (fd < 0 && bCreate)
+	{
+		// left behind by a crashed instance
+		shm_unlink (szShm.c_str ());
+		fd = shm_open (szShm.c_str (), O_CREAT | O_EXCL | O_RDWR, 0600);
+	}
+	if (fd < 0)
+		return false;
+
+	size_t nSize = RING_DATA_OFFSET + nCapacity;
+	if (bCreate)
+	{
+		if (ftruncate (fd, nSize) != 0)
+		{
+			::close (fd);
+			shm_unlink (szShm.c_str ());
+			return false;
+		}
+	}
+	else
+	{
+		struct stat st;
+		if (fstat (fd, &st) != 0 || (size_t)st.st_size < RING_DATA_OFFSET)
+		{
+			::close (fd);
+			return false;
+		}
+		nSize = st.st_size;
+	}
+
+	void* pView = mmap (NULL, nSize, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	::close (fd);
+	if (pView == MAP_FAILED)
+	{
+		if (bCreate)
+			shm_unlink (szShm.c_str ());
+		return false;
+	}
+
+	m_nMappedSize = nSize;
+	m_pHeader = (SharedRingHeader*)pView;
+	m_pData = (char*)pView + RING_DATA_OFFSET;
+
+	if (!bCreate && !checkCapacity ())
+	{
+		close ();
+		return false;
+	}
+	return true;
+}
+
+//------------------------------------------------------------------------
+void CSharedRing::close ()
+{
+	if (m_pHeader)
+	{
+		munmap (m_pHeader, m_nMappedSize);
+		if (m_bOwner)
+			shm_unlink (("/" + m_szName).c_str ());
+	}
+	m_pHeader = NULL;
+	m_pData = NULL;
+	m_nCapacity = 0;
+	m_nMappedSize = 0;
+}
+#endif
+
+//------------------------------------------------------------------------
+// Takes over the capacity of an opened segment if it is a power of two
+// that fits the mapping.
+bool CSharedRing::checkCapacity ()
+{
+	uint64_t nCapacity = m_pHeader->capacity;
+	if (nCapacity < sizeof (uint32_t) || (nCapacity & (nCapacity - 1)) != 0
+		|| nCapacity > m_nMappedSize - RING_DATA_OFFSET)
+		return false;
+	m_nCapacity = nCapacity;
+	return true;
+}
+
+//------------------------------------------------------------------------
+void CSharedRing::copyIn (uint64_t nPos, const void* pData, uint64_t nBytes)
+{
+	uint64_t nMask = m_nCapacity - 1;
+	uint64_t nStart = nPos & nMask;
+	uint64_t nFirst = m_nCapacity - nStart;
+	if (nFirst > nBytes)
+		nFirst = nBytes;
+
+	memcpy (m_pData + nStart, pData, (size_t)nFirst);
+	if (nFirst < nBytes)
+		memcpy (m_pData, (const char*)pData + nFirst, (size_t)(nBytes - nFirst));
+}
+
+//------------------------------------------------------------------------
+void CSharedRing::copyOut (uint64_t nPos, void* pData, uint64_t nBytes) const
+{
+	uint64_t nMask = m_nCapacity - 1;
+	uint64_t nStart = nPos & nMask;
+	uint64_t nFirst = m_nCapacity - nStart;
+	if (nFirst > nBytes)
+		nFirst = nBytes;
+
+	memcpy (pData, m_pData + nStart, (size_t)nFirst);
+	if (nFirst < nBytes)
+		memcpy ((char*)pData + nFirst, m_pData, (size_t)(nBytes - nFirst));
+}
+
+//------------------------------------------------------------------------
+bool CSharedRing::write (const void* pData, uint32_t nBytes)
+{
+	if (!m_pHeader)
+		return false;
+
+	uint64_t nHead = m_pHeader->head.load (memory_order_relaxed);
+	uint64_t nTail = m_pHeader->tail.load (memory_order_acquire);
+	uint64_t nNeeded = sizeof (uint32_t) + (uint64_t)nBytes;
+	if (nHead - nTail > m_nCapacity || m_nCapacity - (nHead - nTail) < nNeeded)
+		return false;
+
+	copyIn (nHead, &nBytes, sizeof (nBytes));
+	copyIn (nHead + sizeof (nBytes), pData, nBytes);
+	m_pHeader->head.store (nHead + nNeeded, memory_order_release);
+	return true;
+}
+
+//------------------------------------------------------------------------
+bool CSharedRing::read (string& szOut /*out*/, uint32_t nMaxBytes)
+{
+	if (!m_pHeader)
+		return false;
+
+	uint64_t nTail = m_pHeader->tail.load (memory_order_relaxed);
+	uint64_t nHead = m_pHeader->head.load (memory_order_acquire);
+	uint64_t nWaiting = nHead - nTail;
+	if (nWaiting < sizeof (uint32_t) || nWaiting > m_nCapacity)
+		return false;
+
+	uint32_t nBytes = 0;
+	copyOut (nTail, &nBytes, sizeof (nBytes));
+	if (nBytes > nMaxBytes || nWaiting < sizeof (nBytes) + (uint64_t)nBytes)
+		return false;
+
+	szOut.resize (nBytes);
+	if (nBytes > 0)
+		copyOut (nTail + sizeof (nBytes), &szOut[0], nBytes);
+	m_pHeader->tail.store (nTail + sizeof (nBytes) + nBytes, memory_order_release);
+	return true;
+}
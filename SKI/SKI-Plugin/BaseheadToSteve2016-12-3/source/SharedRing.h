@@ -0,0 +1,92 @@
+//------------------------------------------------------------------------
+//
+// Project     : BaseHeadSKI
+// Filename    : SharedRing.h
+// Description : Single-producer/single-consumer ring buffer in a named
+//				 shared memory segment, for payloads too big for the pipe
+//
+//------------------------------------------------------------------------
+#if !defined(SHAREDRING_H)
+#define SHAREDRING_H
+
+#if _MSC_VER > 1000
+#pragma once
+#endif // _MSC_VER > 1000
+
+#include <atomic>
+#include <string>
+#include <stdint.h>
+#if defined(_WIN32)
+#include <Windows.h>
+#endif
+using namespace std;
+
+
+//------------------------------------------------------------------------
+// Segment layout: SharedRingHeader, then 'capacity' bytes of data. Each
+// record is a uint32 length followed by the payload and may wrap around
+// the end of the data area. head is only written by the producer, tail
+// only by the consumer, so no lock is needed. The other side can write
+// the whole segment, so only our own copy of the capacity is used and
+// head, tail and record lengths are checked before use. The ring itself never
+// signals anything; the pipe frame with kPipeFrameInRing set is the
+// doorbell telling the other side that a record is waiting.
+//------------------------------------------------------------------------
+#define kSharedRingMagic	0x42524842	/* "BHRB" */
+#define kSharedRingVersion	1
+
+struct SharedRingHeader
+{
+	uint32_t magic;
+	uint32_t version;
+	uint64_t capacity;					// power of two
+	alignas(64) atomic<uint64_t> head;	// bytes written, producer only
+	alignas(64) atomic<uint64_t> tail;	// bytes consumed, consumer only
+};
+
+static_assert (ATOMIC_LLONG_LOCK_FREE == 2, "shared ring needs lock-free 64 bit atomics");
+
+//------------------------------------------------------------------------
+class CSharedRing
+{
+public:
+	//--------------------------------------------------------------------
+	CSharedRing ();
+	virtual ~CSharedRing ();
+
+	// Creates and owns the segment; capacity is rounded up to a power of two.
+	bool create (string szName, uint64_t nCapacity);
+	// Maps a segment created by the other side.
+	bool open (string szName);
+	void close ();
+
+	bool isOpen () const { return m_pHeader != NULL; }
+	string GetName () const { return m_szName; }
+	uint64_t GetCapacity () const { return m_nCapacity; }
+
+	// Producer side: false if the record does not fit right now.
+	bool write (const void* pData, uint32_t nBytes);
+	// Consumer side: false if no record is waiting, or if head or the
+	// record length are corrupt or the record is longer than nMaxBytes.
+	bool read (string& szOut /*out*/, uint32_t nMaxBytes);
+
+//------------------------------------------------------------------------
+private:
+	bool map (bool bCreate, uint64_t nCapacity);
+	bool checkCapacity ();
+	void copyIn (uint64_t nPos, const void* pData, uint64_t nBytes);
+	void copyOut (uint64_t nPos, void* pData, uint64_t nBytes) const;
+
+	string m_szName;
+	SharedRingHeader* m_pHeader;
+	char* m_pData;
+	uint64_t m_nCapacity;		// read once, the segment's copy may change
+	size_t m_nMappedSize;
+	bool m_bOwner;
+
+#if defined(_WIN32)
+	HANDLE m_hMapping;
+#endif
+};
+
+#endif // !defined(SHAREDRING_H)
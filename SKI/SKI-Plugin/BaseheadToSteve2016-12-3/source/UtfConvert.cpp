@@ -0,0 +1,222 @@
+//------------------------------------------------------------------------
+//
+// Project     : BaseHeadSKI
+// Filename    : UtfConvert.cpp
+// Description : Conversion between UTF-16 (the host's paths and strings)
+//				 and UTF-8 (the pipe protocol)
+//
+//------------------------------------------------------------------------
+#include "UtfConvert.h"
+
+#include <stdint.h>
+#include <string.h>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define UTFCONVERT_SSE2 1
+#include <emmintrin.h>
+#endif
+
+#define kReplacementChar	0xFFFD
+
+//------------------------------------------------------------------------
+// Converts the ASCII units at the start of pText, at most nLength, and
+// returns how many were converted. Stops at the first block containing
+// anything else; the caller converts from there one code point at a time.
+//------------------------------------------------------------------------
+static size_t narrowAscii (const char16_t* pText, size_t nLength, char* pOut)
+{
+	size_t i = 0;
+#if UTFCONVERT_SSE2
+	const __m128i nonAscii = _mm_set1_epi16 ((short)0xFF80);
+	const __m128i zero = _mm_setzero_si128 ();
+	for (; nLength - i >= 8; i += 8)
+	{
+		__m128i v = _mm_loadu_si128 ((const __m128i*)(pText + i));
+		if (_mm_movemask_epi8 (_mm_cmpeq_epi16 (_mm_and_si128 (v, nonAscii), zero)) != 0xFFFF)
+			break;
+		_mm_storel_epi64 ((__m128i*)(pOut + i), _mm_packus_epi16 (v, v));
+	}
+#else
+	for (; nLength - i >= 4; i += 4)
+	{
+		uint64_t nWord;
+		memcpy (&nWord, pText + i, sizeof (nWord));
+		if (nWord & 0xFF80FF80FF80FF80ull)
+			break;
+		for (size_t j = 0; j < 4; j++)
+			pOut[i + j] = (char)pText[i + j];
+	}
+#endif
+	return i;
+}
+
+//------------------------------------------------------------------------
+static size_t widenAscii (const char* pText, size_t nLength, char16_t* pOut)
+{
+	size_t i = 0;
+#if UTFCONVERT_SSE2
+	const __m128i zero = _mm_setzero_si128 ();
+	for (; nLength - i >= 16; i += 16)
+	{
+		__m128i v = _mm_loadu_si128 ((const __m128i*)(pText + i));
+		if (_mm_movemask_epi8 (v) != 0)
+			break;
+		_mm_storeu_si128 ((__m128i*)(pOut + i), _mm_unpacklo_epi8 (v, zero));
+		_mm_storeu_si128 ((__m128i*)(pOut + i + 8), _mm_unpackhi_epi8 (v, zero));
+	}
+#else
+	for (; nLength - i >= 8; i += 8)
+	{
+		uint64_t nWord;
+		memcpy (&nWord, pText + i, sizeof (nWord));
+		if (nWord & 0x8080808080808080ull)
+			break;
+		for (size_t j = 0; j < 8; j++)
+			pOut[i + j] = (char16_t)pText[i + j];
+	}
+#endif
+	return i;
+}
+
+//------------------------------------------------------------------------
+bool utf16ToUtf8 (const char16_t* pText, size_t nLength, std::string& szOut /*out*/)
+{
+	// at most three bytes per unit, a surrogate pair takes four for two
+	szOut.resize (nLength * 3);
+	char* pStart = nLength ? &szOut[0] : 0;
+	char* p = pStart;
+	bool bValid = true;
+
+	size_t i = 0;
+	while (i < nLength)
+	{
+		uint32_t c = pText[i];
+		if (c < 0x80)
+		{
+			size_t nAscii = narrowAscii (pText + i, nLength - i, p);
+			if (nAscii == 0)
+			{
+				*p = (char)c;
+				nAscii = 1;
+			}
+			p += nAscii;
+			i += nAscii;
+			continue;
+		}
+
+		i++;
+		if (c >= 0xD800 && c < 0xE000)
+		{
+			uint32_t c2 = (i < nLength) ? pText[i] : 0;
+			if (c < 0xDC00 && c2 >= 0xDC00 && c2 < 0xE000)
+			{
+				c = 0x10000 + ((c - 0xD800) << 10) + (c2 - 0xDC00);
+				i++;
+			}
+			else
+			{
+				c = kReplacementChar;
+				bValid = false;
+			}
+		}
+
+		if (c < 0x800)
+		{
+			*p++ = (char)(0xC0 | (c >> 6));
+			*p++ = (char)(0x80 | (c & 0x3F));
+		}
+		else if (c < 0x10000)
+		{
+			*p++ = (char)(0xE0 | (c >> 12));
+			*p++ = (char)(0x80 | ((c >> 6) & 0x3F));
+			*p++ = (char)(0x80 | (c & 0x3F));
+		}
+		else
+		{
+			*p++ = (char)(0xF0 | (c >> 18));
+			*p++ = (char)(0x80 | ((c >> 12) & 0x3F));
+			*p++ = (char)(0x80 | ((c >> 6) & 0x3F));
+			*p++ = (char)(0x80 | (c & 0x3F));
+		}
+	}
+
+	szOut.resize (p - pStart);
+	return bValid;
+}
+
+//------------------------------------------------------------------------
+bool utf8ToUtf16 (const char* pText, size_t nLength, std::u16string& szOut /*out*/)
+{
+	// never more units than bytes
+	szOut.resize (nLength);
+	char16_t* pStart = nLength ? &szOut[0] : 0;
+	char16_t* p = pStart;
+	bool bValid = true;
+
+	const unsigned char* s = (const unsigned char*)pText;
+	size_t i = 0;
+	while (i < nLength)
+	{
+		uint32_t c = s[i];
+		if (c < 0x80)
+		{
+			size_t nAscii = widenAscii (pText + i, nLength - i, p);
+			if (nAscii == 0)
+			{
+				*p = (char16_t)c;
+				nAscii = 1;
+			}
+			p += nAscii;
+			i += nAscii;
+			continue;
+		}
+
+		size_t nMore = 0;
+		uint32_t nMin = 0;
+		if (c >= 0xC2 && c < 0xE0)
+		{
+			c &= 0x1F;
+			nMore = 1;
+			nMin = 0x80;
+		}
+		else if (c >= 0xE0 && c < 0xF0)
+		{
+			c &= 0x0F;
+			nMore = 2;
+			nMin = 0x800;
+		}
+		else if (c >= 0xF0 && c < 0xF5)
+		{
+			c &= 0x07;
+			nMore = 3;
+			nMin = 0x10000;
+		}
+
+		// a bad sequence is replaced up to the first byte that breaks it
+		i++;
+		size_t nRead = 0;
+		while (nRead < nMore && i < nLength && (s[i] & 0xC0) == 0x80)
+		{
+			c = (c << 6) | (s[i++] & 0x3F);
+			nRead++;
+		}
+		if (nMore == 0 || nRead < nMore || c < nMin || c > 0x10FFFF || (c >= 0xD800 && c < 0xE000))
+		{
+			*p++ = (char16_t)kReplacementChar;
+			bValid = false;
+			continue;
+		}
+
+		if (c >= 0x10000)
+		{
+			c -= 0x10000;
+			*p++ = (char16_t)(0xD800 + (c >> 10));
+			*p++ = (char16_t)(0xDC00 + (c & 0x3FF));
+		}
+		else
+			*p++ = (char16_t)c;
+	}
+
+	szOut.resize (p - pStart);
+	return bValid;
+}
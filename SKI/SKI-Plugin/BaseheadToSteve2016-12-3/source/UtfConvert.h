@@ -0,0 +1,58 @@
+//------------------------------------------------------------------------
+//
+// Project     : BaseHeadSKI
+// Filename    : UtfConvert.h
+// Description : Conversion between UTF-16 (the host's paths and strings)
+//				 and UTF-8 (the pipe protocol)
+//
+//------------------------------------------------------------------------
+#if !defined(UTFCONVERT_H)
+#define UTFCONVERT_H
+
+#if _MSC_VER > 1000
+#pragma once
+#endif // _MSC_VER > 1000
+
+#include <string>
+#include <string_view>
+#include <stddef.h>
+
+
+//------------------------------------------------------------------------
+// Both directions replace the result, handle any length and return false
+// if the input was malformed: unpaired surrogates in UTF-16; overlong,
+// truncated or out of range sequences in UTF-8. Every malformed sequence
+// is replaced by U+FFFD, so the result is usable either way. Runs of
+// ASCII are converted several characters at a time.
+//------------------------------------------------------------------------
+bool utf16ToUtf8 (const char16_t* pText, size_t nLength, std::string& szOut /*out*/);
+bool utf8ToUtf16 (const char* pText, size_t nLength, std::u16string& szOut /*out*/);
+
+//------------------------------------------------------------------------
+inline bool utf16ToUtf8 (std::u16string_view szText, std::string& szOut /*out*/)
+{
+	return utf16ToUtf8 (szText.data (), szText.size (), szOut);
+}
+
+inline bool utf8ToUtf16 (std::string_view szText, std::u16string& szOut /*out*/)
+{
+	return utf8ToUtf16 (szText.data (), szText.size (), szOut);
+}
+
+//------------------------------------------------------------------------
+// for terminated strings and where malformed input needs no reporting
+inline std::string toUtf8 (std::u16string_view szText)
+{
+	std::string szOut;
+	utf16ToUtf8 (szText, szOut);
+	return szOut;
+}
+
+inline std::u16string toUtf16 (std::string_view szText)
+{
+	std::u16string szOut;
+	utf8ToUtf16 (szText, szOut);
+	return szOut;
+}
+
+#endif // !defined(UTFCONVERT_H)
@@ -13,8 +13,12 @@
 #include "pluginterfaces/host/ihostclasses.h"
 
 #include "skicomponent.h"
+#include "PipeCodec.h"
+#include "CommandTable.h"
 #include "LogFile.h"
 
+#include <string.h>
+
 //-----------------------------------------------------------------------
 template <class T>
 inline void SafeDelete(T *& ptr)
@@ -27,19 +31,82 @@ inline void SafeDelete(T *& ptr)
 }
 ///@} 
 
+// notifications waiting to be sent, older ones are dropped
+#define MAX_PENDING_NOTIFICATIONS	64
+// a busy BaseHead must not stall the notifications behind this one
+#define NOTIFY_WINDOW_TIMEOUT		500
+// notifications arriving this close together are sent as one batch
+#define NOTIFY_COALESCE_TIME		20
+
+// cheap commands that never edit the project take the query lane, see
+// PIPE_QUERY_LANE
+static constexpr const char* kQueryCommandNames[] =
+{
+	"project path",
+	"cursor position",
+	"pool contains",
+	"job status",
+	"job cancel"
+};
+static constexpr CommandTable<sizeof (kQueryCommandNames) / sizeof (kQueryCommandNames[0])> kQueryCommands (kQueryCommandNames);
+static_assert (kQueryCommands.isValid (), "no perfect hash for kQueryCommandNames");
+
+// commands whose file arguments are probed before they are queued; the
+// main thread then only spends time on files that will likely make it
+static bool isProbingCommand (std::string_view name)
+{
+	return equalsCommandName (name, "xfertopool file") || equalsCommandName (name, "xfertopool job");
+}
+
+//------------------------------------------------------------------------
+// The file arguments of a command, exactly as its handler will see them
+static void getPathArguments (const PipeRequest& request, const char* cmd, std::vector<string>& paths)
+{
+	std::vector<string> fieldTokens;
+	strutil::TokenArray<1024> tokens;
+	if (request.binary)
+	{
+		if (!SKIComponent::fieldsToTokens (request, fieldTokens, tokens))
+			return;
+	}
+	else
+		strutil::split (std::string_view (cmd), "\t", tokens);
+
+	for (uint32 i = 1; i < tokens.size (); i++)
+		paths.push_back (string (tokens[i]));
+}
+
+//------------------------------------------------------------------------
+template <class T>
+inline void updateMax (std::atomic<T>& maximum, T value)
+{
+	T current = maximum;
+	while (value > current && !maximum.compare_exchange_weak (current, value))
+		;
+}
+
+//------------------------------------------------------------------------
+template <class TimePoint>
+inline uint64 microsecondsSince (TimePoint start)
+{
+	return (uint64)std::chrono::duration_cast<std::chrono::microseconds> (std::chrono::steady_clock::now () - start).count ();
+}
+
 //------------------------------------------------------------------------
 struct ReturnMessage
 {
 public:
 //------------------------------------------------------------------------
-	ReturnMessage () : code (-1) {}
-	ReturnMessage (int code, const char* out)
+	ReturnMessage () : code (-1), toWindow (false) {}
+	ReturnMessage (int code, const char* out, bool toWindow)
 	: code (code)
+	, toWindow (toWindow)
 	{
 		outString = out;
 	}
 	ReturnMessage (const ReturnMessage& other)
 	: code (other.code)
+	, toWindow (other.toWindow)
 	{
 		outString = other.outString;
 	}
@@ -47,33 +114,44 @@ public:
 	{
 		return false;
 	}
+	bool isSameAs (const ReturnMessage& other) const
+	{
+		return code == other.code && toWindow == other.toWindow
+			&& strcmp (outString.text8 (), other.outString.text8 ()) == 0;
+	}
 
-	void sendMessage ()
+#if WINDOWS
+	// window is cached by the caller and only searched again once the
+	// BaseHead window it refers to is gone
+	void sendMessage (HWND& window)
 	{
 		if (isEmpty ())
 			return;
-		String windowCaption ("BaseHead");
-
-#if WINDOWS
 
-		// The FindWindow function retrieves the handle to the top-level window
-		// whose class name and/or window name match the specified strings.
-		// This function does not search child windows.
-		//
-		HWND lResult = FindWindowA (NULL, windowCaption.text8 ());
-		if (lResult)
+		if (window == NULL || !IsWindow (window))
 		{
-			static COPYDATASTRUCT cds;			// declare a variable with type copy-data-struct" (windows API)
+			// The FindWindow function retrieves the handle to the top-level window
+			// whose class name and/or window name match the specified strings.
+			// This function does not search child windows.
+			//
+			window = FindWindowA (NULL, "BaseHead");
+		}
+		if (window)
+		{
+			COPYDATASTRUCT cds;			// declare a variable with type copy-data-struct" (windows API)
 			cds.dwData = code;			// acknowledge code
 			cds.cbData = strlen (outString.text8 ());	// count of bytes in data block
 			cds.lpData = (void*) outString.text8 ();			// pointer to data block
 
-			SendMessage (lResult, WM_COPYDATA , -1, (LPARAM)&cds);
+			// WM_COPYDATA cannot be posted; the timeout keeps a hung
+			// BaseHead from blocking this thread
+			DWORD_PTR result = 0;
+			SendMessageTimeout (window, WM_COPYDATA, (WPARAM)-1, (LPARAM)&cds, SMTO_ABORTIFHUNG, NOTIFY_WINDOW_TIMEOUT, &result);
 		}
+	}
 #elif MAC
 	#error	// Not implemented
 #endif
-	}
 
 	bool isEmpty ()
 	{
@@ -82,16 +160,21 @@ public:
 	
 	int32 code;
 	String outString;
+	bool toWindow;		// also send to the BaseHead window, not only the pipe
 };
 
+//------------------------------------------------------------------------
+// Sleeps until addMessage () signals, gives a burst of notifications
+// NOTIFY_COALESCE_TIME to arrive, then sends the whole queue at once with
+// repeated notifications merged.
 //------------------------------------------------------------------------
 class MessageSendThread : public FThread
 {
 public :
 //------------------------------------------------------------------------
-	static MessageSendThread* create () 
+	static MessageSendThread* create (CPipeServer* pipe) 
 	{
-		MessageSendThread* thread = NEW MessageSendThread;
+		MessageSendThread* thread = NEW MessageSendThread (pipe);
 		thread->setPriority (kLowPriority);
 		thread->run ();
 		return thread;
@@ -99,8 +182,13 @@ public :
 
 	void addMessage (ReturnMessage message)
 	{
-		
+		messageQueueLock.lock ();
+		if (messageQueue.total () >= MAX_PENDING_NOTIFICATIONS)
+			messageQueue.dequeue ();
 		messageQueue.enqueue (message);
+		messageQueueLock.unlock ();
+
+		waitTimer.signal ();
 	}
 	virtual void end () 
 	{
@@ -112,6 +200,7 @@ public :
 		messageQueueLock.unlock ();
 
 		waitTimer.signalAll ();
+		shutDownTimer.signalAll ();
 
 		if (isRunning () && waitDead (1000) == false)
 		{
@@ -124,52 +213,99 @@ public :
 	uint32 entry ()
 	{
 		running = true;
+		std::vector<ReturnMessage> batch;
 		while (true)
 		{
 			if (shutDown)
 				break;
 
-			ReturnMessage currentMessage;
-			getNextMessage (currentMessage);
-			currentMessage.sendMessage ();
+			// the timeout only guards against a lost signal
+			if (isQueueEmpty ())
+				waitTimer.waitTimeout (1000);
+			if (shutDown)
+				break;
+			if (isQueueEmpty ())
+				continue;
+
+			shutDownTimer.waitTimeout (NOTIFY_COALESCE_TIME);
 
-			setNextWaitTime ();
-			waitTimer.waitTimeout (nextWaitTime);
+			batch.clear ();
+			takeAllMessages (batch);
+			coalesce (batch);
 
+			for (uint32 i = 0; i < batch.size () && !shutDown; i++)
+				sendMessage (batch[i]);
 		}
 		running = false;
 		return 0;
 	}
 
-	void getNextMessage (ReturnMessage& currentMessage ) 
+private:
+	MessageSendThread (CPipeServer* pipe) : FThread ("BaseHeadMessageSendThread"), shutDown (false), pipe (pipe)
+	{
+#if WINDOWS
+		window = NULL;
+#endif
+	}
+	virtual ~MessageSendThread () {}
+
+	bool isQueueEmpty ()
 	{
 		messageQueueLock.lock ();
-		if (!messageQueue.isEmpty ())
-			currentMessage = messageQueue.dequeue ();			
+		bool empty = messageQueue.isEmpty ();
 		messageQueueLock.unlock ();
+		return empty;
 	}
 
-	void setNextWaitTime() 
+	void takeAllMessages (std::vector<ReturnMessage>& batch)
 	{
 		messageQueueLock.lock ();
-		if (messageQueue.isEmpty () && !shutDown)
-			nextWaitTime = 100;
-		else
-			nextWaitTime = 1;
+		while (!messageQueue.isEmpty ())
+			batch.push_back (messageQueue.dequeue ());
 		messageQueueLock.unlock ();
 	}
 
-private:
-	MessageSendThread () : FThread ("BaseHeadMessageSendThread"), nextWaitTime (1), shutDown (false) {}
-	virtual ~MessageSendThread () {}
+	// A notification repeated later in the same batch (same code, target
+	// and text) is only sent at its last position. This merges the
+	// SKI_PRJ_ACTIVATED path that beforeProjectActivation, projectActivated
+	// and beforeProjectSaved each send; SKI_PRJ_ADDED has its own code and
+	// is always kept.
+	static void coalesce (std::vector<ReturnMessage>& batch)
+	{
+		std::vector<ReturnMessage> kept;
+		for (int32 i = (int32)batch.size () - 1; i >= 0; i--)
+		{
+			bool repeated = false;
+			for (uint32 j = 0; j < kept.size () && !repeated; j++)
+				repeated = batch[i].isSameAs (kept[j]);
+			if (!repeated)
+				kept.push_back (batch[i]);
+		}
+		batch.assign (kept.rbegin (), kept.rend ());
+	}
+
+	void sendMessage (ReturnMessage& message)
+	{
+		if (pipe)
+			pipe->postEvent (message.code, message.outString.text8 ());
+#if WINDOWS
+		if (message.toWindow)
+			message.sendMessage (window);
+#endif
+	}
 
 	volatile bool shutDown;
 
 	TQueue<ReturnMessage> messageQueue;
 	FLock messageQueueLock;
 
-	FCondition waitTimer;
-	int32 nextWaitTime;
+	FCondition waitTimer;		// signaled by addMessage ()
+	FCondition shutDownTimer;	// only signaled by end ()
+
+	CPipeServer* pipe;			// owned by the receive thread, for subscribed sessions
+#if WINDOWS
+	HWND window;		// BaseHead main window, see ReturnMessage::sendMessage ()
+#endif
 };
 
 //------------------------------------------------------------------------
@@ -186,7 +322,7 @@ public:
 		return thread;
 	}
 
-	CNamedPipe* getPipe ()
+	CPipeServer* getPipe ()
 	{
 		return pipe;
 	}
@@ -196,6 +332,8 @@ public:
 		shutDown = true;
 
 		waitTimer.signalAll ();
+		if (pipe)
+			pipe->interrupt ();
 
 		if (isRunning () && waitDead (1000) == false)
 		{
@@ -213,23 +351,29 @@ public:
 			if (shutDown)
 				break;
 
-			waitTimer.waitTimeout (40);
-
 			if (!pipe)
+			{
+				waitTimer.waitTimeout (1000);
 				continue;
+			}
 
-			string szMsg;
-			bool result = pipe->read (szMsg);
+			// blocks until any session has a command or end () interrupts the pipe
+			PipeRequest request;
+			bool result = pipe->read (request);
 			if (!result)
+			{
+				if (!shutDown)
+					waitTimer.waitTimeout (1000);
 				continue;
+			}
 
-			if (szMsg == "QUIT")
+			if (request.payload == "QUIT")
 				break;
 
 			if (!PipeMessageHandler::instance ())
 				return 1;
 
-			PipeMessageHandler::instance ()->readMessage (szMsg.c_str ());		
+			PipeMessageHandler::instance ()->readMessage (request);		
 		}
 		running = false;
 		return 0;
@@ -243,13 +387,13 @@ private:
 	volatile bool shutDown;
 	FCondition waitTimer;
 
-	CNamedPipe* pipe;
+	CPipeServer* pipe;
 };
 
 //------------------------------------------------------------------------
 void MessageReceiveThread::initPipe ()
 {
-	pipe = NEW CNamedPipe ();
+	pipe = NEW CPipeServer ();
 	pipe->SetPipeName (PIPE_NAME, ".");
 	//m_Log->Write("Server pipe=%s", m_Pipe->GetRealPipeName(true).c_str());
 	//m_Log->Write("Client pipe=%s", m_Pipe->GetRealPipeName(false).c_str());
@@ -266,9 +410,15 @@ void MessageReceiveThread::initPipe ()
 PipeMessageHandler::PipeMessageHandler()
 	: skiComponent (0)
 	, lock (NEW FLock ("StateLock"))
-	, isReceiving (false)
 	, isShuttingDown (false)
-	, waitForMessageReceiver (0, "PipeMessageHandler")
+	, nextRequestId (1)
+	, queryLane (PIPE_MAX_QUERIES_IN_FLIGHT)
+	, bulkLane (PIPE_MAX_COMMANDS_IN_FLIGHT)
+	, wakeupPosted (false)
+	, hasCachedProjectPath (false)
+	, messenger (0)
+	, wakeupMessage (0)
+	, probePool (0)
 	, messageSendThread (0)
 	, messageReceiveThread (0)
 {
@@ -279,25 +429,62 @@ PipeMessageHandler::PipeMessageHandler()
 //------------------------------------------------------------------------
 PipeMessageHandler::~PipeMessageHandler()
 {
+	// first, it uses the pipe of the receive thread
+	if (messageSendThread)
+	{
+		messageSendThread->end ();
+		messageSendThread = 0;
+	}
+
 	if (messageReceiveThread)
 	{
+		// the main thread answers nothing anymore
+		isShuttingDown = true;
+
 		messageReceiveThread->end ();
 		messageReceiveThread = 0;
 	}
 
-	if (messageSendThread)
-	{
-		messageSendThread->end ();
-		messageSendThread = 0;
-	}
+	// waits for files being probed, their completions still need the lock
+	SafeDelete (probePool);
 
+	setSkiComponent (0);
 	SafeDelete (lock);
 }
 
+//------------------------------------------------------------------------
+PipeMessageHandler::Lane::Lane (int32 slotCount)
+: slotCount (slotCount)
+, inFlight (0)
+, depth (0)
+, maxDepth (0)
+, commands (0)
+, totalWait (0)
+, maxWait (0)
+, totalLatency (0)
+, maxLatency (0)
+{
+}
+
 //------------------------------------------------------------------------
 void PipeMessageHandler::setSkiComponent (SKIComponent* newSkiComponent )
 {
+	FGuard guard (*lock);
 	skiComponent = newSkiComponent;
+
+	if (messenger)
+		messenger->release ();
+	if (wakeupMessage)
+		wakeupMessage->release ();
+	messenger = 0;
+	wakeupMessage = 0;
+
+	// the only host objects the receive thread needs, made here once
+	if (skiComponent)
+	{
+		messenger = FHostCreate (IMessenger, skiComponent->getHostClasses ());
+		wakeupMessage = FHostCreate (IMessage, skiComponent->getHostClasses ());
+	}
 }
 
 //------------------------------------------------------------------------
@@ -307,81 +494,348 @@ void PipeMessageHandler::setShuttingDown()
 }
 
 //------------------------------------------------------------------------
-void PipeMessageHandler::readMessage (const char *cmd )
+// Called on the receive thread. The command is queued for the main thread
+// under a new request id and the receive thread goes straight back to the
+// pipe; the reply is sent whenever notifyMessageWasInterpreted () comes
+// back with that id. At most PIPE_MAX_COMMANDS_IN_FLIGHT commands wait for
+// the main thread at once; further ones wait in the lane until replies
+// free a slot, so this never blocks.
+void PipeMessageHandler::readMessage (const PipeRequest& request)
 {
 	if (!skiComponent)
 		return;
 
-	bool canContinue = true;
+	// binary commands only post their name, the main thread decodes the
+	// arguments from the request itself (see findRequest ())
+	const char* cmd = request.payload.c_str ();
+	bool hasArguments = false;
+	string binaryName;
+	if (request.binary)
+	{
+		CPipeFieldReader reader (request.payload.data (), request.payload.size ());
+		PipeField field;
+		if (!reader.next (field) || !field.getString8 (binaryName))
+		{
+			sendReply (request, "Malformed binary command");
+			return;
+		}
+		cmd = binaryName.c_str ();
+		hasArguments = reader.countFields () > 1;
+	}
+
+	// the command name ends at the first tab or line break
+	std::string_view name (cmd, strcspn (cmd, "\t\r\n"));
+	if (answerDirectly (request, name))
+		return;
+
+	int32 laneIndex = kQueryCommands.find (name) >= 0 ? PIPE_QUERY_LANE : PIPE_BULK_LANE;
+	Lane& lane = getLane (laneIndex);
+
+	Clock::time_point queuedAt = Clock::now ();
+	uint32 requestId = 0;
+	const char* refusal = "Currently Sending Message";
+	{
+		FGuard guard (*lock);
+		if (!isShuttingDown && lane.waiting.size () >= PIPE_MAX_WAITING)
+			refusal = "Busy";
+		else if (!isShuttingDown)
+		{
+			requestId = nextRequestId++;
+			if (nextRequestId == 0)
+				nextRequestId = 1;
+
+			PendingRequest& pending = pendingRequests[requestId];
+			pending.request = request;
+			pending.replied = false;
+			pending.lane = laneIndex;
+			pending.queuedAt = queuedAt;
+			pending.probing = isProbingCommand (name);
+		}
+	}
+	if (requestId == 0)
+	{
+		sendReply (request, refusal);
+		return;
+	}
+	updateMax (lane.maxDepth, ++lane.depth);
+
+	if (stricmp (cmd, "insert file") == 0 && !hasArguments)
+	{
+		// do not wait here because basehead seem to process the pasting
+		{
+			FGuard guard (*lock);
+			pendingRequests[requestId].replied = true;
+		}
+		sendReply (request, "ok");
+	}
+
+	QueuedCommand queued;
+	queued.requestId = requestId;
+	queued.command = cmd;
+	queued.queuedAt = queuedAt;
 	{
 		FGuard guard (*lock);
-		if (isShuttingDown)
-			canContinue = false;
-		else
-			isReceiving = true;
+		lane.waiting.push_back (queued);
+	}
+	if (!isProbingCommand (name))
+	{
+		admit (lane);
+		return;
 	}
-	if (canContinue)
+
+	// The files are checked on the probe threads while this thread goes
+	// back to the pipe. The command already has its place in the lane, and
+	// admit () holds it and the later commands of its session until the
+	// last file is done.
+	std::vector<string> paths;
+	getPathArguments (request, cmd, paths);
+	if (!probePool)
+		probePool = NEW CFileProbePool (PIPE_PROBE_THREADS);
+	probePool->probe (paths, [this, requestId] (std::vector<FileProbe>& probes)
 	{
+		{
+			FGuard guard (*lock);
+			std::map<uint32, PendingRequest>::iterator it = pendingRequests.find (requestId);
+			if (it == pendingRequests.end ())
+				return;
+			it->second.probes.swap (probes);
+			it->second.probing = false;
+		}
+		admit (bulkLane);
+		admit (queryLane);
+	});
+}
 
-		FUnknownPtr<IMessenger> hostMessenger = FHostCreate (IMessenger, skiComponent->getHostClasses ());
-		FUnknownPtr<IMessage> hostMessage = FHostCreate (IMessage, skiComponent->getHostClasses ());
-		if (hostMessenger && hostMessage)
+//------------------------------------------------------------------------------
+// Any thread: hands waiting commands to the main thread while the lane
+// has free slots. They are queued under the lock, so commands admitted
+// by different threads keep their order. A session's commands leave in
+// the order they arrived: one still being probed holds up the later bulk
+// commands of its session, and its queries too, which would otherwise
+// answer as if the files were not added yet.
+void PipeMessageHandler::admit (Lane& lane)
+{
+	bool admitted = false;
+	{
+		FGuard guard (*lock);
+		std::set<uint32> heldSessions;
+		if (&lane == &queryLane)
 		{
-			hostMessage->addString8 ("Command", cmd);
-			// posted Messages get delivered in main thread
-			hostMessenger->postMessage (skiComponent, hostMessage);		
+			for (std::deque<QueuedCommand>::iterator it = bulkLane.waiting.begin (); it != bulkLane.waiting.end (); ++it)
+			{
+				std::map<uint32, PendingRequest>::iterator pending = pendingRequests.find (it->requestId);
+				if (pending != pendingRequests.end () && pending->second.probing)
+					heldSessions.insert (pending->second.request.session);
+			}
+		}
 
-			if (stricmp(cmd, "insert file") == 0)
+		std::deque<QueuedCommand>::iterator it = lane.waiting.begin ();
+		while (it != lane.waiting.end () && lane.inFlight < lane.slotCount)
+		{
+			std::map<uint32, PendingRequest>::iterator pending = pendingRequests.find (it->requestId);
+			if (pending != pendingRequests.end ()
+				&& (pending->second.probing || heldSessions.count (pending->second.request.session) > 0))
 			{
-				// do not wait here because basehead seem to process the pasting
-				this->resultMessage = "ok";
+				heldSessions.insert (pending->second.request.session);
+				++it;
+				continue;
 			}
-			else
-				waitForMessageReceiver.acquire ();
+
+			lane.inFlight++;
+			lane.queue.push (std::move (*it));
+			it = lane.waiting.erase (it);
+			admitted = true;
+		}
+	}
+
+	// outside the lock, wakeMainThread () takes it
+	if (admitted)
+		wakeMainThread ();
+}
+
+//------------------------------------------------------------------------------
+// Receive thread: commands that need nothing from the main thread
+bool PipeMessageHandler::answerDirectly (const PipeRequest& request, std::string_view name)
+{
+	if (equalsCommandName (name, "project path"))
+	{
+		string path;
+		{
+			FGuard guard (*lock);
+			if (!hasCachedProjectPath)
+				return false;
+			path = cachedProjectPath;
+		}
+		sendReply (request, path);
+		return true;
+	}
+
+	if (equalsCommandName (name, "lane stats"))
+	{
+		static const char* laneNames[PIPE_LANE_COUNT] = {"query", "bulk"};
+		string stats = "ok";
+		for (int32 i = 0; i < PIPE_LANE_COUNT; i++)
+		{
+			Lane& lane = getLane (i);
+			uint32 commands = lane.commands;
+			char line[256];
+			snprintf (line, sizeof (line), "\n%s\t%d\t%d\t%u\t%llu\t%llu\t%llu\t%llu", laneNames[i],
+				(int)lane.depth, (int)lane.maxDepth, commands,
+				(unsigned long long)(commands ? lane.totalWait / commands : 0), (unsigned long long)lane.maxWait,
+				(unsigned long long)(commands ? lane.totalLatency / commands : 0), (unsigned long long)lane.maxLatency);
+			stats += line;
 		}
+		sendReply (request, stats);
+		return true;
 	}
+	return false;
+}
+
+//------------------------------------------------------------------------------
+void PipeMessageHandler::setCachedProjectPath (const char* path)
+{
+	FGuard guard (*lock);
+	hasCachedProjectPath = path != 0;
+	cachedProjectPath = path ? path : "";
+}
+
+//------------------------------------------------------------------------------
+// Any thread. One wakeup serves every command queued until the main thread
+// calls wakeupReceived (); onIdle () drains the queue as well, so nothing
+// is lost while there is no messenger.
+void PipeMessageHandler::wakeMainThread ()
+{
+	if (wakeupPosted.exchange (true))
+		return;
+
+	FGuard guard (*lock);
+	// posted Messages get delivered in main thread
+	if (skiComponent && messenger && wakeupMessage)
+		messenger->postMessage (skiComponent, wakeupMessage);
 	else
-		resultMessage = "Currently Sending Message";
+		wakeupPosted = false;
+}
 
-	//resultMessage.toMultiByte ();
-	//if (messageSendThread)
-	//	messageReceiveThread->getPipe ()->send (resultMessage.text8 ());
+//------------------------------------------------------------------------------
+// Queries first, so none waits behind more than one bulk command.
+bool PipeMessageHandler::takeCommand (uint32& requestId /*out*/, string& command /*out*/)
+{
+	QueuedCommand queued;
+	Lane* lane = &queryLane;
+	if (!lane->queue.pop (queued))
+	{
+		lane = &bulkLane;
+		if (!lane->queue.pop (queued))
+			return false;
+	}
 
-	if (messageSendThread)
-		messageReceiveThread->getPipe ()->send (resultMessage.c_str ());
+	lane->depth--;
+	uint64 wait = microsecondsSince (queued.queuedAt);
+	lane->totalWait += wait;
+	updateMax (lane->maxWait, wait);
 
+	requestId = queued.requestId;
+	command.swap (queued.command);
+	return true;
+}
+
+//------------------------------------------------------------------------------
+// Called on the main thread once the command with requestId was executed.
+void PipeMessageHandler::notifyMessageWasInterpreted (uint32 requestId, const char8* resultMessage)
+{
+	PipeRequest request;
+	bool needsReply = false;
+	int32 laneIndex = PIPE_BULK_LANE;
+	Clock::time_point queuedAt;
 	{
 		FGuard guard (*lock);
-		isReceiving = false;
+		std::map<uint32, PendingRequest>::iterator it = pendingRequests.find (requestId);
+		if (it == pendingRequests.end ())
+			return;
+
+		request = it->second.request;
+		needsReply = !it->second.replied;
+		laneIndex = it->second.lane;
+		queuedAt = it->second.queuedAt;
+		pendingRequests.erase (it);
+		getLane (laneIndex).inFlight--;
 	}
 
+	Lane& lane = getLane (laneIndex);
+	uint64 latency = microsecondsSince (queuedAt);
+	lane.totalLatency += latency;
+	updateMax (lane.maxLatency, latency);
+	lane.commands++;
+	admit (lane);
+
+	if (needsReply && messageReceiveThread && messageReceiveThread->getPipe ())
+		messageReceiveThread->getPipe ()->postReply (request, resultMessage ? resultMessage : "");
+}
+
+//------------------------------------------------------------------------------
+const PipeRequest* PipeMessageHandler::findRequest (uint32 requestId)
+{
+	// map nodes stay put while the receive thread inserts new ones, and
+	// only the main thread erases them
+	FGuard guard (*lock);
+	std::map<uint32, PendingRequest>::iterator it = pendingRequests.find (requestId);
+	if (it == pendingRequests.end ())
+		return 0;
+	return &it->second.request;
 }
 
 //------------------------------------------------------------------------------
-void PipeMessageHandler::notifyMessageWasInterpreted (const char8* resultMessage)
+const std::vector<FileProbe>* PipeMessageHandler::findProbes (uint32 requestId)
 {
-	this->resultMessage = resultMessage;
-	waitForMessageReceiver.release ();
+	FGuard guard (*lock);
+	std::map<uint32, PendingRequest>::iterator it = pendingRequests.find (requestId);
+	if (it == pendingRequests.end () || it->second.probes.empty ())
+		return 0;
+	return &it->second.probes;
+}
+
+//------------------------------------------------------------------------------
+// Only valid on the receive thread, which owns the pipe.
+void PipeMessageHandler::sendReply (const PipeRequest& request, const string& resultMessage)
+{
+	if (messageReceiveThread && messageReceiveThread->getPipe ())
+		messageReceiveThread->getPipe ()->send (request, resultMessage);
 }
 
 //------------------------------------------------------------------------------
 bool PipeMessageHandler::sendMessageToWindow (int code, const char* message )
 {
+	// BaseHead may be blocked on a reply and would not answer the
+	// window message before the timeout. Commands already answered and
+	// those of clients subscribed on the pipe do not block: the latter
+	// get every notification pushed, which never blocks.
 	bool canContinue = true;
 	{
 		FGuard guard (*lock);
-		if (isReceiving)
-			canContinue = false;
-	}
-
-	if (canContinue)
-	{
-		if (0 == messageSendThread)
+		std::map<uint32, PendingRequest>::const_iterator it;
+		for (it = pendingRequests.begin (); it != pendingRequests.end () && canContinue; ++it)
 		{
-			messageSendThread = MessageSendThread::create ();
-		}		
-		messageSendThread->addMessage (ReturnMessage (code, message));
+			if (!it->second.replied && !it->second.request.subscribed)
+				canContinue = false;
+		}
 	}
 
+	addNotification (code, message, canContinue);
 	return canContinue;
 }
+
+//------------------------------------------------------------------------------
+void PipeMessageHandler::sendEvent (int code, const char* message)
+{
+	addNotification (code, message, false);
+}
+
+//------------------------------------------------------------------------------
+void PipeMessageHandler::addNotification (int code, const char* message, bool toWindow)
+{
+	if (0 == messageSendThread)
+	{
+		messageSendThread = MessageSendThread::create (messageReceiveThread ? messageReceiveThread->getPipe () : 0);
+	}		
+	messageSendThread->addMessage (ReturnMessage (code, message, toWindow));
+}
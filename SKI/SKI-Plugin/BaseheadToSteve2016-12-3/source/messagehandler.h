@@ -10,23 +10,69 @@
 #include "base/source/fobject.h"
 #include "base/source/tlist.h"
 
-#include "NamedPipe.h"
+#include "PipeServer.h"
 #include <base/thread/include/fthread.h>
 #include <base/thread/include/flock.h>
 
+#include "MpscQueue.h"
+#include "FileProbe.h"
+#include <map>
+#include <set>
+#include <deque>
+#include <atomic>
+#include <chrono>
+#include <string_view>
+
 
 #define PIPE_NAME "BaseHeadNuendoPipe"
 
+// commands posted to the main thread but not yet answered, per lane;
+// further ones wait in arrival order without holding up the receive
+// thread, and beyond PIPE_MAX_WAITING of them the reply is "Busy"
+#define PIPE_MAX_COMMANDS_IN_FLIGHT 32
+#define PIPE_MAX_QUERIES_IN_FLIGHT	8
+#define PIPE_MAX_WAITING			1024
+
+// Commands run in one of two lanes. Queries that never edit the project
+// (see kQueryCommands in messagehandler.cpp) go to the query lane, which the main thread
+// always empties before it takes the next command of the bulk lane;
+// "project path" is even answered by the receive thread while the path
+// is cached. "lane stats" reports one line per lane after "ok":
+//
+//   <lane> \t <depth> \t <max depth> \t <commands> \t <average wait> \t
+//   <max wait> \t <average latency> \t <max latency>
+//
+// Depth counts the commands not yet taken by the main thread, waiting for
+// a slot or queued. Wait is the time until the main thread took the
+// command, latency the time until the reply, both in microseconds.
+#define PIPE_QUERY_LANE		0
+#define PIPE_BULK_LANE		1
+#define PIPE_LANE_COUNT		2
+
+// main thread time spent on queued commands per idle call or wakeup, in
+// milliseconds; commands left over wait for the next one
+#define PIPE_DRAIN_TIME 10
+
 #define SKI_PLG_STARTED		0
 #define SKI_PRJ_ADDED		1
 #define SKI_PRJ_REMOVED		2
 #define SKI_PRJ_ACTIVATED	3
 #define SKI_PRJ_DEACTIVATED	4
 #define SKI_PLG_STOPPED		5
+#define SKI_JOB_PROGRESS	6	/* pipe only, see JobList.h */
+#define SKI_JOB_FINISHED	7	/* pipe only */
+
+// threads checking the files of "xfertopool" commands before the main
+// thread gets them
+#define PIPE_PROBE_THREADS	8
 
 class MessageSendThread;
 class MessageReceiveThread;
 class SKIComponent;
+namespace Steinberg {
+class IMessenger;
+class IMessage;
+}
 
 using namespace Steinberg;
 
@@ -42,23 +88,103 @@ public:
 	void setSkiComponent (SKIComponent* newSkiComponent);
 	void setShuttingDown ();
 
-	void readMessage (const char *cmd);
+	void readMessage (const PipeRequest& request);
 	bool sendMessageToWindow (int code, const char *message);
 
-	void notifyMessageWasInterpreted (const char8* resultMessage);
+	// Notification for sessions subscribed on the pipe, never sent to the
+	// BaseHead window
+	void sendEvent (int code, const char* message);
+
+	void notifyMessageWasInterpreted (uint32 requestId, const char8* resultMessage);
+
+	// Main thread only: the request behind requestId, valid until
+	// notifyMessageWasInterpreted () was called for it.
+	const PipeRequest* findRequest (uint32 requestId);
+
+	// Main thread only: the next command queued by readMessage (), false
+	// if there is none
+	bool takeCommand (uint32& requestId /*out*/, string& command /*out*/);
+
+	// Main thread only: for commands that add files to the pool, one probe
+	// per file argument, made before the command was queued; 0 for other
+	// commands. Valid as long as findRequest ().
+	const std::vector<FileProbe>* findProbes (uint32 requestId);
+
+	// Main thread only: call before draining the queue, so commands queued
+	// from now on post a new wakeup
+	void wakeupReceived () { wakeupPosted = false; }
+
+	// Posts a message that makes the main thread drain the queue, unless
+	// one is on its way already
+	void wakeMainThread ();
+
+	// Main thread: the reply to "project path" while the active project
+	// stays the same, 0 when it has to be asked for again
+	void setCachedProjectPath (const char* path);
 
 	SINGLETON (PipeMessageHandler);
 	//------------------------------------------------------------------------------
 private:
 	SKIComponent* skiComponent;
 	
+	typedef std::chrono::steady_clock Clock;
+
+	struct QueuedCommand
+	{
+		uint32 requestId;
+		string command;		// text command, or the name of a binary one
+		Clock::time_point queuedAt;
+	};
+
+	struct PendingRequest
+	{
+		PipeRequest request;
+		bool replied;		// answered before the main thread got to it
+		int32 lane;
+		Clock::time_point queuedAt;
+		bool probing;		// waits for its probes, and so do later commands of its session
+		std::vector<FileProbe> probes;	// see findProbes ()
+	};
+
+	struct Lane
+	{
+		Lane (int32 slotCount);
+
+		int32 slotCount;
+		int32 inFlight;						// guarded by lock
+		std::deque<QueuedCommand> waiting;	// for a slot, guarded by lock
+		MpscQueue<QueuedCommand> queue;
+
+		// written by both threads, read by "lane stats"
+		std::atomic<int32> depth;
+		std::atomic<int32> maxDepth;
+		std::atomic<uint32> commands;
+		std::atomic<uint64> totalWait;		// microseconds
+		std::atomic<uint64> maxWait;
+		std::atomic<uint64> totalLatency;
+		std::atomic<uint64> maxLatency;
+	};
+
+	Lane& getLane (int32 lane) { return lane == PIPE_QUERY_LANE ? queryLane : bulkLane; }
+	bool answerDirectly (const PipeRequest& request, std::string_view name);
+	void admit (Lane& lane);
+	void sendReply (const PipeRequest& request, const string& resultMessage);
+	void addNotification (int code, const char* message, bool toWindow);
+
 	FLock* lock;
-	volatile bool isReceiving;
 	volatile bool isShuttingDown;
 
-	FSemaphore waitForMessageReceiver;
-	//String resultMessage;
-	string resultMessage;
+	std::map<uint32, PendingRequest> pendingRequests;	// guarded by lock
+	uint32 nextRequestId;
+
+	Lane queryLane;
+	Lane bulkLane;
+	std::atomic<bool> wakeupPosted;
+	string cachedProjectPath;	// guarded by lock
+	bool hasCachedProjectPath;
+	IMessenger* messenger;		// created once with wakeupMessage, guarded by lock
+	IMessage* wakeupMessage;
+	CFileProbePool* probePool;	// receive thread, made with the first "xfertopool"
 
 	MessageSendThread* messageSendThread;
 	MessageReceiveThread* messageReceiveThread;
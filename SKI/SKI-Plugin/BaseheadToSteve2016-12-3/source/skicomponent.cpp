@@ -14,7 +14,12 @@
 #include "base/source/tlist.h"
 #include "base/source/tassociation.h"
 #include "messagehandler.h"
+#include "PipeCodec.h"
+#include "CommandTable.h"
 #include "strutil.h"
+#include "UtfConvert.h"
+#include "AudioHeader.h"
+#include "PeakFile.h"
 
 extern void* moduleHandle; // defined in dllmain.cpp
 
@@ -31,11 +36,15 @@ static SKIComponent *m_Self = NULL;
 SKIComponent::SKIComponent ()
 : guiDescription (0)
 , projectInfo (0)
+, platform (0)
 , dialogController (0)
 , hostClasses (0)
+, peakBuilder (0)
 {
 	FUNKNOWN_CTOR
 
+	registerCommands ();
+
 	// m_Log = NULL;
 }
 
@@ -47,12 +56,7 @@ SKIComponent::~SKIComponent ()
 	PipeMessageHandler::instance ()->setSkiComponent (0);
 
 	// Close mutex handle
-	char c[] = "BaseHeadNuendoMutex";
-	WCHAR    name[20];
-	memset(name, 0, sizeof(name));
-	MultiByteToWideChar(0, 0, c, strlen(c), name, strlen(c) + 1);
-
-	HANDLE hMutex = CreateMutexW(NULL, TRUE, (LPWSTR)name);
+	HANDLE hMutex = CreateMutexW(NULL, TRUE, L"BaseHeadNuendoMutex");
 	if(GetLastError() == ERROR_ALREADY_EXISTS)
 	{
 		CloseHandle(hMutex);
@@ -116,9 +120,15 @@ tresult PLUGIN_API SKIComponent::initialize (FUnknown* context)
 		projectInfo->registerNotification (this);
 
 	// initiate idle calls from host 
-	FInstancePtr<IPlatform> platform (hostClasses);
-	if (platform)
-		platform->addIdleHandler (this);
+	FInstancePtr<IPlatform> hostPlatform (hostClasses);
+	if (hostPlatform)
+	{
+		hostPlatform->addIdleHandler (this);
+		platform = hostPlatform;
+		platform->addRef ();
+	}
+
+	peakBuilder = new CPeakBuilder;
 
 	PipeMessageHandler::instance ()->setSkiComponent (this);
 	Alone ();
@@ -141,11 +151,8 @@ void SKIComponent::SendAcknowledge(int code, const char *message)
 bool SKIComponent::Alone()
 {
 	char c[] = "BaseHeadNuendoMutex";
-	WCHAR    name[20];
-	memset(name, 0, sizeof(name));
-	MultiByteToWideChar(0, 0, c, strlen(c), name, strlen(c) + 1);
 
-	HANDLE hMutex = CreateMutexW(NULL, TRUE, (LPWSTR)name);
+	HANDLE hMutex = CreateMutexW(NULL, TRUE, L"BaseHeadNuendoMutex");
 	if(GetLastError() == ERROR_ALREADY_EXISTS)
 	{
 		CloseHandle(hMutex);
@@ -155,192 +162,605 @@ bool SKIComponent::Alone()
 	return true;
 }
 
-inline void replace(std::string& text, std::string s, std::string d)
+//------------------------------------------------------------------------
+// UTF-8 path of project, result is left alone if it has none
+static bool getProjectPathString (IProject* project, string& result /*out*/)
 {
-  for(std::string::size_type index=text.find(s); index!=std::string::npos; index=text.find(s, index))
-  {
-    text.replace(index, s.length(), d);
-    index+=d.length();
-  }
+	IPath* path = project->getProjectPath ();
+	if (!path)
+		return false;
+
+	tchar buffer[kIPPathNameMax] = {0};
+	path->getFullPath (buffer);
+	utf16ToUtf8 ((const char16_t*)buffer, result);
+	return true;
 }
 
 //------------------------------------------------------------------------
-void SKIComponent::ReadMessage(const char *cmd)
+// Runs the commands queued by the pipe until there are no more or maxTime
+// milliseconds have passed.
+void SKIComponent::processCommands (int32 maxTime)
 {
-	string message;
-	if (cmd == 0 || stricmp (cmd, "") == 0)
+	PipeMessageHandler* handler = PipeMessageHandler::instance ();
+	handler->wakeupReceived ();
+
+	int32 start = platform ? platform->getTickCount () : 0;
+	uint32 requestId = 0;
+	string command;
+	while (handler->takeCommand (requestId, command))
 	{
-		message.append ("Empty command");
-		goto Quit;
+		ReadMessage (command.c_str (), requestId);
+		if (platform && platform->getTickCount () - start >= maxTime)
+		{
+			// the rest after the host had its turn
+			handler->wakeMainThread ();
+			break;
+		}
 	}
+}
 
-	//m_Log->Write("input %s", cmd);
-	
+//------------------------------------------------------------------------
+bool SKIComponent::fieldsToTokens (const PipeRequest& request, vector<string>& fieldTokens, strutil::TokenList& tokens)
+{
+	CPipeFieldReader reader (request.payload.data (), request.payload.size ());
+	PipeField field;
+	while (reader.next (field))
 	{
-		IProject *project = projectInfo->getActiveProject();
-		vector<string> items;
-		vector<string> tokens = strutil::split(string(cmd), string("\t"));
-
-		if (!project)
+		string token;
+		uint32_t intValue = 0;
+		double floatValue = 0.0;
+		if (field.getUInt32 (intValue))
+			token = std::to_string (intValue);
+		else if (field.getFloat64 (floatValue))
 		{
-			message.append("Couldn't open active project");
-			goto Quit;
+			char buffer[32];
+			snprintf (buffer, sizeof (buffer), "%.17g", floatValue);
+			token = buffer;
 		}
+		else if (!field.getString8 (token))
+			return false;
+		fieldTokens.push_back (token);
+	}
 
-		if (stricmp (tokens[0].c_str(), "insert file") == 0 && tokens.size () >= 2)
-		{
-			InsertPackage package;
-			package.parseTokens (tokens);
+	// only now, fieldTokens does not move anymore
+	for (uint32 i = 0; i < fieldTokens.size (); i++)
+		tokens.push_back (fieldTokens[i]);
+	return reader.isValid () && !tokens.empty ();
+}
 
+//------------------------------------------------------------------------
+// Every command name a handler can be registered under. kCommands is a
+// perfect hash over them, built at compile time.
+static constexpr const char* kCommandNames[] =
+{
+	"insert file",
+	"insert files",
+	"spot files",
+	"distribute files",
+	"project path",
+	"xfertopool file",
+	"xfertopool job",
+	"job status",
+	"job cancel",
+	"cursor position",
+	"pool contains"
+};
+static constexpr CommandTable<sizeof (kCommandNames) / sizeof (kCommandNames[0])> kCommands (kCommandNames);
+static_assert (kCommands.isValid (), "no perfect hash for kCommandNames, raise CommandTable::kMaxSeed");
 
-			IWindow *window = project->getProjectWindow ();
-			window->toFront ();
+//------------------------------------------------------------------------
+void SKIComponent::registerCommands ()
+{
+	commandHandlers.assign (kCommands.size (), 0);
+
+	registerCommand ("insert file", &SKIComponent::onInsertFile);
+	registerCommand ("insert files", &SKIComponent::onInsertFiles);
+	registerCommand ("spot files", &SKIComponent::onSpotFiles);
+	registerCommand ("distribute files", &SKIComponent::onDistributeFiles);
+	registerCommand ("project path", &SKIComponent::onProjectPath);
+	registerCommand ("xfertopool file", &SKIComponent::onXferToPool);
+	registerCommand ("xfertopool job", &SKIComponent::onXferToPoolJob);
+	registerCommand ("job status", &SKIComponent::onJobStatus);
+	registerCommand ("job cancel", &SKIComponent::onJobCancel);
+	registerCommand ("cursor position", &SKIComponent::onCursorPosition);
+	registerCommand ("pool contains", &SKIComponent::onPoolContains);
+}
 
-			FIDString resultMessage = insertFile (package);
-			message.append (resultMessage);
+//------------------------------------------------------------------------
+void SKIComponent::registerCommand (const char* name, CommandHandler handler)
+{
+	int index = kCommands.find (name);
+	ASSERT (index >= 0)	// add the name to kCommandNames
+	if (index >= 0)
+		commandHandlers[index] = handler;
+}
 
-			goto Quit;
-		}
+//------------------------------------------------------------------------
+void SKIComponent::ReadMessage(const char *cmd, uint32 requestId)
+{
+	string message;
+	if (cmd == 0 || stricmp (cmd, "") == 0)
+		message.append ("Empty command");
+	else
+	{
+		//m_Log->Write("input %s", cmd);
+
+		CommandArguments args;
+		args.text = cmd;
+		args.request = PipeMessageHandler::instance ()->findRequest (requestId);
+		args.isBinary = args.request && args.request->binary;
+		args.project = projectInfo->getActiveProject();
 
-		if (stricmp(cmd, "insert file") == 0)
+		// the command name ends at the first tab or line break
+		std::string_view name (cmd, strcspn (cmd, "\t\r\n"));
+		if (args.isBinary)
 		{
-			IWindow *window = project->getProjectWindow();
-			window->toFront();
+			if (!fieldsToTokens (*args.request, args.fieldTokens, args.tokens))
+				message.append("Malformed binary command");
+			else
+				name = args.tokens[0];
+		}
+		else
+			strutil::split(std::string_view (cmd), "\t", args.tokens);
 
-			tresult res = -1;
-			IActionManager* actionManager = HOST_NEW (IActionManager);
-			if (actionManager)
+		// probed by the message handler before the command was queued
+		args.probes = PipeMessageHandler::instance ()->findProbes (requestId);
+		if (args.probes && args.probes->size () + 1 != args.tokens.size ())
+			args.probes = 0;
+
+		if (message.empty ())
+		{
+			int index = kCommands.find (name);
+			if (!args.project)
+				message.append("Couldn't open active project");
+			else if (index < 0 || !commandHandlers[index])
 			{
-				res = actionManager->performAction ("Edit", "Paste");
-				actionManager->release ();
-				message.append("ok");
+				message.append("Unknown command: ");
+				message.append(cmd);
 			}
 			else
-				message.append("Couldn't initialize Action Manager");
-			return;
+				(this->*commandHandlers[index]) (args, message);
 		}
+	}
+
+	// Process message
+	String messageObject = (char*)message.data ();
+	PipeMessageHandler::instance ()->notifyMessageWasInterpreted (requestId, messageObject.text8 ());
+}
 
-		if (stricmp(cmd, "project path") == 0)
+//------------------------------------------------------------------------
+// "insert file" with arguments inserts one file, without it pastes
+void SKIComponent::onInsertFile (CommandArguments& args, string& result)
+{
+	IProject* project = args.project;
+	if (args.tokens.size () >= 2)
+	{
+		InsertPackage package;
+		if (args.isBinary)
 		{
-			char buffer[1024], out[1024];
-			memset(buffer, 0, sizeof(buffer));
-			IPath *path = project->getProjectPath();
-			if (path)
+			// numbers and paths straight from the payload, no text parsing
+			CPipeFieldReader reader (args.request->payload.data (), args.request->payload.size ());
+			if (!package.parseFields (reader))
 			{
-				path->getFullPath((tchar *)buffer);
-				int count = WideCharToMultiByte(CP_UTF8, 0, (LPCWSTR)buffer, -1, 0, 0, 0, 0);
-				if (count > 0)
-				{
-					WideCharToMultiByte(CP_UTF8, 0, (LPCWSTR)buffer, -1, out, count, 0, 0);
-					out[count] = 0; // make the string null-terminated
-					message.append(out);
-				}
-				else
-					message.append(buffer);
+				result.append("Malformed insert file arguments");
+				return;
 			}
-			else
-				message.append("No active persistent project");
-			goto Quit;
 		}
+		else if (!package.parseTokens (args.tokens, result))
+			return;
+
+
+		IWindow *window = project->getProjectWindow ();
+		window->toFront ();
+
+		FIDString resultMessage = insertFile (package);
+		result.append (resultMessage);
+		return;
+	}
+
+	IWindow *window = project->getProjectWindow();
+	window->toFront();
+
+	tresult res = -1;
+	IActionManager* actionManager = HOST_NEW (IActionManager);
+	if (actionManager)
+	{
+		res = actionManager->performAction ("Edit", "Paste");
+		actionManager->release ();
+		result.append("ok");
+	}
+	else
+		result.append("Couldn't initialize Action Manager");
+}
+
+//------------------------------------------------------------------------
+// "insert files", then one line per file with the arguments of "insert file"
+void SKIComponent::onInsertFiles (CommandArguments& args, string& result)
+{
+	vector<InsertPackage> packages;
+	if (!parsePackages (args, 0, packages, result))
+		return;
+
+	IWindow *window = args.project->getProjectWindow ();
+	window->toFront ();
+
+	insertFiles (packages, result);
+}
+
+//------------------------------------------------------------------------
+// "spot files" <tab> project start, then one line per file with the
+// arguments of "insert file". The project start is the time reference of
+// project position 0 in seconds, 3600 for a project starting at 01:00:00:00.
+void SKIComponent::onSpotFiles (CommandArguments& args, string& result)
+{
+	double projectStart = 0.0;
+	if (args.isBinary)
+	{
+		CPipeFieldReader reader (args.request->payload.data (), args.request->payload.size ());
+		PipeField field;
+		reader.next (field);
+		if (!reader.next (field) || !field.getFloat64 (projectStart))
+		{
+			result.append("Malformed spot files arguments");
+			return;
+		}
+	}
+	else
+	{
+		strutil::TokenArray<256> lines;
+		strutil::TokenArray<8> tokens;
+		strutil::split(std::string_view (args.text), "\r\n", lines);
+		if (lines.size () > 0)
+			strutil::split(lines[0], "\t", tokens);
+
+		const char* problem = 0;
+		if (tokens.size () >= 2 && (problem = strutil::parseNumber (tokens[1], projectStart)) != 0)
+		{
+			result.append (string ("Invalid project start: ") + problem);
+			return;
+		}
+	}
+
+	vector<InsertPackage> packages;
+	if (!parsePackages (args, 1, packages, result))
+		return;
+
+	IWindow *window = args.project->getProjectWindow ();
+	window->toFront ();
+
+	spotFiles (packages, projectStart, result);
+}
+
+//------------------------------------------------------------------------
+// "distribute files" <tab> layout [<tab> track count], then one line per
+// file with the arguments of "insert file", whose track offsets are
+// replaced by the layout: "consecutive", "round robin" over track count
+// tracks (all from the selected one if 0 or left out), or "create" for
+// consecutive tracks with new ones where they run out.
+void SKIComponent::onDistributeFiles (CommandArguments& args, string& result)
+{
+	string layoutName;
+	uint32 trackCount = 0;
+	if (args.isBinary)
+	{
+		CPipeFieldReader reader (args.request->payload.data (), args.request->payload.size ());
+		PipeField field;
+		reader.next (field);
+		if (!reader.next (field) || !field.getString8 (layoutName) || !reader.next (field) || !field.getUInt32 (trackCount))
+		{
+			result.append("Malformed distribute files arguments");
+			return;
+		}
+	}
+	else
+	{
+		strutil::TokenArray<256> lines;
+		strutil::TokenArray<8> tokens;
+		strutil::split(std::string_view (args.text), "\r\n", lines);
+		if (lines.size () > 0)
+			strutil::split(lines[0], "\t", tokens);
+		if (tokens.size () >= 2)
+			layoutName = string (tokens[1]);
+
+		const char* problem = 0;
+		if (tokens.size () >= 3 && (problem = strutil::parseNumber (tokens[2], trackCount)) != 0)
+		{
+			result.append (string ("Invalid track count: ") + problem);
+			return;
+		}
+	}
+
+	TrackLayout layout;
+	if (layoutName == "consecutive")
+		layout = kConsecutiveTracks;
+	else if (layoutName == "round robin")
+		layout = kRoundRobinTracks;
+	else if (layoutName == "create")
+		layout = kCreateTracks;
+	else
+	{
+		result.append("Unknown track layout: " + layoutName);
+		return;
+	}
+
+	vector<InsertPackage> packages;
+	if (!parsePackages (args, 2, packages, result))
+		return;
+
+	IWindow *window = args.project->getProjectWindow ();
+	window->toFront ();
+
+	distributeFiles (packages, layout, trackCount, result);
+}
 
-		if (stricmp(tokens[0].c_str(), "xfertopool file") == 0)
+//------------------------------------------------------------------------
+// The files of "insert files" and commands like it: a line of six tokens
+// per file after the first, or six fields per file after the command name
+// and leadingFields other fields.
+bool SKIComponent::parsePackages (CommandArguments& args, int32 leadingFields, std::vector<InsertPackage>& packages, string& result)
+{
+	if (args.isBinary)
+	{
+		// six fields per file, all of them required
+		CPipeFieldReader reader (args.request->payload.data (), args.request->payload.size ());
+		PipeField field;
+		for (int32 i = 0; i <= leadingFields; i++)
+			reader.next (field);
+		int32 fileFields = (int32)reader.countFields () - 1 - leadingFields;
+		if (fileFields < 0 || fileFields % 6 != 0)
+		{
+			result.append("Malformed " + string (args.tokens[0]) + " arguments");
+			return false;
+		}
+		packages.resize (fileFields / 6);
+		for (uint32 i = 0; i < packages.size (); i++)
 		{
-			IMediaPool *pool = project->getMediaPool();
-			if (pool)
+			if (!packages[i].parseArguments (reader, true))
 			{
-				for (int i = 0; i < pool->countMediaItems(); i++)
-				{
-					IMedium *medium = pool->getMediumByIndex(i);
-					if (medium)
-					{
-						IPath *path = medium->getFilePath();
-						char buffer[1024], out[1024];
-
-						if (path)
-						{
-							memset(buffer, 0, sizeof(buffer));
-							path->getFullPath((tchar *)buffer);
-
-							int count = WideCharToMultiByte(CP_UTF8, 0, (LPCWSTR)buffer, -1, 0, 0, 0, 0);
-							if (count > 0)
-							{
-								WideCharToMultiByte(CP_UTF8, 0, (LPCWSTR)buffer, -1, out, count, 0, 0);
-								out[count] = 0; // make the string null-terminated
-
-								// m_Log->Write("pool[%d]=%s", i, out);
-								items.push_back(string(out));
-							}
-						}
-					}
-				}
+				result.append("Malformed " + string (args.tokens[0]) + " arguments");
+				return false;
+			}
+		}
+	}
+	else
+	{
+		strutil::TokenArray<256> lines;
+		strutil::split(std::string_view (args.text), "\r\n", lines);
+		packages.resize (lines.size () > 0 ? lines.size () - 1 : 0);
+		for (uint32 i = 1; i < lines.size (); i++)
+		{
+			strutil::TokenArray<8> fileTokens;
+			fileTokens.push_back ("insert files");
+			strutil::split(lines[i], "\t", fileTokens);
 
-				for (uint32 i = 1; i < tokens.size(); i++)
-				{
-					bool bFound = false;
-					for (uint32 j = 0; j < items.size(); j++)
-					{
-						if (stricmp(tokens[i].c_str(), items[j].c_str()) == 0)
-						{
-							bFound = true;
-							break;
-						}
-					}
-
-					// m_Log->Write("tokens[%d]=%s found=%d", i, tokens[i].c_str(), bFound);
-					if (!bFound)
-					{
-						// Add file to pool
-						IAudioClip* clip = HOST_NEW (IAudioClip);
-						if (clip)
-						{
-							FUnknownPtr<IMedium> medium(clip);
-							if (medium)
-							{
-								WCHAR name[1024];
-								memset(name, 0, sizeof(name));
-								MultiByteToWideChar(0, 0, tokens[i].c_str(), strlen(tokens[i].c_str()), name, strlen(tokens[i].c_str()) + 1);
-
-								IPath *path = HOST_NEW (IPath);
-								path->setFullPath(name, 0);
-								medium->setFilePath(path);
-								// path->release ();
-							}
-
-							tresult res = pool->addMedium(medium);
-							if (!res)
-								message.append("ok");
-							else
-								message.append("Couldn't add media to pool");
-						}
-						else
-						{
-							message.append("Couldn't create audio clip");
-						}
-					}
-					else
-					{
-						//message.append("File already exists in pool");
-						message.append("ok");
-					}
-				}
-				replace(message, "ok", "");
-				if (message.length() == 0)
-					message.append("ok");
-				goto Quit;
+			string error;
+			if (!packages[i - 1].parseTokens (fileTokens, error))
+			{
+				result.append ("File " + std::to_string (i) + ": " + error);
+				return false;
 			}
 		}
 	}
 
-	
-	message.append("Unknown command: ");
-	message.append(cmd);
+	if (packages.empty ())
+	{
+		result.append("No files to insert");
+		return false;
+	}
+	return true;
+}
 
-	// Process message
-Quit:
-	String messageObject = (char*)message.data ();
-	PipeMessageHandler::instance ()->notifyMessageWasInterpreted (messageObject.text8 ());
+//------------------------------------------------------------------------
+void SKIComponent::onProjectPath (CommandArguments& args, string& result)
+{
+	string path;
+	if (getProjectPathString(args.project, path))
+		result.append(path);
+	else
+		result.append("No active persistent project");
+
+	PipeMessageHandler::instance ()->setCachedProjectPath (result.c_str ());
 }
 
+//------------------------------------------------------------------------
+void SKIComponent::onCursorPosition (CommandArguments& args, string& result)
+{
+	char buffer[64];
+	snprintf (buffer, sizeof (buffer), "ok\t%.17g", getCursorPosition ());
+	result.append (buffer);
+}
+
+//------------------------------------------------------------------------
+// pool contains <tab> path ...: ok, then 1 or 0 per path
+void SKIComponent::onPoolContains (CommandArguments& args, string& result)
+{
+	IMediaPool* pool = args.project->getMediaPool ();
+	if (!pool)
+	{
+		result.append ("Access to pool failed");
+		return;
+	}
+
+	MediaPoolIndex& index = poolIndexes[args.project];
+	index.update (pool);
+
+	result.append ("ok");
+	for (uint32 i = 1; i < args.tokens.size (); i++)
+		result.append (index.contains (args.tokens[i]) ? "\t1" : "\t0");
+}
+
+//------------------------------------------------------------------------
+void SKIComponent::onXferToPool (CommandArguments& args, string& result)
+{
+	const strutil::TokenList& tokens = args.tokens;
+	if (!args.project->getMediaPool())
+	{
+		result.append("Unknown command: ");
+		result.append(args.text);
+		return;
+	}
+
+	// one "problem: path" line per file that did not make it
+	for (uint32 i = 1; i < tokens.size(); i++)
+	{
+		FIDString problem = transferToPool(args.project, tokens[i], args.probes ? &(*args.probes)[i - 1] : 0);
+		if (problem)
+		{
+			if (!result.empty())
+				result.append("\n");
+			result.append(problem);
+			result.append(": ");
+			result.append(tokens[i]);
+		}
+	}
+	if (result.length() == 0)
+		result.append("ok");
+}
+
+//------------------------------------------------------------------------
+// xfertopool file as a job, one file per step
+class XferToPoolJob : public Job
+{
+public:
+	XferToPoolJob (SKIComponent* component, IProject* project, const strutil::TokenList& tokens, const std::vector<FileProbe>* probes)
+	: Job (project, (int32)tokens.size () - 1)
+	, component (component)
+	{
+		for (uint32 i = 1; i < tokens.size (); i++)
+			paths.push_back (string (tokens[i]));
+		if (probes)
+			this->probes = *probes;
+	}
+
+protected:
+	bool doStep ()
+	{
+		// like xfertopool file, a failed file does not stop the others
+		FIDString problem = component->transferToPool (project, paths[done], probes.empty () ? 0 : &probes[done]);
+		if (problem)
+		{
+			if (!result.empty ())
+				result.append ("\n");
+			result.append ("File " + to_string (done + 1) + ": " + problem + ": " + paths[done]);
+		}
+		return true;
+	}
+
+	SKIComponent* component;
+	std::vector<string> paths;
+	std::vector<FileProbe> probes;	// empty if the files were not probed
+};
+
+//------------------------------------------------------------------------
+void SKIComponent::onXferToPoolJob (CommandArguments& args, string& result)
+{
+	if (!args.project->getMediaPool())
+	{
+		result.append("Access to pool failed");
+		return;
+	}
+
+	uint32 id = jobs.add (new XferToPoolJob (this, args.project, args.tokens, args.probes));
+	result.append ("ok\t" + to_string (id));
+}
+
+//------------------------------------------------------------------------
+// job status <tab> id: ok <tab> state <tab> done <tab> total <tab> result
+void SKIComponent::onJobStatus (CommandArguments& args, string& result)
+{
+	Job* job = findJob (args, result);
+	if (!job)
+		return;
+
+	result.append ("ok\t");
+	result.append (Job::getStateName (job->getState ()));
+	result.append ("\t" + to_string (job->countDone ()) + "\t" + to_string (job->countTotal ()) + "\t");
+	result.append (job->getResult ());
+}
+
+//------------------------------------------------------------------------
+void SKIComponent::onJobCancel (CommandArguments& args, string& result)
+{
+	Job* job = findJob (args, result);
+	if (!job)
+		return;
+
+	if (jobs.cancel (job->getId ()))
+		result.append ("ok");
+	else
+		result.append ("Job already finished");
+}
+
+//------------------------------------------------------------------------
+Job* SKIComponent::findJob (CommandArguments& args, string& result)
+{
+	unsigned int id = 0;
+	const char* problem = "missing";
+	if (args.tokens.size () >= 2)
+		problem = strutil::parseNumber (args.tokens[1], id);
+	if (problem)
+	{
+		result.append ("Invalid job id: ");
+		result.append (problem);
+		return 0;
+	}
+
+	Job* job = jobs.find (id);
+	if (!job)
+		result.append ("Unknown job " + to_string (id));
+	return job;
+}
+
+//------------------------------------------------------------------------
+FIDString SKIComponent::transferToPool (IProject* project, std::string_view pathString, const FileProbe* probe)
+{
+	IMediaPool *pool = project->getMediaPool();
+	if (!pool)
+		return "Access to pool failed";
+
+	MediaPoolIndex& index = poolIndexes[project];
+	index.update(pool);
+	if (index.contains(pathString))
+	{
+		//File already exists in pool
+		return 0;
+	}
+	if (probe && probe->error)
+		return probe->error;
+
+	// Add file to pool
+	IAudioClip* clip = HOST_NEW (IAudioClip);
+	if (!clip)
+		return "Couldn't create audio clip";
+
+	FIDString problem = 0;
+	FUnknownPtr<IMedium> medium(clip);
+	IPath* path = 0;
+	if (medium)
+		path = HOST_NEW (IPath);
+	if (!path)
+		problem = "Couldn't create audio clip";
+	else
+	{
+		u16string name = toUtf16(pathString);
+		path->setFullPath((const tchar*)name.c_str(), 0);
+		medium->setFilePath(path);
+		path->release ();
+
+		if (pool->addMedium(medium) != kResultOk)
+			problem = "Couldn't add media to pool";
+	}
+
+	// the pool and the index keep their own references
+	if (!problem)
+	{
+		index.add(pathString, medium);
+		if (peakBuilder)
+			peakBuilder->add(string(pathString));
+	}
+	clip->release ();
+	return problem;
+}
 
 //------------------------------------------------------------------------------
 tresult PLUGIN_API SKIComponent::terminate ()
@@ -361,6 +781,13 @@ tresult PLUGIN_API SKIComponent::terminate ()
 
 	PipeMessageHandler::instance ()->setShuttingDown ();
 
+	poolIndexes.clear ();
+	trackIndexes.clear ();
+
+	// stops the peak files being built, they are started over next time
+	delete peakBuilder;
+	peakBuilder = 0;
+
 	char c[] = "SKI plugin stopped";
 	SendAcknowledge(SKI_PLG_STOPPED, c); // ack: project added
 
@@ -377,9 +804,12 @@ tresult PLUGIN_API SKIComponent::terminate ()
 		if (actionManager)
 			actionManager->removeActionHandler (this);
 
-		FInstancePtr<IPlatform> platform (hostClasses);
 		if (platform)
+		{
 			platform->removeIdleHandler (this);
+			platform->release ();
+			platform = 0;
+		}
 	}
 
 	
@@ -396,6 +826,10 @@ tresult PLUGIN_API SKIComponent::terminate ()
 void PLUGIN_API SKIComponent::onIdle ()
 {
 	// do any low priority peridic tasks here
+	processCommands (PIPE_DRAIN_TIME);
+
+	if (jobs.hasRunningJobs ())
+		jobs.run (JOB_SLICE_TIME);
 }
 
 
@@ -493,21 +927,7 @@ tresult SKIComponent::openTestWindow (bool checkOnly)
 void SKIComponent::projectAdded (IProject* project)
 {
 	string message = "No active persistent project";
-
-	char buffer[1024], out[1024];
-	memset(buffer, 0, sizeof(buffer));
-	IPath *path = project->getProjectPath();
-	if (path)
-	{
-		path->getFullPath((tchar *)buffer);
-		int count = WideCharToMultiByte(CP_UTF8, 0, (LPCWSTR)buffer, -1, 0, 0, 0, 0);
-		if (count > 0)
-		{
-			WideCharToMultiByte(CP_UTF8, 0, (LPCWSTR)buffer, -1, out, count, 0, 0);
-			out[count] = 0; // make the string null-terminated
-			message = out;
-		}
-	}
+	getProjectPathString (project, message);
 	SendAcknowledge(SKI_PRJ_ADDED, message.c_str()); // ack: project added
 
 	project->registerStorageNotification (this);
@@ -518,24 +938,14 @@ void SKIComponent::projectRemoved (IProject* project)
 {
 	//static char m_SKIProject_Removed[2048];
 	string message = "No active persistent project";
-
-	char buffer[1024], out[1024];
-	memset(buffer, 0, sizeof(buffer));
-	IPath *path = project->getProjectPath();
-	if (path)
-	{
-		path->getFullPath((tchar *)buffer);
-		int count = WideCharToMultiByte(CP_UTF8, 0, (LPCWSTR)buffer, -1, 0, 0, 0, 0);
-		if (count > 0)
-		{
-			WideCharToMultiByte(CP_UTF8, 0, (LPCWSTR)buffer, -1, out, count, 0, 0);
-			out[count] = 0; // make the string null-terminated
-			message = out;
-		}
-	}
+	getProjectPathString (project, message);
 
 	SendAcknowledge(SKI_PRJ_REMOVED, message.c_str()); // ack: project removed
+	PipeMessageHandler::instance ()->setCachedProjectPath (0);
 
+	jobs.cancelProject (project);
+	poolIndexes.erase (project);
+	trackIndexes.erase (project);
 	project->unregisterStorageNotification (this);
 }
 
@@ -549,23 +959,10 @@ tresult SKIComponent::canProjectClose (IProject* project)
 void SKIComponent::projectActivated (IProject* project)
 {
 	string message = "No active persistent project";
-
-	char buffer[1024], out[1024];
-	memset(buffer, 0, sizeof(buffer));
-	IPath *path = project->getProjectPath();
-	if (path)
-	{
-		path->getFullPath((tchar *)buffer);
-		int count = WideCharToMultiByte(CP_UTF8, 0, (LPCWSTR)buffer, -1, 0, 0, 0, 0);
-		if (count > 0)
-		{
-			WideCharToMultiByte(CP_UTF8, 0, (LPCWSTR)buffer, -1, out, count, 0, 0);
-			out[count] = 0; // make the string null-terminated
-			message = out;
-		}
-	}
+	getProjectPathString (project, message);
 
 	SendAcknowledge(SKI_PRJ_ACTIVATED, message.c_str()); // ack: project activated
+	PipeMessageHandler::instance ()->setCachedProjectPath (message.c_str ());
 }
 
 //------------------------------------------------------------------------------
@@ -573,23 +970,13 @@ void SKIComponent::projectDeactivated (IProject* project)
 {
 	//static char m_SKIProject_Deactivated[2048];
 	string message = "No active persistent project";
-
-	char buffer[1024], out[1024];
-	memset(buffer, 0, sizeof(buffer));
-	IPath *path = project->getProjectPath();
-	if (path)
-	{
-		path->getFullPath((tchar *)buffer);
-		int count = WideCharToMultiByte(CP_UTF8, 0, (LPCWSTR)buffer, -1, 0, 0, 0, 0);
-		if (count > 0)
-		{
-			WideCharToMultiByte(CP_UTF8, 0, (LPCWSTR)buffer, -1, out, count, 0, 0);
-			out[count] = 0; // make the string null-terminated
-			message = out;
-		}
-	}
+	getProjectPathString (project, message);
 
 	SendAcknowledge(SKI_PRJ_DEACTIVATED, message.c_str()); // ack: project deactivated
+	PipeMessageHandler::instance ()->setCachedProjectPath (0);
+
+	poolIndexes.erase (project);
+	trackIndexes.erase (project);
 
 	// save the state to able to restore it when the project is reactivated
 	storeSetup (project);
@@ -601,21 +988,7 @@ void SKIComponent::beforeProjectActivation (IProject* project)
 	restoreSetup (project);
 
 	string message = "No active persistent project";
-
-	char buffer[1024], out[1024];
-	memset(buffer, 0, sizeof(buffer));
-	IPath *path = project->getProjectPath();
-	if (path)
-	{
-		path->getFullPath((tchar *)buffer);
-		int count = WideCharToMultiByte(CP_UTF8, 0, (LPCWSTR)buffer, -1, 0, 0, 0, 0);
-		if (count > 0)
-		{
-			WideCharToMultiByte(CP_UTF8, 0, (LPCWSTR)buffer, -1, out, count, 0, 0);
-			out[count] = 0; // make the string null-terminated
-			message = out;
-		}
-	}
+	getProjectPathString (project, message);
 
 	SendAcknowledge(SKI_PRJ_ACTIVATED, message.c_str()); // ack: project activated
 }
@@ -623,25 +996,16 @@ void SKIComponent::beforeProjectActivation (IProject* project)
 //------------------------------------------------------------------------------
 void SKIComponent::beforeProjectSaved (IProject* project)
 {
-	char buffer[1024], out[1024];
-	memset(buffer, 0, sizeof(buffer));
-	IPath *path = project->getProjectPath();
 	string message = "No active persistent project";
-
-	if (path)
-	{
-		path->getFullPath((tchar *)buffer);
-		int count = WideCharToMultiByte(CP_UTF8, 0, (LPCWSTR)buffer, -1, 0, 0, 0, 0);
-		if (count > 0)
-		{
-			WideCharToMultiByte(CP_UTF8, 0, (LPCWSTR)buffer, -1, out, count, 0, 0);
-			out[count] = 0; // make the string null-terminated
-			message = out;
-		}
-	}
+	getProjectPathString (project, message);
 
 	SendAcknowledge(SKI_PRJ_ACTIVATED, message.c_str()); // ack: project activated
 
+	// saving may copy or move media into the project folder, or the
+	// project itself
+	PipeMessageHandler::instance ()->setCachedProjectPath (0);
+	poolIndexes.erase (project);
+	trackIndexes.erase (project);
 	storeSetup (project);
 }
 
@@ -651,7 +1015,8 @@ int32 PLUGIN_API SKIComponent::notifyMessage( IMessage* message )
 	if (!message)
 		return kMessageUnknown;
 
-	ReadMessage (message->getString8 ("Command"));
+	// the wakeup posted by PipeMessageHandler
+	processCommands (PIPE_DRAIN_TIME);
 	return kMessageNotified;
 }
 
@@ -707,60 +1072,349 @@ void SKIComponent::restoreSetup (IProject* project)
 //------------------------------------------------------------------------------
 FIDString SKIComponent::insertFile (InsertPackage& package)
 {
-	OPtr<IPath> path = HOST_NEW (IPath);
-	if (path)
-		path->setFullPath (package.pathString.text (), IPath::kIPFile);
-
 	IProject* project = projectInfo->getActiveProject();
 	ASSERT (project)
 
 	// Find Medium or create new one
+	InsertBatch batch (hostClasses, project, poolIndexes[project]);
+	IAudioClip* clip = 0;
+	FIDString result = batch.resolveClip (package.pathString, clip);
+	if (result)
+		return result;
+
+	// Find selected AudioEvent
+	AudioTrackIndex& audioTracks = trackIndexes[project];
+	audioTracks.update (project, package.trackOffset + 1);
+	IProjectObject* firstSelectedAudioTrack = audioTracks.getDestination (package.trackOffset);
+	if (!firstSelectedAudioTrack)
+		return "No audio track selected or no audio track available";
+
+	// Create Event and insert into project
+	result = batch.addEvent (firstSelectedAudioTrack, clip, package, getCursorPosition () + package.cursorOffset);
+	if (result)
+		return result;
+	batch.finish (STR ("Insert File from BaseHead"));
+	if (peakBuilder)
+		peakBuilder->add (batch.getAddedMedia ());
+
+	return "ok";
+}
+
+//------------------------------------------------------------------------------
+// How many tracks from the first selected one on the packages go to
+static uint32 countTrackSpan (const std::vector<InsertPackage>& packages)
+{
+	uint32 span = 0;
+	for (uint32 i = 0; i < packages.size (); i++)
+	{
+		if (packages[i].trackOffset >= span)
+			span = packages[i].trackOffset + 1;
+	}
+	return span;
+}
+
+//------------------------------------------------------------------------------
+// Inserts all packages as one undo step. report gets one line per package,
+// in order: "ok" or the reason it was skipped.
+void SKIComponent::insertFiles (std::vector<InsertPackage>& packages, string& report)
+{
+	IProject* project = projectInfo->getActiveProject();
+	ASSERT (project)
+
+	InsertBatch batch (hostClasses, project, poolIndexes[project]);
+	std::vector<IAudioClip*> clips (packages.size (), 0);
+	std::vector<FIDString> results (packages.size (), 0);
+
+	// all pool media first, the edit below only collects events
+	for (uint32 i = 0; i < packages.size (); i++)
+		results[i] = batch.resolveClip (packages[i].pathString, clips[i]);
+
+	AudioTrackIndex& audioTracks = trackIndexes[project];
+	audioTracks.update (project, countTrackSpan (packages));
+	double cursorPosition = getCursorPosition ();
+	for (uint32 i = 0; i < packages.size (); i++)
+	{
+		if (results[i])
+			continue;
+
+		IProjectObject* track = audioTracks.getDestination (packages[i].trackOffset);
+		if (!track)
+		{
+			results[i] = "No audio track selected or no audio track available";
+			continue;
+		}
+		results[i] = batch.addEvent (track, clips[i], packages[i], cursorPosition + packages[i].cursorOffset);
+	}
+
+	batch.finish (STR ("Insert Files from BaseHead"));
+	if (peakBuilder)
+		peakBuilder->add (batch.getAddedMedia ());
+
+	for (uint32 i = 0; i < results.size (); i++)
+	{
+		if (i > 0)
+			report.append ("\n");
+		report.append (results[i] ? results[i] : "ok");
+	}
+}
+
+//------------------------------------------------------------------------------
+// Like insertFiles (), but each file goes to its BWF time reference minus
+// projectStart instead of the cursor; cursorOffset and inTime shift it
+// from there. All positions come from the file headers before the first
+// medium is resolved, so a file that cannot be spotted is not added to
+// the pool either.
+void SKIComponent::spotFiles (std::vector<InsertPackage>& packages, double projectStart, string& report)
+{
+	IProject* project = projectInfo->getActiveProject();
+	ASSERT (project)
+
+	std::vector<double> positions (packages.size (), 0.0);
+	std::vector<FIDString> results (packages.size (), 0);
+	for (uint32 i = 0; i < packages.size (); i++)
+	{
+		std::string path;
+		AudioFileInfo info;
+		utf16ToUtf8 ((const char16_t*)packages[i].pathString.text (), path);
+		results[i] = CAudioInfoCache::shared ().getInfo (path, info);
+		if (results[i])
+			continue;
+		if (!info.bHasTimeReference)
+		{
+			results[i] = "File has no BWF time reference";
+			continue;
+		}
+
+		// the time reference counts samples at the file's own rate
+		double inTime = packages[i].inTime > 0.0 ? packages[i].inTime : 0.0;
+		positions[i] = info.getTimeReference () + inTime - projectStart + packages[i].cursorOffset;
+		if (positions[i] < 0.0)
+			results[i] = "Time reference is before the project start";
+	}
+
+	InsertBatch batch (hostClasses, project, poolIndexes[project]);
+	std::vector<IAudioClip*> clips (packages.size (), 0);
+	for (uint32 i = 0; i < packages.size (); i++)
+	{
+		if (!results[i])
+			results[i] = batch.resolveClip (packages[i].pathString, clips[i]);
+	}
+
+	AudioTrackIndex& audioTracks = trackIndexes[project];
+	audioTracks.update (project, countTrackSpan (packages));
+	for (uint32 i = 0; i < packages.size (); i++)
+	{
+		if (results[i])
+			continue;
+
+		IProjectObject* track = audioTracks.getDestination (packages[i].trackOffset);
+		if (!track)
+		{
+			results[i] = "No audio track selected or no audio track available";
+			continue;
+		}
+		results[i] = batch.addEvent (track, clips[i], packages[i], positions[i]);
+	}
+
+	batch.finish (STR ("Spot Files from BaseHead"));
+	if (peakBuilder)
+		peakBuilder->add (batch.getAddedMedia ());
+
+	for (uint32 i = 0; i < results.size (); i++)
+	{
+		if (i > 0)
+			report.append ("\n");
+		report.append (results[i] ? results[i] : "ok");
+	}
+}
+
+//------------------------------------------------------------------------------
+// Like insertFiles (), with the track of each file picked by layout. New
+// tracks get the channel count of their file and go behind the last
+// destination track; each is its own undo step before the events.
+void SKIComponent::distributeFiles (std::vector<InsertPackage>& packages, TrackLayout layout, uint32 trackCount, string& report)
+{
+	IProject* project = projectInfo->getActiveProject();
+	ASSERT (project)
+
+	InsertBatch batch (hostClasses, project, poolIndexes[project]);
+	std::vector<IAudioClip*> clips (packages.size (), 0);
+	std::vector<FIDString> results (packages.size (), 0);
+	for (uint32 i = 0; i < packages.size (); i++)
+		results[i] = batch.resolveClip (packages[i].pathString, clips[i]);
+
+	AudioTrackIndex& audioTracks = trackIndexes[project];
+	audioTracks.update (project);
+	uint32 destinations = (uint32)audioTracks.countDestinations ();
+	if (trackCount == 0 || trackCount > destinations)
+		trackCount = destinations;
+
+	double cursorPosition = getCursorPosition ();
+	uint32 fileIndex = 0;	// counts the files that made it this far, so none leaves a gap
+	for (uint32 i = 0; i < packages.size (); i++)
+	{
+		if (results[i])
+			continue;
+
+		IProjectObject* track = 0;
+		if (layout == kRoundRobinTracks)
+			track = trackCount > 0 ? audioTracks.getDestination (fileIndex % trackCount) : 0;
+		else
+			track = audioTracks.getDestination (fileIndex);
+
+		if (!track && layout == kCreateTracks)
+		{
+			int32 channels = 0;
+			std::string path;
+			AudioFileInfo info;
+			utf16ToUtf8 ((const char16_t*)packages[i].pathString.text (), path);
+			if (CAudioInfoCache::shared ().getInfo (path, info) == 0)
+				channels = info.nChannels;
+			else if (IAudioStream* audioStream = clips[i]->getIAudioStream ())
+				channels = audioStream->getChannels ();
+			IProjectObject* lastTrack = destinations > 0 ? audioTracks.getDestination (destinations - 1) : 0;
+			track = batch.addAudioTrack (channels > 0 ? channels : 1, lastTrack);
+			if (!track)
+			{
+				results[i] = "Audio track cannot be created";
+				continue;
+			}
+		}
+		if (!track)
+		{
+			results[i] = "No audio track selected or no audio track available";
+			continue;
+		}
+
+		results[i] = batch.addEvent (track, clips[i], packages[i], cursorPosition + packages[i].cursorOffset);
+		fileIndex++;
+	}
+
+	batch.finish (STR ("Distribute Files from BaseHead"));
+	if (layout == kCreateTracks)
+		audioTracks.clear ();	// the new tracks are not in it
+	if (peakBuilder)
+		peakBuilder->add (batch.getAddedMedia ());
+
+	for (uint32 i = 0; i < results.size (); i++)
+	{
+		if (i > 0)
+			report.append ("\n");
+		report.append (results[i] ? results[i] : "ok");
+	}
+}
+
+//------------------------------------------------------------------------------
+double SKIComponent::getCursorPosition ()
+{
+	OPtr<ITransportDevice> transportDevice = HOST_NEW (ITransportDevice);
+	if (transportDevice)
+		return transportDevice->getDisplayPosition ();
+	return 0.0;
+}
+
+//------------------------------------------------------------------------
+InsertBatch::InsertBatch (IHostClasses* hostClasses, IProject* project, MediaPoolIndex& poolIndex)
+: hostClasses (hostClasses)
+, project (project)
+, poolIndex (poolIndex)
+, edit (0)
+, eventCount (0)
+{
+	edit = HOST_NEW (IProjectEdit);
+	if (edit)
+		edit->setEditMode (IProjectEdit::kBulkMode);
+}
+
+//------------------------------------------------------------------------
+InsertBatch::~InsertBatch ()
+{
+	for (uint32 i = 0; i < trackContexts.size (); i++)
+		trackContexts[i].second->release ();
+	for (uint32 i = 0; i < clips.size (); i++)
+		clips[i]->release ();
+	for (uint32 i = 0; i < addedTracks.size (); i++)
+		addedTracks[i]->release ();
+	if (edit)
+		edit->release ();
+}
+
+//------------------------------------------------------------------------
+FIDString InsertBatch::resolveClip (const String& pathString, IAudioClip*& clip /*out*/)
+{
+	clip = 0;
+
 	IMediaPool* pool = project->getMediaPool ();
 	if (!pool)
 		return "Access to pool failed";
+
+	std::string key;
+	utf16ToUtf8 ((const char16_t*)pathString.text (), key);
+	poolIndex.update (pool);
 	
-	FUnknownPtr<IAudioClip> clip;
-	IMedium* medium = pool->getMediumByPath (path);
+	FUnknownPtr<IAudioClip> audioClip;
+	IMedium* medium = poolIndex.find (key);
 	if (medium)
 	{
-		clip = medium;
+		audioClip = medium;
 	}
 	if (!medium)
 	{
-		clip = HOST_NEW (IAudioClip);
-		if (clip)
+		OPtr<IPath> path = HOST_NEW (IPath);
+		if (path)
+			path->setFullPath (pathString.text (), IPath::kIPFile);
+
+		audioClip = HOST_NEW (IAudioClip);
+		if (audioClip)
 		{
-			FUnknownPtr<IMedium> newMedium (clip);
+			FUnknownPtr<IMedium> newMedium (audioClip);
 			if (newMedium)
 			{
 				newMedium ->setFilePath (path);
 				medium = newMedium;
-				pool->addMedium (medium);
+				if (pool->addMedium (medium) == kResultOk)
+				{
+					poolIndex.add (key, medium);
+					addedMedia.push_back (key);
+				}
 			}
 		}
 	}
-	if (!medium)
+	if (!medium || !audioClip)
 		return "No pool medium can be created";
 
-	// Find selected AudioEvent
-	FUnknownPtr<IProjectObject> projectAsObject (project);
-	if (!projectAsObject)
-		return "Fail";
-	
-	IProjectObject* firstSelectedAudioTrack = findDestinationAudioTrack (projectAsObject, package.trackOffset);
-	if (!firstSelectedAudioTrack)
-		return "No audio track selected or no audio track available";
-
-	// Get cursor time
-	double insertTime = package.cursorOffset;
-	OPtr<ITransportDevice> transportDevice = HOST_NEW (ITransportDevice);
-	if (transportDevice)
-		insertTime += transportDevice->getDisplayPosition ();
+	// kept alive until the batch is finished
+	audioClip->addRef ();
+	clips.push_back (audioClip);
+	clip = audioClip;
+	return 0;
+}
 
+//------------------------------------------------------------------------
+FIDString InsertBatch::addEvent (IProjectObject* track, IAudioClip* clip, const InsertPackage& package, double insertTime)
+{
+	if (!edit)
+		return "Undo Object cannot be created";
 
-	// Create Event and insert into project
+	IProjectContext* trackContext = getTrackContext (track);
+	if (!trackContext)
+		return "Track context cannot be created";
+
+	// keep the event within the file, its length is known from the
+	// header without asking the host for the clip's audio stream
+	double length = package.length;
+	std::string path;
+	AudioFileInfo info;
+	utf16ToUtf8 ((const char16_t*)package.pathString.text (), path);
+	if (CAudioInfoCache::shared ().getInfo (path, info) == 0 && info.getDuration () > 0.0)
+	{
+		double available = info.getDuration () - (package.inTime > 0.0 ? package.inTime : 0.0);
+		if (available <= 0.0)
+			return "In time is beyond the end of the file";
+		if (length > available)
+			length = available;
+	}
 
-	OPtr<IProjectContext> trackContext = project->createContext (firstSelectedAudioTrack);
 	IAudioEvent* audioEvent = HOST_NEW (IAudioEvent);
 	FUnknownPtr<IProjectObject> audioObj (audioEvent);
 	if (!audioEvent || !audioObj)
@@ -770,69 +1424,167 @@ FIDString SKIComponent::insertFile (InsertPackage& package)
 	audioObj->setStartPosition (trackContext, insertTime);
 	if (package.inTime > 0.0)
 		audioObj->setDataOffset (trackContext, package.inTime);
-	if (package.length > 0.0)
-		audioObj->setEndPosition (trackContext, insertTime+package.length);
+	if (length > 0.0)
+		audioObj->setEndPosition (trackContext, insertTime+length);
 	if (!package.description.isEmpty ())
 		audioEvent->setDescription (trackContext, package.description.text ());
 	audioObj->setSelected (trackContext, true);
 
-	OPtr<IProjectEdit> edit = HOST_NEW (IProjectEdit);
-	if (!edit)
-		return "Undo Object cannot be created";
-	edit->setEditMode (IProjectEdit::kBulkMode);
 	edit->insertObject (trackContext, audioEvent);
-	edit->finish (project, STR ("Insert File from BaseHead"));
+	eventCount++;
+	return 0;
+}
 
-	return "ok";
+//------------------------------------------------------------------------
+void InsertBatch::finish (const tchar* description)
+{
+	if (edit && eventCount > 0)
+		edit->finish (project, description);
 }
 
-//------------------------------------------------------------------------------
-IProjectObject* SKIComponent::findDestinationAudioTrack (IProjectObject* parent, uint32 trackOffset)
+//------------------------------------------------------------------------
+IProjectObject* InsertBatch::addAudioTrack (int32 channels, IProjectObject* after)
 {
-	int32 counter = -1;
-	return findDestinationAudioTrack (parent, trackOffset, counter);
+	if (!edit)
+		return 0;
+	if (!addedTracks.empty ())
+		after = addedTracks.back ();
+
+	ITrack* track = project->createTrack (kAudioObject);
+	if (!track)
+		return 0;
+	FReleaser trackRel (track);
+	FUnknownPtr<IProjectObject> trackObject (track);
+	if (!trackObject)
+		return 0;
+
+	// mono/stereo/surround before the first event is added
+	FUnknownPtr<IAudioTrack> audioTrack (track);
+	if (audioTrack)
+		audioTrack->initializeStreamCount (channels);
+
+	// the folder of after takes the track at its end
+	IProjectObject* parent = after ? after->getParentObject () : 0;
+	IProjectContext* context = parent ? project->createContext (parent) : project->createContext ();
+	FReleaser contextRel (context);
+	IProjectEdit* trackEdit = HOST_NEW (IProjectEdit);
+	FReleaser trackEditRel (trackEdit);
+	if (!context || !trackEdit)
+		return 0;
+
+	// like projectTest1 (): the track has to be in the project before a
+	// context on it can take events
+	trackEdit->setEditMode (IProjectEdit::kImmediateMode);
+	trackEdit->insertObject (context, track);
+	trackEdit->finish (project, STR ("Add Audio Track"));
+
+	trackObject->addRef ();
+	addedTracks.push_back (trackObject);
+	return trackObject;
 }
 
-//------------------------------------------------------------------------------
-IProjectObject* SKIComponent::findDestinationAudioTrack (IProjectObject* parent, uint32 trackOffset, int32& counter)
+//------------------------------------------------------------------------
+// one context per track, they have to live until the edit is finished
+IProjectContext* InsertBatch::getTrackContext (IProjectObject* track)
+{
+	for (uint32 i = 0; i < trackContexts.size (); i++)
+	{
+		if (trackContexts[i].first == track)
+			return trackContexts[i].second;
+	}
+
+	IProjectContext* context = project->createContext (track);
+	if (context)
+		trackContexts.push_back (std::make_pair (track, context));
+	return context;
+}
+
+//------------------------------------------------------------------------
+AudioTrackIndex::AudioTrackIndex ()
+: firstSelected (-1)
+, complete (false)
+, indexedProject (0)
+{
+}
+
+//------------------------------------------------------------------------
+AudioTrackIndex::~AudioTrackIndex ()
+{
+	clear ();
+}
+
+//------------------------------------------------------------------------
+void AudioTrackIndex::update (IProject* project, uint32 destinations)
+{
+	if (isCurrent (project, destinations))
+		return;
+
+	clear ();
+	FUnknownPtr<IProjectObject> projectAsObject (project);
+	if (projectAsObject)
+		complete = collect (projectAsObject, destinations);
+	indexedProject = project;
+}
+
+//------------------------------------------------------------------------
+bool AudioTrackIndex::isCurrent (IProject* project, uint32 destinations) const
+{
+	if (project != indexedProject || firstSelected < 0)
+		return false;
+	if (!complete && (destinations == 0 || tracks.size () - firstSelected < destinations))
+		return false;
+
+	IProjectObject* track = tracks[firstSelected];
+	return track->isSelected () && track->isObjectType (kAudioObject);
+}
+
+//------------------------------------------------------------------------
+void AudioTrackIndex::clear ()
+{
+	for (uint32 i = 0; i < tracks.size (); i++)
+		tracks[i]->release ();
+	tracks.clear ();
+	firstSelected = -1;
+	complete = false;
+	indexedProject = 0;
+}
+
+//------------------------------------------------------------------------
+IProjectObject* AudioTrackIndex::getDestination (uint32 trackOffset) const
+{
+	if (firstSelected < 0 || trackOffset >= tracks.size () - firstSelected)
+		return 0;
+	return tracks[firstSelected + trackOffset];
+}
+
+//------------------------------------------------------------------------
+// Returns false if it stopped because destinations tracks were found
+bool AudioTrackIndex::collect (IProjectObject* parent, uint32 destinations)
 {
 	OPtr<IProjectIterator> iter = parent->createIterator ();
-	if (iter)
+	if (!iter)
+		return true;
+
+	while (!iter->done ())
 	{
-		while (!iter->done ())
+		IProjectObject* subObject = iter->getNextObject ();
+		if (!subObject)
+			continue;
+
+		if (subObject->isObjectType (kFolderObject) && !collect (subObject, destinations))
+			return false;
+		if (subObject->isObjectType (kAudioObject))
 		{
-			IProjectObject* subObject = iter->getNextObject ();
-			if (subObject)
-			{
-				if (subObject->isObjectType (kFolderObject))
-				{
-					IProjectObject* result = findDestinationAudioTrack (subObject, trackOffset, counter);
-					if (result)
-						return result;
-				}
-				if (subObject->isObjectType (kAudioObject))
-				{
-					if (counter < 0)
-					{
-						if (subObject->isSelected ())
-						{
-							counter = 0;
-							if (trackOffset == 0)
-								return subObject;
-						}
-					}
-					else
-					{
-						counter++;
-						if (counter == trackOffset)
-							return subObject;
-					}
-					
-				}
-			}
+			if (firstSelected < 0 && subObject->isSelected ())
+				firstSelected = (int32)tracks.size ();
+			subObject->addRef ();
+			tracks.push_back (subObject);
+
+			if (destinations > 0 && firstSelected >= 0 && tracks.size () - firstSelected >= destinations)
+				return false;
 		}
 	}
-	return 0;
+	return true;
 }
 
 //------------------------------------------------------------------------
@@ -845,7 +1597,9 @@ InsertPackage::InsertPackage ()
 }
 
 //------------------------------------------------------------------------
-void InsertPackage::parseTokens (std::vector<string>& tokens )
+// Numbers are parsed independent of the system locale. Returns false and
+// fills error if a numeric token is malformed.
+bool InsertPackage::parseTokens (const strutil::TokenList& tokens, std::string& error)
 {
 #if DEVELOPMENT
 	pathString = "c:\\fun\\Gitarre - Riff1.wav";
@@ -855,31 +1609,73 @@ void InsertPackage::parseTokens (std::vector<string>& tokens )
 	inTime = 0.5;
 	//outTime = 2;
 #else
-	String tempString;
-
 	if (tokens.size () >= 2)
-		pathString = tokens[1].c_str();
+		pathString = (const char16*)toUtf16 (tokens[1]).c_str ();
 	if (tokens.size () >= 3)
-		description = tokens[2].c_str();
-	if (tokens.size () >= 4)
+		description = (const char16*)toUtf16 (tokens[2]).c_str ();
+
+	const char* problem = 0;
+	const char* field = 0;
+	if (tokens.size () >= 4 && (problem = strutil::parseNumber (tokens[3], trackOffset)) != 0)
+		field = "track offset";
+	else if (tokens.size () >= 5 && (problem = strutil::parseNumber (tokens[4], cursorOffset)) != 0)
+		field = "cursor offset";
+	else if (tokens.size () >= 6 && (problem = strutil::parseNumber (tokens[5], inTime)) != 0)
+		field = "in time";
+	else if (tokens.size () >= 7 && (problem = strutil::parseNumber (tokens[6], length)) != 0)
+		field = "length";
+
+	if (problem)
 	{
-		tempString = tokens[3].c_str();
-		tempString.scanUInt32 (trackOffset);
-	}
-	if (tokens.size () >= 5)
-	{
-		tempString = tokens[4].c_str();
-		tempString.scanFloat (cursorOffset);
-	}
-	if (tokens.size () >= 6)
-	{
-		tempString = tokens[5].c_str();
-		tempString.scanFloat (inTime);
+		error = string ("Invalid ") + field + ": " + problem;
+		return false;
 	}
-	if (tokens.size () >= 7)
+#endif
+	return true;
+}
+
+//------------------------------------------------------------------------
+// Binary form of parseTokens: the command name, then the arguments as read
+// by parseArguments.
+bool InsertPackage::parseFields (CPipeFieldReader& reader)
+{
+	PipeField field;
+	if (!reader.next (field))	// command name
+		return false;
+	return parseArguments (reader, false);
+}
+
+//------------------------------------------------------------------------
+// Path and description as string8 or string16, trackOffset as uint32 and
+// the three times as float64. Unless complete is set, trailing fields may
+// be left out.
+bool InsertPackage::parseArguments (CPipeFieldReader& reader, bool complete)
+{
+	PipeField field;
+	for (int32 i = 0; i < 6; i++)
 	{
-		tempString = tokens[6].c_str();
-		tempString.scanFloat (length);
+		if (!reader.next (field))
+			return !complete && reader.isValid ();
+
+		bool valid = false;
+		u16string text;
+		switch (i)
+		{
+			case 0:
+				valid = field.getString16 (text);
+				pathString = (const char16*)text.c_str ();
+				break;
+			case 1:
+				valid = field.getString16 (text);
+				description = (const char16*)text.c_str ();
+				break;
+			case 2: valid = field.getUInt32 (trackOffset); break;
+			case 3: valid = field.getFloat64 (cursorOffset); break;
+			case 4: valid = field.getFloat64 (inTime); break;
+			case 5: valid = field.getFloat64 (length); break;
+		}
+		if (!valid)
+			return false;
 	}
-#endif
+	return true;
 }
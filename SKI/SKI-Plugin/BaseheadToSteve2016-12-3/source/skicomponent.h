@@ -20,13 +20,26 @@
 #include "base/source/fobject.h"
 #include "base/source/fstring.h"
 
+#include "strutil.h"
+#include "PoolIndex.h"
+#include "JobList.h"
+#include "FileProbe.h"
 #include <vector>
+#include <map>
 
 
 class SKIDialogController;
+class CPipeFieldReader;
+class CPeakBuilder;
+struct PipeRequest;
 namespace Steinberg {
 class IHostClasses;
 class IProjectObject;
+class IProject;
+class IProjectContext;
+class IProjectEdit;
+class IAudioClip;
+class IPlatform;
 }
 using namespace Steinberg;
 
@@ -43,7 +56,98 @@ struct InsertPackage
 
 	InsertPackage ();
 
-	void parseTokens (std::vector<std::string>& tokens);
+	bool parseTokens (const strutil::TokenList& tokens, std::string& error);
+	bool parseFields (CPipeFieldReader& reader);
+	bool parseArguments (CPipeFieldReader& reader, bool complete);
+};
+
+//------------------------------------------------------------------------
+// Inserts the events of any number of packages with one bulk mode
+// IProjectEdit, so they end up as a single undo step. Pool media should
+// be resolved for all packages before the first event is added.
+//------------------------------------------------------------------------
+class InsertBatch
+{
+public:
+	InsertBatch (IHostClasses* hostClasses, IProject* project, MediaPoolIndex& poolIndex);
+	~InsertBatch ();
+
+	// Finds the pool medium of path in poolIndex or adds a new one;
+	// returns 0 on success
+	FIDString resolveClip (const String& path, IAudioClip*& clip /*out*/);
+
+	// Adds an event for clip at insertTime; returns 0 on success
+	FIDString addEvent (IProjectObject* track, IAudioClip* clip, const InsertPackage& package, double insertTime);
+
+	// Adds a new audio track with channels streams behind after (in its
+	// folder), or behind the track added before, or at the end of the
+	// project. The track is inserted right away, as its own undo step,
+	// since events can only go into a track that is in the project.
+	// 0 if it cannot be created.
+	IProjectObject* addAudioTrack (int32 channels, IProjectObject* after);
+
+	int32 countEvents () const { return eventCount; }
+
+	// UTF-8 paths of the media resolveClip () added to the pool
+	const std::vector<std::string>& getAddedMedia () const { return addedMedia; }
+
+	// Commits all added events as one undo step named description
+	void finish (const tchar* description);
+
+protected:
+	IProjectContext* getTrackContext (IProjectObject* track);
+
+	IHostClasses* hostClasses;
+	IProject* project;
+	MediaPoolIndex& poolIndex;
+	IProjectEdit* edit;
+	std::vector<IAudioClip*> clips;
+	std::vector<IProjectObject*> addedTracks;	// referenced, by addAudioTrack ()
+	std::vector<std::string> addedMedia;
+	std::vector<std::pair<IProjectObject*, IProjectContext*> > trackContexts;
+	int32 eventCount;
+};
+
+//------------------------------------------------------------------------
+// The audio tracks of a project in arrangement order, with the tracks of
+// folder tracks flattened in place. SKI reports neither track nor
+// selection changes, so the index is kept across commands only while its
+// first selected track is still selected and still an audio track, and
+// collected again otherwise. Collecting stops once the tracks a command
+// asked for are known. Indexed tracks are referenced until the index is
+// cleared, so the check never touches a deleted track.
+//------------------------------------------------------------------------
+class AudioTrackIndex
+{
+public:
+	AudioTrackIndex ();
+	~AudioTrackIndex ();
+
+	// Makes the index cover the first destinations tracks getDestination ()
+	// can return, or all of them for 0
+	void update (IProject* project, uint32 destinations = 0);
+	void clear ();
+
+	int32 countTracks () const { return (int32)tracks.size (); }
+
+	// The track trackOffset tracks after the first selected audio track,
+	// 0 if none is selected or there are not enough tracks
+	IProjectObject* getDestination (uint32 trackOffset) const;
+
+	// The tracks getDestination () can return, after update (project, 0)
+	int32 countDestinations () const { return firstSelected < 0 ? 0 : (int32)tracks.size () - firstSelected; }
+
+protected:
+	AudioTrackIndex (const AudioTrackIndex&) = delete;
+	AudioTrackIndex& operator= (const AudioTrackIndex&) = delete;
+
+	bool isCurrent (IProject* project, uint32 destinations) const;
+	bool collect (IProjectObject* parent, uint32 destinations);
+
+	std::vector<IProjectObject*> tracks;	// referenced
+	int32 firstSelected;	// index into tracks, -1 if no audio track is selected
+	bool complete;			// tracks holds all audio tracks, not just the first ones
+	IProject* indexedProject;
 };
 
 
@@ -93,15 +197,47 @@ public:
 
 	IHostClasses* getHostClasses ();
 
+	// Adds path to the pool of project unless it is there already;
+	// returns 0 on success. A file the probe found a problem with is not
+	// handed to the host.
+	FIDString transferToPool (IProject* project, std::string_view path, const FileProbe* probe = 0);
+
+	// Renders the fields of a binary command like the tab separated tokens
+	// of its text form, for the commands that do not read the fields directly
+	static bool fieldsToTokens (const PipeRequest& request, std::vector<std::string>& fieldTokens, strutil::TokenList& tokens);
+
 	// CLogFile *m_Log;
-	void ReadMessage(const char *message);
+	void ReadMessage(const char *message, uint32 requestId);
+	void processCommands (int32 maxTime);
+
+	//------------------------------------------------------------------------
+	// What a command handler gets: the command split into tokens (tokens[0]
+	// is the command name) and, for binary commands, the request to read
+	// typed fields from.
+	struct CommandArguments
+	{
+		const char* text;					// as received, or the name of a binary command
+		const PipeRequest* request;
+		bool isBinary;
+		strutil::TokenArray<1024> tokens;	// views into text, or into fieldTokens
+		std::vector<std::string> fieldTokens;	// binary commands only
+		IProject* project;					// active project, never 0
+		const std::vector<FileProbe>* probes;	// one per token after the name, or 0
+	};
+	typedef void (SKIComponent::*CommandHandler) (CommandArguments& args, std::string& result);
 
 	DECLARE_FUNKNOWN_METHODS
 protected:
 	IHostClasses* hostClasses;
 	IProjectInformation* projectInfo;
 	IGuiDescription* guiDescription;
+	IPlatform* platform;
 	SKIDialogController* dialogController;
+	std::vector<CommandHandler> commandHandlers;	// indexed like kCommandNames
+	std::map<IProject*, MediaPoolIndex> poolIndexes;	// shared by all commands, dropped when a project is deactivated or saved
+	std::map<IProject*, AudioTrackIndex> trackIndexes;	// likewise
+	JobList jobs;
+	CPeakBuilder* peakBuilder;		// overviews of the media we add, for BaseHead
 
 	tresult showTestDialog (bool checkOnly);
 	tresult openTestWindow (bool checkOnly);
@@ -110,10 +246,36 @@ protected:
 	void restoreSetup (IProject* project);
 	bool Alone ();
 	void SendAcknowledge (int code, const char *message);
+	void registerCommands ();
+	void registerCommand (const char* name, CommandHandler handler);
+
+	void onInsertFile (CommandArguments& args, std::string& result);
+	void onInsertFiles (CommandArguments& args, std::string& result);
+	void onSpotFiles (CommandArguments& args, std::string& result);
+	void onDistributeFiles (CommandArguments& args, std::string& result);
+	bool parsePackages (CommandArguments& args, int32 leadingFields, std::vector<InsertPackage>& packages, std::string& result);
+	void onProjectPath (CommandArguments& args, std::string& result);
+	void onCursorPosition (CommandArguments& args, std::string& result);
+	void onPoolContains (CommandArguments& args, std::string& result);
+	void onXferToPool (CommandArguments& args, std::string& result);
+	void onXferToPoolJob (CommandArguments& args, std::string& result);
+	void onJobStatus (CommandArguments& args, std::string& result);
+	void onJobCancel (CommandArguments& args, std::string& result);
+	Job* findJob (CommandArguments& args, std::string& result);
+
 	FIDString insertFile (InsertPackage& package);
+	void insertFiles (std::vector<InsertPackage>& packages, std::string& report);
+	void spotFiles (std::vector<InsertPackage>& packages, double projectStart, std::string& report);
 
-	IProjectObject* findDestinationAudioTrack (IProjectObject* parent, uint32 trackOffset);
-	IProjectObject* findDestinationAudioTrack (IProjectObject* parent, uint32 trackOffset, int32& counter);
+	// how "distribute files" picks the track of each file
+	enum TrackLayout
+	{
+		kConsecutiveTracks,		// file i on the i-th track from the selected one
+		kRoundRobinTracks,		// the same, wrapping around after trackCount tracks
+		kCreateTracks			// consecutive, new tracks for the files beyond the last one
+	};
+	void distributeFiles (std::vector<InsertPackage>& packages, TrackLayout layout, uint32 trackCount, std::string& report);
+	double getCursorPosition ();
 
 };
 
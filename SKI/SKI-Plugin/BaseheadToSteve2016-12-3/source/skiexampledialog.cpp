@@ -8,6 +8,8 @@
 #include "common/pluginview_old.h" 
 #include "base/source/fstring.h"
 #include "base/source/tarray.h"
+#include "PoolIndex.h"
+#include "AudioHeader.h"
 
 #include <stdio.h>
 #include <ctype.h>
@@ -618,7 +620,23 @@ void SKIDialogController::projectTest1 ()
 		// get first clip from pool
 		IMedium* clip = pool->getMediumByIndex (0, kAudioObject);
 		FUnknownPtr <IAudioClip> audioClip (clip);
-		IAudioStream* audioStream = audioClip->getIAudioStream ();
+
+		// channels and length from the file header, the audio stream only
+		// if the file cannot be parsed
+		int32 channels = 1;
+		double clipLength = 0.0;
+		std::string filePath;
+		AudioFileInfo info;
+		if (MediaPoolIndex::getPathString (clip->getFilePath (), filePath) && !CAudioInfoCache::shared ().getInfo (filePath, info))
+		{
+			channels = info.nChannels;
+			clipLength = info.getDuration ();
+		}
+		else if (IAudioStream* audioStream = audioClip->getIAudioStream ())
+		{
+			channels = audioStream->getChannels ();
+			clipLength = ((double)audioStream->getFrameCount ()) / project->getNominalSampleRate ();
+		}
 
 		// create an audio track
 		ITrack* track = project->createTrack (kAudioObject);
@@ -626,7 +644,7 @@ void SKIDialogController::projectTest1 ()
 		// init streamcount of track (mono/stereo)
 		FUnknownPtr <IAudioTrack> audioTrack (track);
 		if (audioTrack && audioClip)
-			audioTrack->initializeStreamCount (audioStream->getChannels ());
+			audioTrack->initializeStreamCount (channels);
 		
 		// get a basic edit context
 		IProjectContext* context = project->createContext ();
@@ -653,7 +671,7 @@ void SKIDialogController::projectTest1 ()
 						FUnknownPtr <IProjectObject> audioObj (ae);
 					
 						audioObj->setStartPosition (trackContext, pos);
-						double length = ((double)audioStream->getFrameCount ()) / project->getNominalSampleRate ();
+						double length = clipLength;
 						audioObj->setDuration (trackContext, length);
 				
 						ae->setMedium (trackContext, audioClip);
@@ -667,7 +685,7 @@ void SKIDialogController::projectTest1 ()
 					{
 						ap->initialize (STR ("Test part"), track);
 						FUnknownPtr <IProjectObject> audioObj (ap);
-						double length = ((double)audioStream->getFrameCount ()) / project->getNominalSampleRate ();
+						double length = clipLength;
 						audioObj->setStartPosition (trackContext, pos);
 						audioObj->setDuration (trackContext, length);
 						command->insertObject (trackContext, ap);
@@ -678,7 +696,7 @@ void SKIDialogController::projectTest1 ()
 							ae = HOST_NEW (IAudioEvent);
 
 							FUnknownPtr <IProjectObject> audioObj (ap);
-							double length = ((double)audioStream->getFrameCount ()) / project->getNominalSampleRate ();
+							double length = clipLength;
 							
 							audioObj->setDuration (partContext, length);
 							ae->setDescription (partContext, STR ("Super Hier"));
@@ -7,6 +7,26 @@
 
 #include "strutil.h"
 #include <algorithm>
+#include <charconv>
+#include <cmath>
+#include <ctype.h>
+#include <string.h>
+
+#if defined(__AVX2__)
+#define STRUTIL_AVX2 1
+#endif
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define STRUTIL_SSE2 1
+#endif
+
+#if STRUTIL_AVX2
+#include <immintrin.h>
+#elif STRUTIL_SSE2
+#include <emmintrin.h>
+#endif
+#if defined(_MSC_VER)
+#include <intrin.h>
+#endif
 
 namespace strutil {
 
@@ -80,13 +100,13 @@ namespace strutil {
 
     string toLower(const string& str) {
         string t = str;
-        transform(t.begin(), t.end(), t.begin(), tolower);
+        transform(t.begin(), t.end(), t.begin(), ::tolower);
         return t;
     }
 
     string toUpper(const string& str) {
         string t = str;
-        transform(t.begin(), t.end(), t.begin(), toupper);
+        transform(t.begin(), t.end(), t.begin(), ::toupper);
         return t;
     }
 
@@ -117,6 +137,18 @@ namespace strutil {
         return toLower(str1) == toLower(str2);
     }
 
+    bool equalsIgnoreCase(string_view str1, string_view str2) {
+        if (str1.size() != str2.size()) {
+            return false;
+        }
+        for (size_t i = 0; i < str1.size(); i++) {
+            if (tolower((unsigned char)str1[i]) != tolower((unsigned char)str2[i])) {
+                return false;
+            }
+        }
+        return true;
+    }
+
     template<bool>
     bool parseString(const std::string& str) {
         bool value;
@@ -134,9 +166,11 @@ namespace strutil {
     vector<string> split(const string& str, const string& delimiters) {
         vector<string> ss;
 
-        Tokenizer tokenizer(str, delimiters);
-        while (tokenizer.nextToken()) {
-            ss.push_back(tokenizer.getToken());
+        TokenArray<64> tokens;
+        split(string_view(str), string_view(delimiters), tokens);
+        ss.reserve(tokens.size());
+        for (size_t i = 0; i < tokens.size(); i++) {
+            ss.push_back(string(tokens[i]));
         }
 
         return ss;
@@ -144,6 +178,92 @@ namespace strutil {
 
 }
 
+namespace strutil {
+
+    static inline unsigned countTrailingZeros(unsigned mask) {
+#if defined(_MSC_VER)
+        unsigned long index;
+        _BitScanForward(&index, mask);
+        return (unsigned)index;
+#else
+        return (unsigned)__builtin_ctz(mask);
+#endif
+    }
+
+    size_t findChar(string_view str, char c) {
+        const char* p = str.data();
+        size_t n = str.size();
+        size_t i = 0;
+
+#if STRUTIL_AVX2
+        const __m256i needle32 = _mm256_set1_epi8(c);
+        for (; i + 32 <= n; i += 32) {
+            __m256i chunk = _mm256_loadu_si256((const __m256i*)(p + i));
+            unsigned mask = (unsigned)_mm256_movemask_epi8(_mm256_cmpeq_epi8(chunk, needle32));
+            if (mask) {
+                return i + countTrailingZeros(mask);
+            }
+        }
+#endif
+#if STRUTIL_SSE2
+        const __m128i needle16 = _mm_set1_epi8(c);
+        for (; i + 16 <= n; i += 16) {
+            __m128i chunk = _mm_loadu_si128((const __m128i*)(p + i));
+            unsigned mask = (unsigned)_mm_movemask_epi8(_mm_cmpeq_epi8(chunk, needle16));
+            if (mask) {
+                return i + countTrailingZeros(mask);
+            }
+        }
+#endif
+        for (; i < n; i++) {
+            if (p[i] == c) {
+                return i;
+            }
+        }
+        return n;
+    }
+
+    size_t split(string_view str, string_view delimiters, TokenList& tokens) {
+        size_t count = 0;
+        size_t n = str.size();
+
+        if (delimiters.size() == 1) {
+            char c = delimiters[0];
+            size_t i = 0;
+            while (i < n) {
+                size_t j = i + findChar(str.substr(i), c);
+                if (j > i) {
+                    tokens.push_back(str.substr(i, j - i));
+                    count++;
+                }
+                i = j + 1;
+            }
+            return count;
+        }
+
+        bool isDelimiter[256];
+        memset(isDelimiter, 0, sizeof(isDelimiter));
+        for (size_t k = 0; k < delimiters.size(); k++) {
+            isDelimiter[(unsigned char)delimiters[k]] = true;
+        }
+
+        size_t i = 0;
+        while (i < n) {
+            size_t j = i;
+            while (j < n && !isDelimiter[(unsigned char)str[j]]) {
+                j++;
+            }
+            if (j > i) {
+                tokens.push_back(str.substr(i, j - i));
+                count++;
+            }
+            i = j + 1;
+        }
+        return count;
+    }
+
+}
+
 namespace strutil {
 
     const string Tokenizer::DEFAULT_DELIMITERS(" \t\n\r");
@@ -189,3 +309,57 @@ namespace strutil {
     }
 
 }
+
+namespace strutil {
+
+    static string_view trimNumber(string_view str) {
+        while (!str.empty() && (str.front() == ' ' || str.front() == '\t')) {
+            str.remove_prefix(1);
+        }
+        while (!str.empty() && (str.back() == ' ' || str.back() == '\t')) {
+            str.remove_suffix(1);
+        }
+        if (str.size() > 1 && str.front() == '+') {
+            str.remove_prefix(1);
+        }
+        return str;
+    }
+
+    template<class T> static const char* parseWithFromChars(string_view str, T& value) {
+        str = trimNumber(str);
+        if (str.empty()) {
+            return "empty number";
+        }
+
+        T parsed = T();
+        const char* end = str.data() + str.size();
+        from_chars_result result = from_chars(str.data(), end, parsed);
+        if (result.ec == errc::result_out_of_range) {
+            return "number out of range";
+        }
+        if (result.ec != errc() || result.ptr != end) {
+            return "not a number";
+        }
+
+        value = parsed;
+        return 0;
+    }
+
+    const char* parseNumber(string_view str, unsigned int& value) {
+        return parseWithFromChars(str, value);
+    }
+
+    const char* parseNumber(string_view str, double& value) {
+        double parsed = 0.0;
+        const char* error = parseWithFromChars(str, parsed);
+        if (error) {
+            return error;
+        }
+        if (!std::isfinite(parsed)) {
+            return "not a finite number";
+        }
+        value = parsed;
+        return 0;
+    }
+
+}
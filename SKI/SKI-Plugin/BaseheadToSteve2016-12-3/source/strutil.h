@@ -8,6 +8,7 @@
 #pragma once
 
 #include <string>
+#include <string_view>
 #include <vector>
 #include <sstream>
 #include <iomanip>
@@ -28,6 +29,7 @@ namespace strutil {
     bool startsWith(const std::string& str, const std::string& substr);
     bool endsWith(const std::string& str, const std::string& substr);
     bool equalsIgnoreCase(const std::string& str1, const std::string& str2);
+    bool equalsIgnoreCase(std::string_view str1, std::string_view str2);
 
     template<class T> T parseString(const std::string& str);
     template<class T> T parseHexString(const std::string& str);
@@ -40,6 +42,75 @@ namespace strutil {
     std::vector<std::string> split(const std::string& str, const std::string& delimiters);
 }
 
+// Allocation free splitting into views of the original string
+namespace strutil {
+
+    /**
+    * Tokens as slices of a string that outlives them. The first tokens go
+    * into storage provided by the derived TokenArray, only the ones beyond
+    * its capacity cause a heap allocation.
+    */
+    class TokenList {
+    public:
+        size_t size() const { return m_Count; }
+        bool empty() const { return m_Count == 0; }
+        std::string_view operator[](size_t i) const {
+            return i < m_Capacity ? m_Fixed[i] : m_Spill[i - m_Capacity];
+        }
+
+        void clear() { m_Count = 0; m_Spill.clear(); }
+        void push_back(std::string_view token) {
+            if (m_Count < m_Capacity) {
+                m_Fixed[m_Count] = token;
+            } else {
+                m_Spill.push_back(token);
+            }
+            m_Count++;
+        }
+
+    protected:
+        TokenList(std::string_view* fixed, size_t capacity)
+            : m_Fixed(fixed), m_Capacity(capacity), m_Count(0) {}
+        TokenList(const TokenList&) = delete;
+        TokenList& operator=(const TokenList&) = delete;
+
+        std::string_view* m_Fixed;
+        size_t m_Capacity;
+        size_t m_Count;
+        std::vector<std::string_view> m_Spill;
+    };
+
+    template<size_t N> class TokenArray : public TokenList {
+    public:
+        TokenArray() : TokenList(m_Storage, N) {}
+
+    private:
+        std::string_view m_Storage[N];
+    };
+
+    /**
+    * Appends the tokens of str to tokens and returns their number. Like
+    * split() above, empty tokens are skipped. A single delimiter character
+    * (the usual '\t') is searched with SSE2/AVX2 where available.
+    */
+    size_t split(std::string_view str, std::string_view delimiters, TokenList& tokens);
+
+    // offset of the first c in str, str.size() if there is none
+    size_t findChar(std::string_view str, char c);
+}
+
+// Locale independent number parsing
+namespace strutil {
+
+    /**
+    * All of str (apart from surrounding blanks and a leading '+') has to be
+    * the number; "0.5" is the same on every system locale. Returns 0 on
+    * success, otherwise why str was rejected, and leaves value unchanged.
+    */
+    const char* parseNumber(std::string_view str, unsigned int& value);
+    const char* parseNumber(std::string_view str, double& value);
+}
+
 // Tokenizer class
 namespace strutil {
     class Tokenizer {
@@ -80,7 +151,7 @@ namespace strutil {
     template<class T> T parseHexString(const std::string& str) {
         T value;
         std::istringstream iss(str);
-        iss >> hex >> value;
+        iss >> std::hex >> value;
         return value;
     }
 
@@ -92,9 +163,9 @@ namespace strutil {
 
     template<class T> std::string toHexString(const T& value, int width) {
         std::ostringstream oss;
-        oss << hex;
+        oss << std::hex;
         if (width > 0) {
-            oss << setw(width) << setfill('0');
+            oss << std::setw(width) << std::setfill('0');
         }
         oss << value;
         return oss.str();
@@ -0,0 +1,35 @@
+//------------------------------------------------------------------------
+//
+// Project     : BaseHeadSKI
+// Filename    : TestCheck.h
+// Description : Minimal checks for the standalone tests, no framework
+//
+//------------------------------------------------------------------------
+#if !defined(TESTCHECK_H)
+#define TESTCHECK_H
+
+#include <stdio.h>
+
+static int g_nTestFailures = 0;
+
+// reports the failed condition and carries on with the next check
+#define CHECK(cond) \
+	do { \
+		if (!(cond)) \
+		{ \
+			printf ("%s:%d: CHECK (%s) failed\n", __FILE__, __LINE__, #cond); \
+			g_nTestFailures++; \
+		} \
+	} while (0)
+
+// exit code of main ()
+inline int testResult (const char* szName)
+{
+	if (g_nTestFailures)
+		printf ("%s: %d check(s) failed\n", szName, g_nTestFailures);
+	else
+		printf ("%s: ok\n", szName);
+	return g_nTestFailures ? 1 : 0;
+}
+
+#endif // !defined(TESTCHECK_H)
@@ -0,0 +1,99 @@
+//------------------------------------------------------------------------
+//
+// Project     : BaseHeadSKI
+// Filename    : bench_dispatch.cpp
+// Description : Command lookup through CommandTable against the stricmp
+//				 chain SKIComponent::ReadMessage used before
+//
+//------------------------------------------------------------------------
+#include "CommandTable.h"
+
+#include <chrono>
+#include <string>
+#include <stdio.h>
+#include <strings.h>
+
+#define BENCH_ROUNDS 2000000
+
+// as kCommandNames in skicomponent.cpp
+static constexpr const char* kCommandNames[] =
+{
+	"insert file",
+	"insert files",
+	"spot files",
+	"distribute files",
+	"project path",
+	"xfertopool file",
+	"xfertopool job",
+	"job status",
+	"job cancel",
+	"cursor position",
+	"pool contains"
+};
+static constexpr size_t kCommandCount = sizeof (kCommandNames) / sizeof (kCommandNames[0]);
+static constexpr CommandTable<kCommandCount> kCommands (kCommandNames);
+static_assert (kCommands.isValid (), "no perfect hash for kCommandNames");
+
+// what clients send, in mixed case, and one unknown verb
+static const char* const kInput[] =
+{
+	"Insert File", "insert files", "SPOT FILES", "distribute files",
+	"project path", "XferToPool File", "xfertopool job", "job status",
+	"job cancel", "cursor position", "pool contains", "render mixdown"
+};
+static const size_t kInputCount = sizeof (kInput) / sizeof (kInput[0]);
+
+//------------------------------------------------------------------------
+// one stricmp per verb until one matches, as the old if chain did
+static int findByChain (const char* szName)
+{
+	for (size_t i = 0; i < kCommandCount; i++)
+	{
+		if (strcasecmp (szName, kCommandNames[i]) == 0)
+			return (int)i;
+	}
+	return -1;
+}
+
+//------------------------------------------------------------------------
+int main ()
+{
+	typedef std::chrono::steady_clock Clock;
+
+	// both must agree before the timing means anything
+	for (size_t i = 0; i < kInputCount; i++)
+	{
+		if (kCommands.find (kInput[i]) != findByChain (kInput[i]))
+		{
+			printf ("lookup mismatch for \"%s\"\n", kInput[i]);
+			return 1;
+		}
+	}
+
+	std::string_view views[kInputCount];
+	for (size_t i = 0; i < kInputCount; i++)
+		views[i] = kInput[i];
+
+	volatile int nSink = 0;
+	Clock::time_point start = Clock::now ();
+	for (int n = 0; n < BENCH_ROUNDS; n++)
+	{
+		for (size_t i = 0; i < kInputCount; i++)
+			nSink += kCommands.find (views[i]);
+	}
+	double fTable = std::chrono::duration<double, std::nano> (Clock::now () - start).count ();
+
+	start = Clock::now ();
+	for (int n = 0; n < BENCH_ROUNDS; n++)
+	{
+		for (size_t i = 0; i < kInputCount; i++)
+			nSink += findByChain (kInput[i]);
+	}
+	double fChain = std::chrono::duration<double, std::nano> (Clock::now () - start).count ();
+
+	double fLookups = (double)BENCH_ROUNDS * kInputCount;
+	printf ("command lookup, %.0f lookups over %d verbs\n", fLookups, (int)kCommandCount);
+	printf ("  CommandTable   %6.2f ns/lookup\n", fTable / fLookups);
+	printf ("  stricmp chain  %6.2f ns/lookup\n", fChain / fLookups);
+	return 0;
+}
@@ -0,0 +1,125 @@
+//------------------------------------------------------------------------
+//
+// Project     : BaseHeadSKI
+// Filename    : bench_pipe.cpp
+// Description : Command round trip on one persistent session against a
+//				 reconnect per command, as the pipe did before
+//
+//------------------------------------------------------------------------
+#include "PipeServer.h"
+
+#include <chrono>
+#include <thread>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#define BENCH_COMMANDS 20000
+
+//------------------------------------------------------------------------
+static int connectClient (const string& szPath)
+{
+	int fd = socket (AF_UNIX, SOCK_STREAM, 0);
+	struct sockaddr_un addr;
+	memset (&addr, 0, sizeof (addr));
+	addr.sun_family = AF_UNIX;
+	strcpy (addr.sun_path, szPath.c_str ());
+	if (fd >= 0 && connect (fd, (struct sockaddr*)&addr, sizeof (addr)) != 0)
+	{
+		close (fd);
+		fd = -1;
+	}
+	return fd;
+}
+
+//------------------------------------------------------------------------
+static bool readAll (int fd, void* pData, size_t nBytes)
+{
+	char* p = (char*)pData;
+	while (nBytes > 0)
+	{
+		ssize_t n = ::read (fd, p, nBytes);
+		if (n <= 0)
+			return false;
+		p += n;
+		nBytes -= (size_t)n;
+	}
+	return true;
+}
+
+//------------------------------------------------------------------------
+// one framed command and its reply
+static bool roundTrip (int fd, uint32_t nTag)
+{
+	static const char szCommand[] = "project path";
+	char msg[sizeof (PipeFrameHeader) + sizeof (szCommand) - 1];
+	PipeFrameHeader header = { kPipeFrameMagic, 0, nTag, (uint32_t)(sizeof (szCommand) - 1) };
+	memcpy (msg, &header, sizeof (header));
+	memcpy (msg + sizeof (header), szCommand, sizeof (szCommand) - 1);
+	if (write (fd, msg, sizeof (msg)) != (ssize_t)sizeof (msg))
+		return false;
+
+	char reply[256];
+	if (!readAll (fd, &header, sizeof (header)) || header.tag != nTag || header.length > sizeof (reply))
+		return false;
+	return readAll (fd, reply, header.length);
+}
+
+//------------------------------------------------------------------------
+int main ()
+{
+	CPipeServer server;
+	server.SetPipeName ("bhski_bench_pipe");
+	if (!server.initialize ())
+	{
+		printf ("can't create the server socket\n");
+		return 1;
+	}
+	string szPath = server.GetRealPipeName (true);
+
+	std::thread serverThread ([&server] ()
+	{
+		PipeRequest request;
+		while (server.read (request))
+			server.send (request, "/projects/bench.npr");
+	});
+
+	typedef std::chrono::steady_clock Clock;
+	bool bOk = true;
+
+	// persistent session, the current protocol
+	Clock::time_point start = Clock::now ();
+	int fd = connectClient (szPath);
+	for (uint32_t i = 0; i < BENCH_COMMANDS && bOk; i++)
+		bOk = fd >= 0 && roundTrip (fd, i + 1);
+	if (fd >= 0)
+		close (fd);
+	double fPersistent = std::chrono::duration<double, std::micro> (Clock::now () - start).count ();
+
+	// a new session for every command, the cost the old close/initialize
+	// after each reply put on every command
+	start = Clock::now ();
+	for (uint32_t i = 0; i < BENCH_COMMANDS && bOk; i++)
+	{
+		fd = connectClient (szPath);
+		bOk = fd >= 0 && roundTrip (fd, i + 1);
+		if (fd >= 0)
+			close (fd);
+	}
+	double fReconnect = std::chrono::duration<double, std::micro> (Clock::now () - start).count ();
+
+	server.interrupt ();
+	serverThread.join ();
+
+	if (!bOk)
+	{
+		printf ("round trip failed\n");
+		return 1;
+	}
+	printf ("pipe round trip, %d commands\n", BENCH_COMMANDS);
+	printf ("  persistent session   %8.2f us/command\n", fPersistent / BENCH_COMMANDS);
+	printf ("  reconnect each time  %8.2f us/command\n", fReconnect / BENCH_COMMANDS);
+	return 0;
+}
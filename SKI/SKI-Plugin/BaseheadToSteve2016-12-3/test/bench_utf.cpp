@@ -0,0 +1,151 @@
+//------------------------------------------------------------------------
+//
+// Project     : BaseHeadSKI
+// Filename    : bench_utf.cpp
+// Description : UtfConvert against the system conversion the plug-in
+//				 called before: WideCharToMultiByte/MultiByteToWideChar
+//				 on Windows, iconv elsewhere
+//
+//------------------------------------------------------------------------
+#include "UtfConvert.h"
+
+#include <chrono>
+#include <stdio.h>
+#include <string.h>
+
+#if defined(_WIN32)
+#include <windows.h>
+#else
+#include <iconv.h>
+#endif
+
+#define BENCH_ROUNDS 200000
+
+using namespace std;
+
+//------------------------------------------------------------------------
+// Like the copies in skicomponent.cpp did: measure, then convert into a
+// fixed buffer.
+//------------------------------------------------------------------------
+class SystemConverter
+{
+public:
+#if defined(_WIN32)
+	bool toUtf8 (const u16string& szIn, char* pOut, size_t nOutSize)
+	{
+		int nCount = WideCharToMultiByte (CP_UTF8, 0, (LPCWSTR)szIn.c_str (), -1, 0, 0, 0, 0);
+		if (nCount <= 0 || (size_t)nCount > nOutSize)
+			return false;
+		return WideCharToMultiByte (CP_UTF8, 0, (LPCWSTR)szIn.c_str (), -1, pOut, nCount, 0, 0) > 0;
+	}
+
+	bool toUtf16 (const string& szIn, char16_t* pOut, size_t nOutSize)
+	{
+		int nCount = MultiByteToWideChar (CP_UTF8, 0, szIn.c_str (), -1, 0, 0);
+		if (nCount <= 0 || (size_t)nCount > nOutSize)
+			return false;
+		return MultiByteToWideChar (CP_UTF8, 0, szIn.c_str (), -1, (LPWSTR)pOut, nCount) > 0;
+	}
+#else
+	SystemConverter ()
+	{
+		m_To8 = iconv_open ("UTF-8", "UTF-16LE");
+		m_To16 = iconv_open ("UTF-16LE", "UTF-8");
+	}
+	~SystemConverter ()
+	{
+		iconv_close (m_To8);
+		iconv_close (m_To16);
+	}
+
+	bool toUtf8 (const u16string& szIn, char* pOut, size_t nOutSize)
+	{
+		return convert (m_To8, (const char*)szIn.c_str (), (szIn.size () + 1) * 2, pOut, nOutSize);
+	}
+
+	bool toUtf16 (const string& szIn, char16_t* pOut, size_t nOutSize)
+	{
+		return convert (m_To16, szIn.c_str (), szIn.size () + 1, (char*)pOut, nOutSize * 2);
+	}
+
+private:
+	static bool convert (iconv_t cd, const char* pIn, size_t nInBytes, char* pOut, size_t nOutBytes)
+	{
+		char* pSrc = (char*)pIn;
+		return iconv (cd, &pSrc, &nInBytes, &pOut, &nOutBytes) != (size_t)-1;
+	}
+
+	iconv_t m_To8;
+	iconv_t m_To16;
+#endif
+};
+
+//------------------------------------------------------------------------
+static double nsPerCall (chrono::steady_clock::time_point start, size_t nCalls)
+{
+	return chrono::duration<double, nano> (chrono::steady_clock::now () - start).count () / nCalls;
+}
+
+//------------------------------------------------------------------------
+int main ()
+{
+	// what the pipe carries: mostly ASCII library paths, some not
+	static const char16_t* const kPaths[] =
+	{
+		u"C:\\Sound Library\\Ambience\\Forest\\Forest_Birds_Morning_01.wav",
+		u"D:\\SFX\\Foley\\Footsteps\\Gravel_Walk_Slow_Stereo_96k.wav",
+		u"C:\\Users\\J\x00FCrgen\\M\x00FCsik\\Ger\x00E4usche\\T\x00FCr_Knarren.wav",
+		u"E:\\\x97F3\x58F0\\\x52B9\x679C\x97F3\\\x96E8\x306E\x97F3.wav",
+	};
+	static const size_t kPathCount = sizeof (kPaths) / sizeof (kPaths[0]);
+
+	SystemConverter system;
+	typedef chrono::steady_clock Clock;
+
+	printf ("UTF conversion, ns per path\n");
+	printf ("  %-8s %10s %10s %10s %10s\n", "path", "to 8", "system", "to 16", "system");
+	for (size_t i = 0; i < kPathCount; i++)
+	{
+		u16string szWide = kPaths[i];
+		string szNarrow = toUtf8 (szWide);
+
+		// both must agree before the timing means anything
+		char buffer[1024];
+		char16_t wideBuffer[1024];
+		if (!system.toUtf8 (szWide, buffer, sizeof (buffer)) || szNarrow != buffer)
+		{
+			printf ("UTF-8 of path %d differs from the system's\n", (int)i);
+			return 1;
+		}
+		if (!system.toUtf16 (szNarrow, wideBuffer, 1024) || szWide != wideBuffer)
+		{
+			printf ("UTF-16 of path %d differs from the system's\n", (int)i);
+			return 1;
+		}
+
+		string szOut;
+		u16string szWideOut;
+		Clock::time_point start = Clock::now ();
+		for (int n = 0; n < BENCH_ROUNDS; n++)
+			utf16ToUtf8 (szWide, szOut);
+		double fTo8 = nsPerCall (start, BENCH_ROUNDS);
+
+		start = Clock::now ();
+		for (int n = 0; n < BENCH_ROUNDS; n++)
+			system.toUtf8 (szWide, buffer, sizeof (buffer));
+		double fSystemTo8 = nsPerCall (start, BENCH_ROUNDS);
+
+		start = Clock::now ();
+		for (int n = 0; n < BENCH_ROUNDS; n++)
+			utf8ToUtf16 (szNarrow, szWideOut);
+		double fTo16 = nsPerCall (start, BENCH_ROUNDS);
+
+		start = Clock::now ();
+		for (int n = 0; n < BENCH_ROUNDS; n++)
+			system.toUtf16 (szNarrow, wideBuffer, 1024);
+		double fSystemTo16 = nsPerCall (start, BENCH_ROUNDS);
+
+		printf ("  %-8d %10.1f %10.1f %10.1f %10.1f\n", (int)i + 1, fTo8, fSystemTo8, fTo16, fSystemTo16);
+	}
+	return 0;
+}
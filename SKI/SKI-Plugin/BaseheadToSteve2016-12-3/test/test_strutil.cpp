@@ -0,0 +1,240 @@
+//------------------------------------------------------------------------
+//
+// Project     : BaseHeadSKI
+// Filename    : test_strutil.cpp
+// Description : Splitting, the SIMD character search and number parsing
+//				 of strutil
+//
+//------------------------------------------------------------------------
+#include "strutil.h"
+#include "TestCheck.h"
+
+#include <charconv>
+#include <limits.h>
+#include <locale.h>
+#include <math.h>
+#include <string.h>
+
+using namespace std;
+
+//------------------------------------------------------------------------
+static string joinTokens (const strutil::TokenList& tokens)
+{
+	string szJoined;
+	for (size_t i = 0; i < tokens.size (); i++)
+	{
+		if (i > 0)
+			szJoined += '|';
+		szJoined += tokens[i];
+	}
+	return szJoined;
+}
+
+//------------------------------------------------------------------------
+static void testSplit ()
+{
+	strutil::TokenArray<8> tokens;
+
+	// empty tokens are skipped, wherever the delimiters are
+	CHECK (strutil::split (string_view ("insert file\t\ta.wav\t"), "\t", tokens) == 2);
+	CHECK (joinTokens (tokens) == "insert file|a.wav");
+
+	tokens.clear ();
+	CHECK (strutil::split (string_view ("\t\tx"), "\t", tokens) == 1);
+	CHECK (joinTokens (tokens) == "x");
+
+	tokens.clear ();
+	CHECK (strutil::split (string_view (""), "\t", tokens) == 0);
+	CHECK (strutil::split (string_view ("\t\t\t"), "\t", tokens) == 0);
+	CHECK (tokens.empty ());
+
+	// several delimiters take the table path
+	tokens.clear ();
+	CHECK (strutil::split (string_view ("  a \tb\r\n\tc "), " \t\r\n", tokens) == 3);
+	CHECK (joinTokens (tokens) == "a|b|c");
+
+	// appends, the count is of this call only
+	CHECK (strutil::split (string_view ("d"), " ", tokens) == 1);
+	CHECK (joinTokens (tokens) == "a|b|c|d");
+
+	// beyond the fixed storage the tokens spill to the heap
+	strutil::TokenArray<2> small;
+	CHECK (strutil::split (string_view ("1\t2\t3\t4\t5"), "\t", small) == 5);
+	CHECK (small.size () == 5);
+	CHECK (joinTokens (small) == "1|2|3|4|5");
+	small.clear ();
+	CHECK (small.empty ());
+	CHECK (strutil::split (string_view ("6\t7\t8"), "\t", small) == 3);
+	CHECK (joinTokens (small) == "6|7|8");
+
+	// the tokens are views into the input
+	string szLine = "a\tbc";
+	tokens.clear ();
+	strutil::split (string_view (szLine), "\t", tokens);
+	CHECK (tokens[1].data () == szLine.data () + 2);
+
+	// a token longer than the SIMD blocks
+	string szLong (70, 'x');
+	tokens.clear ();
+	CHECK (strutil::split (string_view (szLong + "\ty"), "\t", tokens) == 2);
+	CHECK (tokens[0].size () == 70 && tokens[1] == "y");
+
+	vector<string> parts = strutil::split (string ("a,,b,"), ",");
+	CHECK (parts.size () == 2 && parts[0] == "a" && parts[1] == "b");
+}
+
+//------------------------------------------------------------------------
+static void testFindChar ()
+{
+	// around the 16 byte SSE2 and 32 byte AVX2 blocks and their tails
+	static const size_t kLengths[] = { 0, 1, 15, 16, 17, 31, 32, 33, 47, 48, 63, 64, 65 };
+
+	for (size_t l = 0; l < sizeof (kLengths) / sizeof (kLengths[0]); l++)
+	{
+		size_t n = kLengths[l];
+
+		// a match right behind the view must not be found
+		string szBuffer (n + 64, '.');
+		szBuffer[n] = '\t';
+		string_view str (szBuffer.data (), n);
+		CHECK (strutil::findChar (str, '\t') == n);
+
+		for (size_t i = 0; i < n; i++)
+		{
+			szBuffer[i] = '\t';
+			CHECK (strutil::findChar (str, '\t') == i);
+
+			// the first of two
+			if (i + 1 < n)
+			{
+				szBuffer[n - 1] = '\t';
+				CHECK (strutil::findChar (str, '\t') == i);
+				szBuffer[n - 1] = '.';
+			}
+			szBuffer[i] = '.';
+		}
+
+		// and from an unaligned start
+		if (n > 1)
+		{
+			szBuffer[n - 1] = '\t';
+			CHECK (strutil::findChar (string_view (szBuffer.data () + 1, n - 1), '\t') == n - 2);
+			szBuffer[n - 1] = '.';
+		}
+	}
+
+	// bytes with the high bit set compare as themselves
+	string szBytes = "abc\xE9\xFF";
+	CHECK (strutil::findChar (szBytes, '\xFF') == 4);
+	CHECK (strutil::findChar (szBytes, '\xE9') == 3);
+}
+
+//------------------------------------------------------------------------
+static void testParseUInt ()
+{
+	unsigned int nValue = 0;
+	CHECK (strutil::parseNumber ("42", nValue) == 0 && nValue == 42);
+	CHECK (strutil::parseNumber ("+7", nValue) == 0 && nValue == 7);
+	CHECK (strutil::parseNumber (" \t12 ", nValue) == 0 && nValue == 12);
+	CHECK (strutil::parseNumber ("0", nValue) == 0 && nValue == 0);
+	CHECK (strutil::parseNumber ("4294967295", nValue) == 0 && nValue == UINT_MAX);
+
+	// rejected values leave nValue alone
+	nValue = 99;
+	CHECK (strutil::parseNumber ("-1", nValue) != 0);
+	CHECK (strutil::parseNumber ("+-1", nValue) != 0);
+	CHECK (strutil::parseNumber ("++1", nValue) != 0);
+	CHECK (strutil::parseNumber ("+", nValue) != 0);
+	CHECK (strutil::parseNumber ("", nValue) != 0);
+	CHECK (strutil::parseNumber ("  ", nValue) != 0);
+	CHECK (strutil::parseNumber ("12abc", nValue) != 0);
+	CHECK (strutil::parseNumber ("1 2", nValue) != 0);
+	CHECK (strutil::parseNumber ("1.5", nValue) != 0);
+	CHECK (strutil::parseNumber ("0x10", nValue) != 0);
+	CHECK (nValue == 99);
+
+	const char* szError = strutil::parseNumber ("4294967296", nValue);
+	CHECK (szError && strcmp (szError, "number out of range") == 0);
+	CHECK (strutil::parseNumber ("99999999999999999999", nValue) != 0);
+	CHECK (nValue == 99);
+
+	szError = strutil::parseNumber ("", nValue);
+	CHECK (szError && strcmp (szError, "empty number") == 0);
+}
+
+//------------------------------------------------------------------------
+static void testParseDouble ()
+{
+	double fValue = 0.0;
+	CHECK (strutil::parseNumber ("0.5", fValue) == 0 && fValue == 0.5);
+	CHECK (strutil::parseNumber ("+0.25", fValue) == 0 && fValue == 0.25);
+	CHECK (strutil::parseNumber ("-3", fValue) == 0 && fValue == -3.0);
+	CHECK (strutil::parseNumber (" 1e3 ", fValue) == 0 && fValue == 1000.0);
+	CHECK (strutil::parseNumber ("-0", fValue) == 0 && fValue == 0.0 && signbit (fValue));
+
+	fValue = 1.25;
+	CHECK (strutil::parseNumber ("inf", fValue) != 0);
+	CHECK (strutil::parseNumber ("-inf", fValue) != 0);
+	CHECK (strutil::parseNumber ("infinity", fValue) != 0);
+	CHECK (strutil::parseNumber ("nan", fValue) != 0);
+	CHECK (strutil::parseNumber ("NaN", fValue) != 0);
+	CHECK (strutil::parseNumber ("1e400", fValue) != 0);
+	CHECK (strutil::parseNumber ("0,5", fValue) != 0);
+	CHECK (strutil::parseNumber ("1.5x", fValue) != 0);
+	CHECK (strutil::parseNumber ("1.5 s", fValue) != 0);
+	CHECK (strutil::parseNumber (".", fValue) != 0);
+	CHECK (strutil::parseNumber ("", fValue) != 0);
+	CHECK (fValue == 1.25);
+
+	// the shortest form of a double reads back as the same double
+	static const double kValues[] = { 0.1, 1.0 / 3.0, 2.5e-310, 1.7976931348623157e308, 44100.0, 0.999999999999, 123456.789e-12 };
+	for (size_t i = 0; i < sizeof (kValues) / sizeof (kValues[0]); i++)
+	{
+		for (int nSign = -1; nSign <= 1; nSign += 2)
+		{
+			double fIn = kValues[i] * nSign;
+			char szText[64];
+			to_chars_result result = to_chars (szText, szText + sizeof (szText), fIn);
+			CHECK (result.ec == errc ());
+
+			double fOut = 0.0;
+			CHECK (strutil::parseNumber (string_view (szText, result.ptr - szText), fOut) == 0);
+			CHECK (fOut == fIn);
+
+			snprintf (szText, sizeof (szText), "%.17g", fIn);
+			fOut = 0.0;
+			CHECK (strutil::parseNumber (szText, fOut) == 0);
+			CHECK (fOut == fIn);
+		}
+	}
+}
+
+//------------------------------------------------------------------------
+// a comma decimal locale must not change what "0.5" means
+static void testLocale ()
+{
+	static const char* const kLocales[] = { "de_DE.UTF-8", "de_DE", "German_Germany.1252" };
+	for (size_t i = 0; i < sizeof (kLocales) / sizeof (kLocales[0]); i++)
+	{
+		if (setlocale (LC_ALL, kLocales[i]))
+		{
+			double fValue = 0.0;
+			CHECK (strutil::parseNumber ("0.5", fValue) == 0 && fValue == 0.5);
+			CHECK (strutil::parseNumber ("0,5", fValue) != 0);
+			setlocale (LC_ALL, "C");
+			return;
+		}
+	}
+	printf ("test_strutil: no comma decimal locale installed, locale check skipped\n");
+}
+
+//------------------------------------------------------------------------
+int main ()
+{
+	testSplit ();
+	testFindChar ();
+	testParseUInt ();
+	testParseDouble ();
+	testLocale ();
+	return testResult ("test_strutil");
+}
@@ -0,0 +1,214 @@
+//------------------------------------------------------------------------
+//
+// Project     : BaseHeadSKI
+// Filename    : test_utf.cpp
+// Description : UTF-16 <-> UTF-8 conversion of UtfConvert against a plain
+//				 one code point at a time reference
+//
+//------------------------------------------------------------------------
+#include "UtfConvert.h"
+#include "TestCheck.h"
+
+#include <stdint.h>
+
+using namespace std;
+
+static const char* const kReplacement = "\xEF\xBF\xBD";
+
+//------------------------------------------------------------------------
+static void appendUtf8 (string& szOut, uint32_t c)
+{
+	if (c < 0x80)
+		szOut += (char)c;
+	else if (c < 0x800)
+	{
+		szOut += (char)(0xC0 | (c >> 6));
+		szOut += (char)(0x80 | (c & 0x3F));
+	}
+	else if (c < 0x10000)
+	{
+		szOut += (char)(0xE0 | (c >> 12));
+		szOut += (char)(0x80 | ((c >> 6) & 0x3F));
+		szOut += (char)(0x80 | (c & 0x3F));
+	}
+	else
+	{
+		szOut += (char)(0xF0 | (c >> 18));
+		szOut += (char)(0x80 | ((c >> 12) & 0x3F));
+		szOut += (char)(0x80 | ((c >> 6) & 0x3F));
+		szOut += (char)(0x80 | (c & 0x3F));
+	}
+}
+
+//------------------------------------------------------------------------
+static void appendUtf16 (u16string& szOut, uint32_t c)
+{
+	if (c < 0x10000)
+		szOut += (char16_t)c;
+	else
+	{
+		szOut += (char16_t)(0xD800 + ((c - 0x10000) >> 10));
+		szOut += (char16_t)(0xDC00 + ((c - 0x10000) & 0x3FF));
+	}
+}
+
+//------------------------------------------------------------------------
+static bool convertsTo (const u16string& szIn, const string& szExpected, bool bValid)
+{
+	string szOut = "left over";
+	return utf16ToUtf8 (szIn, szOut) == bValid && szOut == szExpected;
+}
+
+static bool convertsTo (const string& szIn, const u16string& szExpected, bool bValid)
+{
+	u16string szOut = u"left over";
+	return utf8ToUtf16 (szIn, szOut) == bValid && szOut == szExpected;
+}
+
+//------------------------------------------------------------------------
+// every scalar value there is, both ways
+static void testAllCodePoints ()
+{
+	string szUtf8;
+	u16string szUtf16;
+	for (uint32_t c = 0; c <= 0x10FFFF; c++)
+	{
+		if (c >= 0xD800 && c < 0xE000)
+			continue;
+		appendUtf8 (szUtf8, c);
+		appendUtf16 (szUtf16, c);
+	}
+
+	string szOut8;
+	u16string szOut16;
+	CHECK (utf16ToUtf8 (szUtf16, szOut8) && szOut8 == szUtf8);
+	CHECK (utf8ToUtf16 (szUtf8, szOut16) && szOut16 == szUtf16);
+	CHECK (toUtf16 (toUtf8 (szUtf16)) == szUtf16);
+}
+
+//------------------------------------------------------------------------
+static void testUnpairedSurrogates ()
+{
+	string szBad = kReplacement;
+
+	CHECK (convertsTo (u"\xD83D\xDE00", "\xF0\x9F\x98\x80", true));
+	CHECK (convertsTo (u16string (u"a\xD800"), "a" + szBad, false));	// high at the end
+	CHECK (convertsTo (u16string (u"\xD800") + u"b", szBad + "b", false));
+	CHECK (convertsTo (u16string (u"\xDC00") + u"b", szBad + "b", false));	// low alone
+	CHECK (convertsTo (u16string (u"\xDFFF"), szBad, false));
+	CHECK (convertsTo (u16string (u"\xDC00\xD800"), szBad + szBad, false));	// the wrong way round
+	CHECK (convertsTo (u16string (u"\xD800\xD800\xDC00"), szBad + "\xF0\x90\x80\x80", false));
+
+	// and inside an ASCII run, past a SIMD block
+	u16string szIn = u"0123456789";
+	szIn += (char16_t)0xDBFF;
+	szIn += u"abcdefgh";
+	CHECK (convertsTo (szIn, "0123456789" + szBad + "abcdefgh", false));
+}
+
+//------------------------------------------------------------------------
+static void testMalformedUtf8 ()
+{
+	string szBad = kReplacement;
+	u16string szBad16 (1, (char16_t)0xFFFD);
+
+	// overlong forms of '/' and of U+0000
+	CHECK (convertsTo (string ("\xC0\xAF"), szBad16 + szBad16, false));	// C0 can never start one
+	CHECK (convertsTo (string ("\xC1\xBF"), szBad16 + szBad16, false));
+	CHECK (convertsTo (string ("\xE0\x80\xAF"), szBad16, false));
+	CHECK (convertsTo (string ("\xE0\x9F\xBF"), szBad16, false));		// U+07FF in three bytes
+	CHECK (convertsTo (string ("\xF0\x80\x80\xAF"), szBad16, false));
+	CHECK (convertsTo (string ("\xF0\x8F\xBF\xBF"), szBad16, false));	// U+FFFF in four bytes
+
+	// the shortest forms around those limits are fine
+	CHECK (convertsTo (string ("\xC2\x80"), u"\x0080", true));
+	CHECK (convertsTo (string ("\xE0\xA0\x80"), u"\x0800", true));
+	CHECK (convertsTo (string ("\xF0\x90\x80\x80"), u"\xD800\xDC00", true));
+	CHECK (convertsTo (string ("\xF4\x8F\xBF\xBF"), u"\xDBFF\xDFFF", true));
+
+	// encoded surrogates
+	CHECK (convertsTo (string ("\xED\xA0\x80"), szBad16, false));
+	CHECK (convertsTo (string ("\xED\xBF\xBF"), szBad16, false));
+	CHECK (convertsTo (string ("\xED\x9F\xBF"), u"\xD7FF", true));
+
+	// above U+10FFFF
+	CHECK (convertsTo (string ("\xF4\x90\x80\x80"), szBad16, false));
+	CHECK (convertsTo (string ("\xF5\x80\x80\x80"), szBad16 + szBad16 + szBad16 + szBad16, false));
+	CHECK (convertsTo (string ("\xFF"), szBad16, false));
+
+	// truncated at the end, and broken by the next character
+	CHECK (convertsTo (string ("a\xC3"), u"a" + szBad16, false));
+	CHECK (convertsTo (string ("a\xE2\x82"), u"a" + szBad16, false));
+	CHECK (convertsTo (string ("a\xF0\x9F\x98"), u"a" + szBad16, false));
+	CHECK (convertsTo (string ("\xE2\x82" "A"), szBad16 + u"A", false));
+	CHECK (convertsTo (string ("\x80\xBF"), szBad16 + szBad16, false));	// lone continuation bytes
+
+	CHECK (convertsTo (string (""), u"", true));
+	CHECK (convertsTo (u16string (), "", true));
+}
+
+//------------------------------------------------------------------------
+// ASCII runs of every length up to past the 8 unit (UTF-16) and 16 byte
+// (UTF-8) blocks, each with one other character at every position
+static void testAsciiBlocks ()
+{
+	static const uint32_t kOthers[] = { 0xE9, 0x20AC, 0x1F600 };
+
+	for (size_t n = 0; n <= 40; n++)
+	{
+		for (size_t o = 0; o < sizeof (kOthers) / sizeof (kOthers[0]); o++)
+		{
+			for (size_t k = 0; k <= n; k++)
+			{
+				string szUtf8;
+				u16string szUtf16;
+				for (size_t i = 0; i < n; i++)
+				{
+					uint32_t c = (i == k) ? kOthers[o] : (uint32_t)('A' + (i % 26));
+					appendUtf8 (szUtf8, c);
+					appendUtf16 (szUtf16, c);
+				}
+
+				string szOut8;
+				u16string szOut16;
+				CHECK (utf16ToUtf8 (szUtf16, szOut8) && szOut8 == szUtf8);
+				CHECK (utf8ToUtf16 (szUtf8, szOut16) && szOut16 == szUtf16);
+			}
+		}
+
+		// from an unaligned start, with a non-ASCII unit right behind the
+		// view that must not be read
+		string szAscii (n + 1, 'x');
+		szAscii[n] = '\xC3';
+		u16string szOut16;
+		CHECK (utf8ToUtf16 (szAscii.data (), n, szOut16) && szOut16 == u16string (n, u'x'));
+
+		u16string szWide (n + 1, u'x');
+		szWide[n] = (char16_t)0xD800;
+		string szOut8;
+		CHECK (utf16ToUtf8 (szWide.data (), n, szOut8) && szOut8 == string (n, 'x'));
+	}
+}
+
+//------------------------------------------------------------------------
+// paths longer than the 1024 byte buffers the plug-in used before
+static void testLongText ()
+{
+	u16string szPath;
+	for (int i = 0; i < 300; i++)
+		szPath += u"\\Ordner \x00FC\x00E4 \x65E5\x672C";
+	string szUtf8 = toUtf8 (szPath);
+	CHECK (szUtf8.size () > 4096);
+	CHECK (toUtf16 (szUtf8) == szPath);
+}
+
+//------------------------------------------------------------------------
+int main ()
+{
+	testAllCodePoints ();
+	testUnpairedSurrogates ();
+	testMalformedUtf8 ();
+	testAsciiBlocks ();
+	testLongText ();
+	return testResult ("test_utf");
+}